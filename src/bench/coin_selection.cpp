@@ -62,6 +62,44 @@ static void CoinSelection(benchmark::Bench& bench)
     });
 }
 
+// Coin selection in a wallet with many outputs of varied value, as built up by
+// staking and by receiving many payments. The knapsack solver is run if branch
+// and bound finds no solution, as in CWallet::CreateTransaction.
+static void CoinSelectionLargePool(benchmark::Bench& bench)
+{
+    NodeContext node;
+    auto chain = interfaces::MakeChain(node);
+    CWallet wallet(chain.get(), "", CreateDummyWalletDatabase());
+    wallet.SetupLegacyScriptPubKeyMan();
+    std::vector<std::unique_ptr<CWalletTx>> wtxs;
+    LOCK(wallet.cs_wallet);
+
+    // Add coins.
+    for (int i = 0; i < 20000; ++i) {
+        addCoin((i % 500 + 1) * COIN / 100 + i, wallet, wtxs);
+    }
+
+    // Create groups
+    std::vector<OutputGroup> groups;
+    for (const auto& wtx : wtxs) {
+        COutput output(wtx.get(), 0 /* iIn */, 6 * 24 /* nDepthIn */, true /* spendable */, true /* solvable */, true /* safe */);
+        groups.emplace_back(output.GetInputCoin(), 6, false, 0, 0);
+    }
+
+    const CoinEligibilityFilter filter_standard(1, 6, 0);
+    const CoinSelectionParams params_bnb(true, 34, 148, CFeeRate(1000), 10);
+    const CoinSelectionParams params_knapsack(false, 34, 148, CFeeRate(1000), 10);
+    bench.run([&] {
+        std::set<CInputCoin> setCoinsRet;
+        CAmount nValueRet;
+        bool bnb_used;
+        bool success = wallet.SelectCoinsMinConf(25 * COIN, filter_standard, groups, setCoinsRet, nValueRet, params_bnb, bnb_used) ||
+            wallet.SelectCoinsMinConf(25 * COIN, filter_standard, groups, setCoinsRet, nValueRet, params_knapsack, bnb_used);
+        assert(success);
+        assert(nValueRet >= 25 * COIN);
+    });
+}
+
 typedef std::set<CInputCoin> CoinSet;
 static NodeContext testNode;
 static auto testChain = interfaces::MakeChain(testNode);
@@ -112,4 +150,5 @@ static void BnBExhaustion(benchmark::Bench& bench)
 }
 
 BENCHMARK(CoinSelection);
+BENCHMARK(CoinSelectionLargePool);
 BENCHMARK(BnBExhaustion);
@@ -16,15 +16,25 @@
 
 #include <unordered_map>
 
+/** The coinbase, and the coinstake of a proof-of-stake block, are never in a peer's mempool. */
+static size_t GetAlwaysPrefilledCount(const CBlock& block)
+{
+    return block.IsProofOfStake() && block.vtx.size() > 1 && block.vtx[1]->IsCoinStake() ? 2 : 1;
+}
+
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
-        shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block), vchBlockSig(block.vchBlockSig) {
+        shorttxids(block.vtx.size() - GetAlwaysPrefilledCount(block)), prefilledtxn(GetAlwaysPrefilledCount(block)),
+        header(block), vchBlockSig(block.vchBlockSig) {
     FillShortTxIDSelector();
-    //TODO: Use our mempool prior to block acceptance to predictively fill more than just the coinbase
-    prefilledtxn[0] = {0, block.vtx[0]};
-    for (size_t i = 1; i < block.vtx.size(); i++) {
+    //TODO: Use our mempool prior to block acceptance to predictively fill more than just the coinbase and coinstake
+    // Prefilled indexes are differentially encoded, so consecutive transactions all have index 0.
+    for (size_t i = 0; i < prefilledtxn.size(); i++) {
+        prefilledtxn[i] = {0, block.vtx[i]};
+    }
+    for (size_t i = prefilledtxn.size(); i < block.vtx.size(); i++) {
         const CTransaction& tx = *block.vtx[i];
-        shorttxids[i - 1] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
+        shorttxids[i - prefilledtxn.size()] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
     }
 }
 
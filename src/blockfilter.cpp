@@ -2,9 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <atomic>
+#include <exception>
 #include <mutex>
 #include <sstream>
 #include <set>
+#include <thread>
 
 #include <blockfilter.h>
 #include <crypto/siphash.h>
@@ -92,11 +95,11 @@ GCSFilter::GCSFilter(const Params& params, std::vector<unsigned char> encoded_fi
 
     // Verify that the encoded filter contains exactly N elements. If it has too much or too little
     // data, a std::ios_base::failure exception will be raised.
-    BitStreamReader<VectorReader> bitreader(stream);
+    GolombRiceReader reader(m_encoded.data() + GetSizeOfCompactSize(N), m_encoded.data() + m_encoded.size());
     for (uint64_t i = 0; i < m_N; ++i) {
-        GolombRiceDecode(bitreader, m_params.m_P);
+        reader.Decode(m_params.m_P);
     }
-    if (!stream.empty()) {
+    if (reader.BitsLeft() >= 8) {
         throw std::ios_base::failure("encoded_filter contains excess data");
     }
 }
@@ -133,18 +136,13 @@ GCSFilter::GCSFilter(const Params& params, const ElementSet& elements)
 
 bool GCSFilter::MatchInternal(const uint64_t* element_hashes, size_t size) const
 {
-    VectorReader stream(GCS_SER_TYPE, GCS_SER_VERSION, m_encoded, 0);
-
     // Seek forward by size of N
-    uint64_t N = ReadCompactSize(stream);
-    assert(N == m_N);
-
-    BitStreamReader<VectorReader> bitreader(stream);
+    GolombRiceReader reader(m_encoded.data() + GetSizeOfCompactSize(m_N), m_encoded.data() + m_encoded.size());
 
     uint64_t value = 0;
     size_t hashes_index = 0;
     for (uint32_t i = 0; i < m_N; ++i) {
-        uint64_t delta = GolombRiceDecode(bitreader, m_params.m_P);
+        uint64_t delta = reader.Decode(m_params.m_P);
         value += delta;
 
         while (true) {
@@ -175,6 +173,43 @@ bool GCSFilter::MatchAny(const ElementSet& elements) const
     return MatchInternal(queries.data(), queries.size());
 }
 
+std::vector<size_t> MatchAnyBatch(const std::vector<BlockFilter>& filters, const GCSFilter::ElementSet& elements, int num_threads)
+{
+    // Each filter is matched by exactly one thread, which records the result at the filter's
+    // position. Results are bytes rather than a std::vector<bool> so threads never share a word.
+    std::vector<unsigned char> matches(filters.size(), 0);
+    std::atomic<size_t> next{0};
+    std::exception_ptr failure;
+    std::mutex failure_mutex;
+    const auto match = [&]() {
+        try {
+            for (size_t i = next++; i < filters.size(); i = next++) {
+                matches[i] = filters[i].GetFilter().MatchAny(elements);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(failure_mutex);
+            failure = std::current_exception();
+            next = filters.size();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_threads && size_t(i) < filters.size(); ++i) {
+        threads.emplace_back(match);
+    }
+    match();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (failure) std::rethrow_exception(failure);
+
+    std::vector<size_t> result;
+    for (size_t i = 0; i < matches.size(); ++i) {
+        if (matches[i]) result.push_back(i);
+    }
+    return result;
+}
+
 const std::string& BlockFilterTypeName(BlockFilterType filter_type)
 {
     static std::string unknown_retval = "";
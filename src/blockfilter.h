@@ -168,4 +168,12 @@ public:
     }
 };
 
+/**
+ * Checks which of the given filters may contain any of the elements, as
+ * BlockFilter::GetFilter().MatchAny does for a single filter, spreading the
+ * filters over up to num_threads threads. Returns the positions of the
+ * matching filters in ascending order.
+ */
+std::vector<size_t> MatchAnyBatch(const std::vector<BlockFilter>& filters, const GCSFilter::ElementSet& elements, int num_threads);
+
 #endif // BITCOIN_BLOCKFILTER_H
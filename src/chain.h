@@ -195,6 +195,11 @@ public:
     int64_t nMoneySupply{0};
     int64_t nTreasuryPayment{0};
 
+    //! (memory only) Total nMint and nTreasuryPayment of the chain up to and including this block,
+    //! so the emission of any stretch of the chain is the difference of two entries.
+    int64_t nChainMint{0};
+    int64_t nChainTreasuryPayment{0};
+
     // peercoin: proof-of-stake related block index fields
     unsigned int nFlags{0};  // peercoin: block index flags
     enum
@@ -92,6 +92,13 @@ typedef char* sockopt_arg_type;
 #define USE_POLL
 #endif
 
+// epoll lets the socket handler keep sockets registered across iterations and
+// only be woken for the ones that changed state. poll() remains the fallback
+// when the epoll instance cannot be created.
+#if defined(__linux__)
+#define USE_EPOLL
+#endif
+
 bool static inline IsSelectableSocket(const SOCKET& s) {
 #if defined(USE_POLL) || defined(WIN32)
     return true;
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_COMPRESSOR_H
 #define BITCOIN_COMPRESSOR_H
 
+#include <primitives/block.h>
 #include <primitives/transaction.h>
 #include <script/script.h>
 #include <serialize.h>
@@ -103,4 +104,91 @@ struct TxOutCompression
     FORMATTER_METHODS(CTxOut, obj) { READWRITE(Using<AmountCompression>(obj.nValue), Using<ScriptCompression>(obj.scriptPubKey)); }
 };
 
+/** Whether BlockCompression reproduces block exactly. It does unless an output
+ *  amount is out of range or an output script is too large to be compressed. */
+bool IsCompressibleBlock(const CBlock& block);
+
+/** Compact serializer for transactions stored in block files.
+ *
+ *  The version, input sequence numbers and lock time are stored as VARINTs,
+ *  outputs use TxOutCompression, and the witness flag is a single byte.
+ */
+struct TxCompression
+{
+    template<typename Stream> void Ser(Stream& s, const CTransactionRef& tx)
+    {
+        const uint32_t version = tx->nVersion;
+        s << VARINT(version);
+        WriteCompactSize(s, tx->vin.size());
+        for (const CTxIn& txin : tx->vin) {
+            const uint32_t sequence = ~txin.nSequence;
+            s << txin.prevout << txin.scriptSig << VARINT(sequence);
+        }
+        WriteCompactSize(s, tx->vout.size());
+        for (const CTxOut& txout : tx->vout) {
+            s << Using<TxOutCompression>(txout);
+        }
+        const uint8_t has_witness = tx->HasWitness();
+        s << has_witness;
+        if (has_witness) {
+            for (const CTxIn& txin : tx->vin) {
+                s << txin.scriptWitness.stack;
+            }
+        }
+        s << VARINT(tx->nLockTime);
+    }
+
+    template<typename Stream> void Unser(Stream& s, CTransactionRef& tx)
+    {
+        CMutableTransaction mtx;
+        uint32_t version;
+        s >> VARINT(version);
+        mtx.nVersion = version;
+        for (uint64_t i = 0, n = ReadCompactSize(s); i < n; ++i) {
+            mtx.vin.emplace_back();
+            CTxIn& txin = mtx.vin.back();
+            uint32_t sequence;
+            s >> txin.prevout >> txin.scriptSig >> VARINT(sequence);
+            txin.nSequence = ~sequence;
+        }
+        for (uint64_t i = 0, n = ReadCompactSize(s); i < n; ++i) {
+            mtx.vout.emplace_back();
+            s >> Using<TxOutCompression>(mtx.vout.back());
+        }
+        uint8_t has_witness;
+        s >> has_witness;
+        if (has_witness) {
+            for (CTxIn& txin : mtx.vin) {
+                s >> txin.scriptWitness.stack;
+            }
+        }
+        s >> VARINT(mtx.nLockTime);
+        tx = MakeTransactionRef(std::move(mtx));
+    }
+};
+
+/** Compact serializer for blocks stored in block files: the header and block
+ *  signature as usual, and the transactions with TxCompression. */
+struct BlockCompression
+{
+    template<typename Stream> void Ser(Stream& s, const CBlock& block)
+    {
+        s << static_cast<const CBlockHeader&>(block);
+        s << Using<VectorFormatter<TxCompression>>(block.vtx);
+        if (block.vtx.size() > 1 && block.vtx[1]->IsCoinStake()) {
+            s << block.vchBlockSig;
+        }
+    }
+
+    template<typename Stream> void Unser(Stream& s, CBlock& block)
+    {
+        block.SetNull();
+        s >> static_cast<CBlockHeader&>(block);
+        s >> Using<VectorFormatter<TxCompression>>(block.vtx);
+        if (block.vtx.size() > 1 && block.vtx[1]->IsCoinStake()) {
+            s >> block.vchBlockSig;
+        }
+    }
+};
+
 #endif // BITCOIN_COMPRESSOR_H
@@ -477,6 +477,21 @@ public:
             }
         return false;
     }
+
+    /** for_each calls fn on every element that is not marked for garbage
+     * collection, e.g. to save the contents of the cache.
+     *
+     * @param fn the callable to invoke with each element
+     *
+     * @pre no concurrent insert
+     */
+    template <typename Fn>
+    void for_each(Fn fn) const
+    {
+        for (uint32_t i = 0; i < size; ++i) {
+            if (!collection_flags.bit_is_set(i)) fn(table[i]);
+        }
+    }
 };
 } // namespace CuckooCache
 
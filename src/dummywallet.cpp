@@ -39,6 +39,10 @@ void DummyWalletInit::AddWalletOptions(ArgsManager& argsman) const
         "-rescan",
         "-salvagewallet",
         "-spendzeroconfchange",
+        "-stakeconsolidate",
+        "-stakeconsolidatecount=<n>",
+        "-stakeconsolidatemaxfee=<amt>",
+        "-stakeconsolidatesize=<amt>",
         "-txconfirmtarget=<n>",
         "-wallet=<path>",
         "-walletbroadcast",
@@ -48,6 +52,7 @@ void DummyWalletInit::AddWalletOptions(ArgsManager& argsman) const
         "-dblogsize=<n>",
         "-flushwallet",
         "-privdb",
+        "-rescanbatchblocks=<n>",
         "-walletrejectlongchains",
     });
 }
@@ -3,6 +3,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <algorithm>
 #include <stdexcept>
 
 #include <flatfile.h>
@@ -10,6 +11,13 @@
 #include <tinyformat.h>
 #include <util/system.h>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 FlatFileSeq::FlatFileSeq(fs::path dir, const char* prefix, size_t chunk_size) :
     m_dir(std::move(dir)),
     m_prefix(prefix),
@@ -96,3 +104,166 @@ bool FlatFileSeq::Flush(const FlatFilePos& pos, bool finalize)
     fclose(file);
     return true;
 }
+
+FlatFileMapping::~FlatFileMapping()
+{
+#ifndef WIN32
+    munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+}
+
+std::shared_ptr<const FlatFileMapping> FlatFileMapCache::Map(const fs::path& path, size_t min_size)
+{
+#ifdef WIN32
+    return nullptr;
+#else
+    // Block files are mapped whole; don't exhaust a 32-bit address space with them
+    if (sizeof(void*) < 8 || m_max_mappings == 0) {
+        return nullptr;
+    }
+
+    LOCK(m_mutex);
+    auto it = m_mappings.find(path);
+    if (it != m_mappings.end() && it->second.first->size() >= min_size) {
+        it->second.second = ++m_use_counter;
+        return it->second.first;
+    }
+
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size >= min_size) {
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    auto mapping = std::make_shared<const FlatFileMapping>(static_cast<const unsigned char*>(data), st.st_size);
+
+    if (it == m_mappings.end() && m_mappings.size() >= m_max_mappings) {
+        auto lru = std::min_element(m_mappings.begin(), m_mappings.end(), [](const MappingMap::value_type& a, const MappingMap::value_type& b) {
+            return a.second.second < b.second.second;
+        });
+        m_mappings.erase(lru);
+    }
+    m_mappings[path] = std::make_pair(mapping, ++m_use_counter);
+    return mapping;
+#endif
+}
+
+void FlatFileMapCache::Forget(const fs::path& path)
+{
+    LOCK(m_mutex);
+    m_mappings.erase(path);
+}
+
+/** Write data at pos of the file at path, creating the file if needed. */
+static bool WriteFileRange(const fs::path& path, unsigned int pos, const std::vector<unsigned char>& data)
+{
+    FILE* file = fsbridge::fopen(path, "rb+");
+    if (!file) {
+        fs::create_directories(path.parent_path());
+        file = fsbridge::fopen(path, "wb+");
+    }
+    if (!file) {
+        LogPrintf("Unable to open file %s\n", path.string());
+        return false;
+    }
+    bool ok = fseek(file, pos, SEEK_SET) == 0 && fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        LogPrintf("Unable to write %u bytes at position %u of %s\n", data.size(), pos, path.string());
+    }
+    return ok;
+}
+
+void FlatFileWriter::Start()
+{
+    LOCK(m_mutex);
+    if (m_running) return;
+    m_running = true;
+    m_thread = std::thread([this] { TraceThread(m_thread_name, [this] { ThreadWrite(); }); });
+}
+
+void FlatFileWriter::Stop()
+{
+    {
+        LOCK(m_mutex);
+        if (!m_running) return;
+        m_running = false;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+void FlatFileWriter::ThreadWrite()
+{
+    WAIT_LOCK(m_mutex, lock);
+    while (true) {
+        m_cv.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return !m_queue.empty() || !m_running; });
+        if (m_queue.empty()) return;
+
+        // Writes are taken off the queue only once done, so they stay readable meanwhile.
+        const WriteKey key = m_queue.front();
+        const WriteData data = m_pending.at(key);
+        bool ok;
+        {
+            REVERSE_LOCK(lock);
+            ok = WriteFileRange(key.first, key.second, *data);
+        }
+        m_failed |= !ok;
+        m_queue.pop_front();
+        m_pending.erase(key);
+        m_pending_bytes -= data->size();
+        m_cv.notify_all();
+    }
+}
+
+bool FlatFileWriter::Write(const fs::path& path, unsigned int pos, std::vector<unsigned char>&& data)
+{
+    WAIT_LOCK(m_mutex, lock);
+    m_cv.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_pending_bytes <= m_max_pending_bytes || !m_running; });
+    if (!m_running) {
+        m_failed |= !WriteFileRange(path, pos, data);
+        return !m_failed;
+    }
+    const WriteKey key(path, pos);
+    m_pending_bytes += data.size();
+    m_pending[key] = std::make_shared<const std::vector<unsigned char>>(std::move(data));
+    m_queue.push_back(key);
+    m_cv.notify_all();
+    return !m_failed;
+}
+
+bool FlatFileWriter::ReadPending(const fs::path& path, unsigned int pos, WriteData& data, size_t& offset)
+{
+    LOCK(m_mutex);
+    auto it = m_pending.upper_bound(WriteKey(path, pos));
+    if (it == m_pending.begin()) return false;
+    --it;
+    if (it->first.first != path || pos >= it->first.second + it->second->size()) return false;
+    data = it->second;
+    offset = pos - it->first.second;
+    return true;
+}
+
+void FlatFileWriter::WaitForWrite(const fs::path& path, unsigned int pos)
+{
+    WriteData data;
+    size_t offset;
+    if (!ReadPending(path, pos, data, offset)) return;
+    const WriteKey key(path, pos - offset);
+    WAIT_LOCK(m_mutex, lock);
+    m_cv.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_pending.count(key) == 0; });
+}
+
+bool FlatFileWriter::Flush()
+{
+    WAIT_LOCK(m_mutex, lock);
+    m_cv.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_queue.empty(); });
+    return !m_failed;
+}
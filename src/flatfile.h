@@ -6,10 +6,18 @@
 #ifndef BITCOIN_FLATFILE_H
 #define BITCOIN_FLATFILE_H
 
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <fs.h>
 #include <serialize.h>
+#include <span.h>
+#include <sync.h>
 
 struct FlatFilePos
 {
@@ -87,4 +95,126 @@ public:
     bool Flush(const FlatFilePos& pos, bool finalize = false);
 };
 
+/** A read-only memory mapping of a whole file. It is unmapped when the last reference goes away. */
+class FlatFileMapping
+{
+private:
+    const unsigned char* const m_data;
+    const size_t m_size;
+
+public:
+    FlatFileMapping(const unsigned char* data, size_t size) : m_data(data), m_size(size) {}
+    ~FlatFileMapping();
+
+    FlatFileMapping(const FlatFileMapping&) = delete;
+    FlatFileMapping& operator=(const FlatFileMapping&) = delete;
+
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    Span<const unsigned char> Bytes() const { return {m_data, m_size}; }
+};
+
+/**
+ * A bounded cache of read-only memory mappings of flat files. Reads through a mapping
+ * are page cache hits that need no file handle, seek or copy through a stdio buffer.
+ * Mappings are only made on 64-bit POSIX systems. Elsewhere, Map() returns nullptr and
+ * callers fall back to FlatFileSeq::Open().
+ */
+class FlatFileMapCache
+{
+private:
+    const size_t m_max_mappings;
+    Mutex m_mutex;
+    //! Mappings by file, with a counter value recording their last use.
+    using MappingMap = std::map<fs::path, std::pair<std::shared_ptr<const FlatFileMapping>, uint64_t>>;
+    MappingMap m_mappings GUARDED_BY(m_mutex);
+    uint64_t m_use_counter GUARDED_BY(m_mutex){0};
+
+public:
+    /** @param max_mappings Number of files kept mapped; the least recently used are dropped first. */
+    explicit FlatFileMapCache(size_t max_mappings) : m_max_mappings(max_mappings) {}
+
+    /**
+     * Get a mapping of the file at path that covers at least its first min_size bytes. A file
+     * that has grown since it was mapped is mapped again.
+     *
+     * @return The mapping, or nullptr if the file is smaller or cannot be mapped.
+     */
+    std::shared_ptr<const FlatFileMapping> Map(const fs::path& path, size_t min_size);
+
+    /** Drop the mapping of a file, e.g. before it is deleted. Readers holding it are unaffected. */
+    void Forget(const fs::path& path);
+};
+
+/**
+ * Writes data to flat files on a dedicated thread, so that callers do not wait on disk I/O.
+ * Queued data can be read back with ReadPending() until it has reached its file. Before
+ * Start() and after Stop(), writes are done synchronously by the caller.
+ */
+class FlatFileWriter
+{
+private:
+    using WriteKey = std::pair<fs::path, unsigned int>;
+    using WriteData = std::shared_ptr<const std::vector<unsigned char>>;
+
+    const char* const m_thread_name;
+    const size_t m_max_pending_bytes;
+    Mutex m_mutex;
+    //! Signalled whenever writes are queued or completed, and on Stop().
+    std::condition_variable m_cv;
+    //! Queued writes by file and position, and the order in which they were queued.
+    std::map<WriteKey, WriteData> m_pending GUARDED_BY(m_mutex);
+    std::deque<WriteKey> m_queue GUARDED_BY(m_mutex);
+    size_t m_pending_bytes GUARDED_BY(m_mutex){0};
+    bool m_running GUARDED_BY(m_mutex){false};
+    //! Whether any write has failed. Later data may then point at data that is missing, so
+    //! this is never reset.
+    bool m_failed GUARDED_BY(m_mutex){false};
+    std::thread m_thread;
+
+    void ThreadWrite();
+
+public:
+    /**
+     * @param thread_name Name of the writer thread.
+     * @param max_pending_bytes Write() blocks while more than this much data is queued.
+     */
+    FlatFileWriter(const char* thread_name, size_t max_pending_bytes) : m_thread_name(thread_name), m_max_pending_bytes(max_pending_bytes) {}
+    ~FlatFileWriter() { Stop(); }
+
+    void Start();
+    /** Write out all queued data and stop the writer thread. */
+    void Stop();
+
+    /**
+     * Queue data to be written to the file at path, starting at position pos.
+     *
+     * @return false if a write has failed, either this one (when writing synchronously) or
+     *         an earlier one.
+     */
+    bool Write(const fs::path& path, unsigned int pos, std::vector<unsigned char>&& data);
+
+    /**
+     * Look up data that is queued but not yet written.
+     *
+     * @param[in] path The file the data goes to.
+     * @param[in] pos A position within the queued write.
+     * @param[out] data The queued write containing pos.
+     * @param[out] offset The offset of pos within data.
+     * @return Whether pos is part of a queued write.
+     */
+    bool ReadPending(const fs::path& path, unsigned int pos, WriteData& data, size_t& offset);
+
+    /** Wait until the queued write containing pos of the file at path, if any, has been done. */
+    void WaitForWrite(const fs::path& path, unsigned int pos);
+
+    /**
+     * Wait until all data queued so far has been written to its file. This does not sync the
+     * files to disk; see FlatFileSeq::Flush().
+     *
+     * @return false if any write has failed.
+     */
+    bool Flush();
+};
+
 #endif // BITCOIN_FLATFILE_H
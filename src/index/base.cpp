@@ -6,16 +6,28 @@
 #include <index/base.h>
 #include <node/ui_interface.h>
 #include <shutdown.h>
+#include <sync.h>
 #include <tinyformat.h>
 #include <util/system.h>
+#include <util/threadnames.h>
 #include <util/translation.h>
 #include <validation.h>
 #include <warnings.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
+
 constexpr char DB_BEST_BLOCK = 'B';
 
 constexpr int64_t SYNC_LOG_INTERVAL = 30; // seconds
 constexpr int64_t SYNC_LOCATOR_WRITE_INTERVAL = 30; // seconds
+//! Maximum number of threads reading blocks ahead of the index while it syncs
+constexpr int MAX_SYNC_READ_THREADS = 8;
+//! Number of blocks kept queued for reading ahead of the index while it syncs
+constexpr size_t SYNC_READ_AHEAD = 32;
 
 template <typename... Args>
 static void FatalError(const char* fmt, const Args&... args)
@@ -84,12 +96,151 @@ static const CBlockIndex* NextSyncBlock(const CBlockIndex* pindex_prev) EXCLUSIV
     return ::ChainActive().Next(::ChainActive().FindFork(pindex_prev));
 }
 
+namespace {
+
+/**
+ * Reads blocks and prepares them for indexing on several threads, so that reading and
+ * deserializing blocks overlaps with writing the index. Blocks are queued with Add() and
+ * handed out in the same order by Next(). The threads live as long as the reader, so the
+ * caller controls the read-ahead window by how far it queues ahead of what it has taken.
+ */
+class SyncBlockReader
+{
+public:
+    using ReadFn = std::function<bool(const CBlockIndex*, CBlock&, std::unique_ptr<BaseIndex::BlockData>&)>;
+
+    SyncBlockReader(int num_threads, const std::string& thread_name, ReadFn read)
+        : m_read(std::move(read))
+    {
+        for (int i = 0; i < num_threads; ++i) {
+            m_threads.emplace_back([this, thread_name] {
+                util::ThreadRename(std::string(thread_name));
+                Run();
+            });
+        }
+    }
+
+    ~SyncBlockReader()
+    {
+        {
+            LOCK(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    /** Queue a block to be read. */
+    void Add(const CBlockIndex* pindex)
+    {
+        {
+            LOCK(m_mutex);
+            m_slots.emplace_back();
+            m_slots.back().pindex = pindex;
+        }
+        m_cond.notify_all();
+    }
+
+    /** Number of blocks queued and not yet taken by Next(). */
+    size_t Size()
+    {
+        LOCK(m_mutex);
+        return m_slots.size();
+    }
+
+    /** The block queued last, or nullptr if there is none. */
+    const CBlockIndex* Back()
+    {
+        LOCK(m_mutex);
+        return m_slots.empty() ? nullptr : m_slots.back().pindex;
+    }
+
+    /**
+     * Wait until the first queued block has been read and take it off the queue. Must only be
+     * called while blocks are queued. Returns false if reading or preparing it failed.
+     */
+    bool Next(const CBlockIndex*& pindex, CBlock& block, std::unique_ptr<BaseIndex::BlockData>& data)
+    {
+        WAIT_LOCK(m_mutex, lock);
+        assert(!m_slots.empty());
+        m_cond.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_slots.front().done; });
+        Slot& slot = m_slots.front();
+        pindex = slot.pindex;
+        block = std::move(slot.block);
+        data = std::move(slot.data);
+        const bool ok = slot.ok;
+        m_slots.pop_front();
+        ++m_first;
+        return ok;
+    }
+
+private:
+    struct Slot {
+        const CBlockIndex* pindex{nullptr};
+        bool done{false};
+        bool ok{false};
+        CBlock block;
+        std::unique_ptr<BaseIndex::BlockData> data;
+    };
+
+    Mutex m_mutex;
+    std::condition_variable m_cond;
+    //! Queued blocks, in order. m_first is the sequence number of the first one.
+    std::deque<Slot> m_slots GUARDED_BY(m_mutex);
+    uint64_t m_first GUARDED_BY(m_mutex){0};
+    //! Sequence number of the next block to hand to a reading thread.
+    uint64_t m_next GUARDED_BY(m_mutex){0};
+    bool m_stop GUARDED_BY(m_mutex){false};
+    const ReadFn m_read;
+    std::vector<std::thread> m_threads;
+
+    void Run()
+    {
+        WAIT_LOCK(m_mutex, lock);
+        while (true) {
+            m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_stop || m_next < m_first + m_slots.size(); });
+            if (m_stop) return;
+
+            const uint64_t n = m_next++;
+            const CBlockIndex* pindex = m_slots[n - m_first].pindex;
+            Slot slot;
+            {
+                REVERSE_LOCK(lock);
+                try {
+                    slot.ok = m_read(pindex, slot.block, slot.data);
+                } catch (const std::exception& e) {
+                    slot.ok = error("%s: %s", __func__, e.what());
+                }
+            }
+            // Blocks are only taken off the queue once read, so the slot is still there.
+            Slot& queued = m_slots[n - m_first];
+            queued.block = std::move(slot.block);
+            queued.data = std::move(slot.data);
+            queued.ok = slot.ok;
+            queued.done = true;
+            m_cond.notify_all();
+        }
+    }
+};
+
+} // namespace
+
 void BaseIndex::ThreadSync()
 {
     const CBlockIndex* pindex = m_best_block_index.load();
     if (!m_synced) {
         auto& consensus_params = Params().GetConsensus();
+        const int num_read_threads = std::max(1, std::min(GetNumCores(), MAX_SYNC_READ_THREADS));
+        const SyncBlockReader::ReadFn read_block = [this, &consensus_params](const CBlockIndex* pindex_read, CBlock& block, std::unique_ptr<BlockData>& data) {
+            if (!ReadBlockFromDisk(block, pindex_read, consensus_params)) {
+                return error("%s: Failed to read block %s from disk", GetName(), pindex_read->GetBlockHash().ToString());
+            }
+            return PrepareBlock(block, pindex_read, data);
+        };
 
+        SyncBlockReader reader(num_read_threads, strprintf("%s.read", GetName()), read_block);
         int64_t last_log_time = 0;
         int64_t last_locator_write_time = 0;
         while (true) {
@@ -104,22 +255,49 @@ void BaseIndex::ThreadSync()
 
             {
                 LOCK(cs_main);
-                const CBlockIndex* pindex_next = NextSyncBlock(pindex);
-                if (!pindex_next) {
-                    m_best_block_index = pindex;
-                    m_synced = true;
-                    // No need to handle errors in Commit. See rationale above.
-                    Commit();
-                    break;
+                const CBlockIndex* pindex_queued = reader.Back();
+                if (!pindex_queued) {
+                    const CBlockIndex* pindex_next = NextSyncBlock(pindex);
+                    if (!pindex_next) {
+                        m_best_block_index = pindex;
+                        m_synced = true;
+                        // No need to handle errors in Commit. See rationale above.
+                        Commit();
+                        break;
+                    }
+                    if (pindex_next->pprev != pindex && !Rewind(pindex, pindex_next->pprev)) {
+                        FatalError("%s: Failed to rewind index %s to a previous chain tip",
+                                   __func__, GetName());
+                        return;
+                    }
+                    reader.Add(pindex_next);
+                    pindex_queued = pindex_next;
                 }
-                if (pindex_next->pprev != pindex && !Rewind(pindex, pindex_next->pprev)) {
-                    FatalError("%s: Failed to rewind index %s to a previous chain tip",
-                               __func__, GetName());
-                    return;
+                // Keep reading ahead along the active chain. Should it change meanwhile, this
+                // stops at the fork; once the blocks queued so far are indexed, the
+                // NextSyncBlock call above rewinds the index as usual.
+                for (size_t queued = reader.Size(); queued < SYNC_READ_AHEAD; ++queued) {
+                    pindex_queued = ::ChainActive().Next(pindex_queued);
+                    if (!pindex_queued) break;
+                    reader.Add(pindex_queued);
                 }
-                pindex = pindex_next;
             }
 
+            const CBlockIndex* pindex_read;
+            CBlock block;
+            std::unique_ptr<BlockData> data;
+            if (!reader.Next(pindex_read, block, data)) {
+                FatalError("%s: Failed to read block %s from disk",
+                           __func__, pindex_read->GetBlockHash().ToString());
+                return;
+            }
+            if (!WritePreparedBlock(block, pindex_read, data.get())) {
+                FatalError("%s: Failed to write block %s to index database",
+                           __func__, pindex_read->GetBlockHash().ToString());
+                return;
+            }
+            pindex = pindex_read;
+
             int64_t current_time = GetTime();
             if (last_log_time + SYNC_LOG_INTERVAL < current_time) {
                 LogPrintf("Syncing %s with block chain from height %d\n",
@@ -133,18 +311,6 @@ void BaseIndex::ThreadSync()
                 // No need to handle errors in Commit. See rationale above.
                 Commit();
             }
-
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, consensus_params)) {
-                FatalError("%s: Failed to read block %s from disk",
-                           __func__, pindex->GetBlockHash().ToString());
-                return;
-            }
-            if (!WriteBlock(block, pindex)) {
-                FatalError("%s: Failed to write block %s to index database",
-                           __func__, pindex->GetBlockHash().ToString());
-                return;
-            }
         }
     }
 
@@ -220,7 +386,8 @@ void BaseIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const
         }
     }
 
-    if (WriteBlock(*block, pindex)) {
+    std::unique_ptr<BlockData> data;
+    if (PrepareBlock(*block, pindex, data) && WritePreparedBlock(*block, pindex, data.get())) {
         m_best_block_index = pindex;
     } else {
         FatalError("%s: Failed to write block %s to index",
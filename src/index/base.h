@@ -11,6 +11,8 @@
 #include <threadinterrupt.h>
 #include <validationinterface.h>
 
+#include <memory>
+
 class CBlockIndex;
 
 struct IndexSummary {
@@ -26,6 +28,15 @@ struct IndexSummary {
  */
 class BaseIndex : public CValidationInterface
 {
+public:
+    /// Data for indexing a block that an index computes independently of other blocks, see
+    /// PrepareBlock.
+    class BlockData
+    {
+    public:
+        virtual ~BlockData() {}
+    };
+
 protected:
     /**
      * The database stores a block locator of the chain the database is synced to
@@ -87,6 +98,15 @@ protected:
     /// Write update index entries for a newly connected block.
     virtual bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) { return true; }
 
+    /// Compute what indexing a newly connected block needs that depends neither on the index
+    /// state nor on other blocks, e.g. its undo data. While the index catches up with the chain,
+    /// this runs on several threads ahead of WritePreparedBlock, so it must not modify the index.
+    virtual bool PrepareBlock(const CBlock& block, const CBlockIndex* pindex, std::unique_ptr<BlockData>& data) const { return true; }
+
+    /// Write update index entries for a newly connected block, given the result of PrepareBlock.
+    /// Indexes that do not override PrepareBlock implement WriteBlock instead.
+    virtual bool WritePreparedBlock(const CBlock& block, const CBlockIndex* pindex, const BlockData* data) { return WriteBlock(block, pindex); }
+
     /// Virtual method called internally by Commit that can be overridden to atomically
     /// commit more index state.
     virtual bool CommitInternal(CDBBatch& batch);
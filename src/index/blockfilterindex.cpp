@@ -208,16 +208,33 @@ size_t BlockFilterIndex::WriteFilterToDisk(FlatFilePos& pos, const BlockFilter&
     return data_size;
 }
 
-bool BlockFilterIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+namespace {
+
+/** A block filter built ahead of being written to the index. */
+struct FilterBlockData : public BaseIndex::BlockData {
+    BlockFilter filter;
+};
+
+} // namespace
+
+bool BlockFilterIndex::PrepareBlock(const CBlock& block, const CBlockIndex* pindex, std::unique_ptr<BlockData>& data) const
 {
     CBlockUndo block_undo;
+    if (pindex->nHeight > 0 && !UndoReadFromDisk(block_undo, pindex)) {
+        return false;
+    }
+
+    std::unique_ptr<FilterBlockData> filter_data = MakeUnique<FilterBlockData>();
+    filter_data->filter = BlockFilter(m_filter_type, block, block_undo);
+    data = std::move(filter_data);
+    return true;
+}
+
+bool BlockFilterIndex::WritePreparedBlock(const CBlock& block, const CBlockIndex* pindex, const BlockData* data)
+{
     uint256 prev_header;
 
     if (pindex->nHeight > 0) {
-        if (!UndoReadFromDisk(block_undo, pindex)) {
-            return false;
-        }
-
         std::pair<uint256, DBVal> read_out;
         if (!m_db->Read(DBHeightKey(pindex->nHeight - 1), read_out)) {
             return false;
@@ -232,7 +249,7 @@ bool BlockFilterIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex
         prev_header = read_out.second.header;
     }
 
-    BlockFilter filter(m_filter_type, block, block_undo);
+    const BlockFilter& filter = static_cast<const FilterBlockData*>(data)->filter;
 
     size_t bytes_written = WriteFilterToDisk(m_next_filter_pos, filter);
     if (bytes_written == 0) return false;
@@ -0,0 +1,298 @@
+// Copyright (c) 2020 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <crypto/sha256.h>
+#include <index/scriptindex.h>
+#include <undo.h>
+#include <util/system.h>
+#include <validation.h>
+
+#include <limits>
+#include <map>
+
+/* The index database stores two kinds of records for each output script, both keyed by the SHA256
+ * hash of the script:
+ *
+ * - History records have keys [DB_SCRIPT_HISTORY, script hash, height (BE), tx position (BE)] and
+ *   hold the txid and the net amount the transaction paid to the script. The height and position
+ *   are big-endian so that the history of a script is read in chain order.
+ * - Unspent records have keys [DB_SCRIPT_UNSPENT, script hash, txid, output index (BE)] and hold
+ *   the height and value of the output.
+ *
+ * Spent outputs are found in the undo data of each block, which is also used to restore them when
+ * blocks are disconnected.
+ */
+constexpr char DB_SCRIPT_HISTORY = 'h';
+constexpr char DB_SCRIPT_UNSPENT = 'u';
+
+std::unique_ptr<ScriptIndex> g_scriptindex;
+
+namespace {
+
+struct DBHistoryKey {
+    uint256 script_hash;
+    int height;
+    uint32_t tx_pos;
+
+    DBHistoryKey() : height(0), tx_pos(0) {}
+    DBHistoryKey(const uint256& script_hash_in, int height_in, uint32_t tx_pos_in)
+        : script_hash(script_hash_in), height(height_in), tx_pos(tx_pos_in) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, DB_SCRIPT_HISTORY);
+        s << script_hash;
+        ser_writedata32be(s, height);
+        ser_writedata32be(s, tx_pos);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        char prefix = ser_readdata8(s);
+        if (prefix != DB_SCRIPT_HISTORY) {
+            throw std::ios_base::failure("Invalid format for script index DB history key");
+        }
+        s >> script_hash;
+        height = ser_readdata32be(s);
+        tx_pos = ser_readdata32be(s);
+    }
+};
+
+struct DBHistoryVal {
+    uint256 txid;
+    CAmount delta;
+
+    SERIALIZE_METHODS(DBHistoryVal, obj) { READWRITE(obj.txid, obj.delta); }
+};
+
+struct DBUnspentKey {
+    uint256 script_hash;
+    COutPoint outpoint;
+
+    DBUnspentKey() {}
+    DBUnspentKey(const uint256& script_hash_in, const COutPoint& outpoint_in)
+        : script_hash(script_hash_in), outpoint(outpoint_in) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, DB_SCRIPT_UNSPENT);
+        s << script_hash << outpoint.hash;
+        ser_writedata32be(s, outpoint.n);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        char prefix = ser_readdata8(s);
+        if (prefix != DB_SCRIPT_UNSPENT) {
+            throw std::ios_base::failure("Invalid format for script index DB unspent key");
+        }
+        s >> script_hash >> outpoint.hash;
+        outpoint.n = ser_readdata32be(s);
+    }
+};
+
+struct DBUnspentVal {
+    int height;
+    CAmount value;
+
+    SERIALIZE_METHODS(DBUnspentVal, obj) { READWRITE(obj.height, obj.value); }
+};
+
+/** The undo data of a block, read ahead of the block being indexed. */
+struct ScriptBlockData : public BaseIndex::BlockData {
+    CBlockUndo block_undo;
+};
+
+}; // namespace
+
+static uint256 GetScriptHash(const CScript& script)
+{
+    uint256 hash;
+    CSHA256().Write(script.data(), script.size()).Finalize(hash.begin());
+    return hash;
+}
+
+/** Outputs that can never be spent, and the empty outputs marking coinstakes, are not indexed. */
+static bool IsIndexed(const CTxOut& txout)
+{
+    return !txout.IsEmpty() && !txout.scriptPubKey.IsUnspendable();
+}
+
+/** Access to the script index database (indexes/scriptindex/) */
+class ScriptIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    /// Add the records of a connected block to batch or, if disconnect is set, remove them.
+    void IndexBlock(CDBBatch& batch, const CBlock& block, const CBlockUndo& block_undo, int height, bool disconnect);
+
+    /// Read up to count records of the given type for a script, after skipping the first skip.
+    template <typename Key, typename Value, typename Fn>
+    bool ReadRange(const Key& start, size_t skip, size_t count, Fn fn);
+};
+
+ScriptIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "scriptindex", n_cache_size, f_memory, f_wipe)
+{}
+
+void ScriptIndex::DB::IndexBlock(CDBBatch& batch, const CBlock& block, const CBlockUndo& block_undo, int height, bool disconnect)
+{
+    for (size_t k = 0; k < block.vtx.size(); ++k) {
+        // Transactions are disconnected in reverse order, as their outputs may be spent in the same block.
+        const size_t i = disconnect ? block.vtx.size() - 1 - k : k;
+        const CTransaction& tx = *block.vtx[i];
+        std::map<uint256, CAmount> deltas;
+
+        if (i > 0) {
+            const CTxUndo& tx_undo = block_undo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx_undo.vprevout.size(); ++j) {
+                const Coin& coin = tx_undo.vprevout[j];
+                if (!IsIndexed(coin.out)) continue;
+                const uint256 script_hash = GetScriptHash(coin.out.scriptPubKey);
+                deltas[script_hash] -= coin.out.nValue;
+                const DBUnspentKey key(script_hash, tx.vin[j].prevout);
+                if (disconnect) {
+                    batch.Write(key, DBUnspentVal{static_cast<int>(coin.nHeight), coin.out.nValue});
+                } else {
+                    batch.Erase(key);
+                }
+            }
+        }
+
+        for (uint32_t n = 0; n < tx.vout.size(); ++n) {
+            const CTxOut& txout = tx.vout[n];
+            if (!IsIndexed(txout)) continue;
+            const uint256 script_hash = GetScriptHash(txout.scriptPubKey);
+            deltas[script_hash] += txout.nValue;
+            const DBUnspentKey key(script_hash, COutPoint(tx.GetHash(), n));
+            if (disconnect) {
+                batch.Erase(key);
+            } else {
+                batch.Write(key, DBUnspentVal{height, txout.nValue});
+            }
+        }
+
+        for (const auto& delta : deltas) {
+            const DBHistoryKey key(delta.first, height, i);
+            if (disconnect) {
+                batch.Erase(key);
+            } else {
+                batch.Write(key, DBHistoryVal{tx.GetHash(), delta.second});
+            }
+        }
+    }
+}
+
+template <typename Key, typename Value, typename Fn>
+bool ScriptIndex::DB::ReadRange(const Key& start, size_t skip, size_t count, Fn fn)
+{
+    std::unique_ptr<CDBIterator> db_it(NewIterator());
+    Key key;
+    Value value;
+    for (db_it->Seek(start); db_it->Valid() && count > 0; db_it->Next()) {
+        if (!db_it->GetKey(key) || key.script_hash != start.script_hash) {
+            break;
+        }
+        if (skip > 0) {
+            --skip;
+            continue;
+        }
+        if (!db_it->GetValue(value)) {
+            return error("%s: unable to read value in script index", __func__);
+        }
+        fn(key, value);
+        --count;
+    }
+    return true;
+}
+
+ScriptIndex::ScriptIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<ScriptIndex::DB>(n_cache_size, f_memory, f_wipe))
+{}
+
+ScriptIndex::~ScriptIndex() {}
+
+bool ScriptIndex::PrepareBlock(const CBlock& block, const CBlockIndex* pindex, std::unique_ptr<BlockData>& data) const
+{
+    // Exclude genesis block transaction because outputs are not spendable.
+    if (pindex->nHeight == 0) return true;
+
+    std::unique_ptr<ScriptBlockData> script_data = MakeUnique<ScriptBlockData>();
+    if (!UndoReadFromDisk(script_data->block_undo, pindex)) {
+        return false;
+    }
+    if (script_data->block_undo.vtxundo.size() + 1 != block.vtx.size()) {
+        return error("%s: undo data does not match block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+    data = std::move(script_data);
+    return true;
+}
+
+bool ScriptIndex::WritePreparedBlock(const CBlock& block, const CBlockIndex* pindex, const BlockData* data)
+{
+    if (pindex->nHeight == 0) return true;
+
+    CDBBatch batch(*m_db);
+    m_db->IndexBlock(batch, block, static_cast<const ScriptBlockData*>(data)->block_undo, pindex->nHeight, false);
+    return m_db->WriteBatch(batch);
+}
+
+bool ScriptIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    assert(current_tip->GetAncestor(new_tip->nHeight) == new_tip);
+
+    // Restore the unspent outputs of the disconnected blocks before the best block is moved back.
+    CDBBatch batch(*m_db);
+    for (const CBlockIndex* pindex = current_tip; pindex != new_tip; pindex = pindex->pprev) {
+        CBlock block;
+        CBlockUndo block_undo;
+        if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+            return error("%s: Failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (!UndoReadFromDisk(block_undo, pindex) || block_undo.vtxundo.size() + 1 != block.vtx.size()) {
+            return error("%s: Failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+        m_db->IndexBlock(batch, block, block_undo, pindex->nHeight, true);
+    }
+    if (!m_db->WriteBatch(batch)) return false;
+
+    return BaseIndex::Rewind(current_tip, new_tip);
+}
+
+BaseIndex::DB& ScriptIndex::GetDB() const { return *m_db; }
+
+bool ScriptIndex::FindHistory(const CScript& script, size_t skip, size_t count, std::vector<ScriptHistoryEntry>& entries) const
+{
+    entries.clear();
+    return m_db->ReadRange<DBHistoryKey, DBHistoryVal>(DBHistoryKey(GetScriptHash(script), 0, 0), skip, count,
+        [&entries](const DBHistoryKey& key, const DBHistoryVal& value) {
+            entries.push_back(ScriptHistoryEntry{key.height, key.tx_pos, value.txid, value.delta});
+        });
+}
+
+bool ScriptIndex::FindUnspent(const CScript& script, size_t skip, size_t count, std::vector<ScriptUnspentEntry>& entries) const
+{
+    entries.clear();
+    return m_db->ReadRange<DBUnspentKey, DBUnspentVal>(DBUnspentKey(GetScriptHash(script), COutPoint(uint256(), 0)), skip, count,
+        [&entries](const DBUnspentKey& key, const DBUnspentVal& value) {
+            entries.push_back(ScriptUnspentEntry{key.outpoint, value.height, value.value});
+        });
+}
+
+bool ScriptIndex::GetBalance(const CScript& script, CAmount& balance, size_t& num_unspent) const
+{
+    balance = 0;
+    num_unspent = 0;
+    return m_db->ReadRange<DBUnspentKey, DBUnspentVal>(DBUnspentKey(GetScriptHash(script), COutPoint(uint256(), 0)), 0, std::numeric_limits<size_t>::max(),
+        [&balance, &num_unspent](const DBUnspentKey& key, const DBUnspentVal& value) {
+            balance += value.value;
+            ++num_unspent;
+        });
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2020 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_SCRIPTINDEX_H
+#define BITCOIN_INDEX_SCRIPTINDEX_H
+
+#include <amount.h>
+#include <index/base.h>
+#include <primitives/transaction.h>
+#include <script/script.h>
+#include <uint256.h>
+
+#include <vector>
+
+/** A transaction that paid to or spent from a script. */
+struct ScriptHistoryEntry {
+    int height;
+    //! Position of the transaction in its block
+    uint32_t tx_pos;
+    uint256 txid;
+    //! Amount the transaction paid to the script minus the amount it spent from it
+    CAmount delta;
+};
+
+/** An unspent output paying to a script. */
+struct ScriptUnspentEntry {
+    COutPoint outpoint;
+    int height;
+    CAmount value;
+};
+
+/**
+ * ScriptIndex is used to look up the transaction history and the unspent
+ * outputs of output scripts. The index is written to a LevelDB database. All
+ * records are keyed by the SHA256 hash of the script, so the records of one
+ * script are adjacent and are read with a range scan.
+ */
+class ScriptIndex final : public BaseIndex
+{
+protected:
+    class DB;
+
+private:
+    const std::unique_ptr<DB> m_db;
+
+protected:
+    bool PrepareBlock(const CBlock& block, const CBlockIndex* pindex, std::unique_ptr<BlockData>& data) const override;
+
+    bool WritePreparedBlock(const CBlock& block, const CBlockIndex* pindex, const BlockData* data) override;
+
+    bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "scriptindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit ScriptIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~ScriptIndex() override;
+
+    /// Look up the transactions that paid to or spent from a script, in chain order.
+    ///
+    /// @param[in]   script  The output script.
+    /// @param[in]   skip  Number of leading entries to leave out.
+    /// @param[in]   count  Maximum number of entries to return.
+    /// @param[out]  entries  The entries found.
+    /// @return  false if the database could not be read
+    bool FindHistory(const CScript& script, size_t skip, size_t count, std::vector<ScriptHistoryEntry>& entries) const;
+
+    /// Look up the unspent outputs paying to a script, ordered by outpoint.
+    bool FindUnspent(const CScript& script, size_t skip, size_t count, std::vector<ScriptUnspentEntry>& entries) const;
+
+    /// Add up the unspent outputs paying to a script.
+    bool GetBalance(const CScript& script, CAmount& balance, size_t& num_unspent) const;
+};
+
+/// The global script index, used by the address RPCs. May be null.
+extern std::unique_ptr<ScriptIndex> g_scriptindex;
+
+#endif // BITCOIN_INDEX_SCRIPTINDEX_H
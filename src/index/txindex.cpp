@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <chainparams.h>
 #include <index/disktxpos.h>
 #include <index/txindex.h>
 #include <node/ui_interface.h>
@@ -235,6 +236,23 @@ bool TxIndex::FindTx(const uint256& tx_hash, uint256& block_hash, CTransactionRe
         return false;
     }
 
+    // The block may have been connected moments ago
+    WaitForBlockWrite(postx);
+    if (!IsRawBlockOnDisk(postx)) {
+        // The transaction offset does not apply to compressed blocks
+        CBlock block;
+        if (!ReadBlockFromDisk(block, postx, Params().GetConsensus())) {
+            return error("%s: ReadBlockFromDisk failed", __func__);
+        }
+        for (const CTransactionRef& block_tx : block.vtx) {
+            if (block_tx->GetHash() == tx_hash) {
+                tx = block_tx;
+                block_hash = block.GetHash();
+                return true;
+            }
+        }
+        return error("%s: txid mismatch", __func__);
+    }
     CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
     if (file.IsNull()) {
         return error("%s: OpenBlockFile failed", __func__);
@@ -6,6 +6,7 @@
 
 #include <chain.h>
 #include <chainparams.h>
+#include <index/blockfilterindex.h>
 #include <interfaces/handler.h>
 #include <interfaces/wallet.h>
 #include <net.h>
@@ -274,6 +275,47 @@ public:
         }
         return false;
     }
+    bool hasBlockFilterIndex(BlockFilterType filter_type) override
+    {
+        return GetBlockFilterIndex(filter_type) != nullptr;
+    }
+    Optional<bool> blockFilterMatchesAny(BlockFilterType filter_type, const uint256& block_hash, const GCSFilter::ElementSet& filter_set) override
+    {
+        const BlockFilterIndex* block_filter_index = GetBlockFilterIndex(filter_type);
+        if (!block_filter_index) return nullopt;
+
+        const CBlockIndex* index = WITH_LOCK(::cs_main, return LookupBlockIndex(block_hash));
+        BlockFilter filter;
+        if (!index || !block_filter_index->LookupFilter(index, filter)) return nullopt;
+        return filter.GetFilter().MatchAny(filter_set);
+    }
+    std::vector<Optional<bool>> blockFiltersMatchAny(BlockFilterType filter_type, const std::vector<uint256>& block_hashes, const GCSFilter::ElementSet& filter_set, int num_threads) override
+    {
+        std::vector<Optional<bool>> result(block_hashes.size());
+        const BlockFilterIndex* block_filter_index = GetBlockFilterIndex(filter_type);
+        if (!block_filter_index) return result;
+
+        std::vector<const CBlockIndex*> indexes;
+        {
+            LOCK(::cs_main);
+            for (const uint256& block_hash : block_hashes) {
+                indexes.push_back(LookupBlockIndex(block_hash));
+            }
+        }
+        std::vector<BlockFilter> filters;
+        std::vector<size_t> positions;
+        for (size_t i = 0; i < indexes.size(); ++i) {
+            BlockFilter filter;
+            if (!indexes[i] || !block_filter_index->LookupFilter(indexes[i], filter)) continue;
+            filters.push_back(std::move(filter));
+            positions.push_back(i);
+            result[i] = false;
+        }
+        for (size_t match : MatchAnyBatch(filters, filter_set, num_threads)) {
+            result[positions[match]] = true;
+        }
+        return result;
+    }
     RBFTransactionState isRBFOptIn(const CTransaction& tx) override
     {
         if (!m_node.mempool) return IsRBFOptInEmptyMempool(tx);
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_INTERFACES_CHAIN_H
 #define BITCOIN_INTERFACES_CHAIN_H
 
+#include <blockfilter.h>            // For BlockFilterType and GCSFilter::ElementSet
 #include <optional.h>               // For Optional and nullopt
 #include <primitives/transaction.h> // For CTransactionRef
 #include <util/settings.h>          // For util::SettingsValue
@@ -167,6 +168,18 @@ public:
     //! the height range from min_height to max_height, inclusive.
     virtual bool hasBlocks(const uint256& block_hash, int min_height = 0, Optional<int> max_height = {}) = 0;
 
+    //! Return whether a block filter index of the given type is enabled.
+    virtual bool hasBlockFilterIndex(BlockFilterType filter_type) = 0;
+
+    //! Return whether any of the elements match the BIP 157 block filter of
+    //! the block, or nullopt if the filter could not be found.
+    virtual Optional<bool> blockFilterMatchesAny(BlockFilterType filter_type, const uint256& block_hash, const GCSFilter::ElementSet& filter_set) = 0;
+
+    //! Return for each block whether any of the elements match its BIP 157
+    //! block filter, or nullopt if the filter could not be found. The filters
+    //! are matched on up to num_threads threads.
+    virtual std::vector<Optional<bool>> blockFiltersMatchAny(BlockFilterType filter_type, const std::vector<uint256>& block_hashes, const GCSFilter::ElementSet& filter_set, int num_threads) = 0;
+
     //! Check if transaction is RBF opt in.
     virtual RBFTransactionState isRBFOptIn(const CTransaction& tx) = 0;
 
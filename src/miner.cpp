@@ -124,8 +124,8 @@ static inline void FillTreasuryPayee(CMutableTransaction& txNew, const int nHeig
 Optional<int64_t> BlockAssembler::m_last_block_num_txs{nullopt};
 Optional<int64_t> BlockAssembler::m_last_block_weight{nullopt};
 
-// peercoin: if pwallet != NULL it will attempt to create coinstake
-std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, std::shared_ptr<CWallet> pwallet, bool* pfPoSCancel)
+// peercoin: if stake_kernel != NULL it will attempt to create coinstake
+std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, const StakeKernel* stake_kernel, bool* pfPoSCancel)
 {
     int64_t nTimeStart = GetTimeMicros();
 
@@ -143,7 +143,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     nHeight = pindexPrev->nHeight + 1;
 
     const Consensus::Params &consensusParams = chainparams.GetConsensus();
-    const bool fProofOfStake = pwallet != nullptr;
+    const bool fProofOfStake = stake_kernel != nullptr;
 
     // Create coinbase transaction.
     CMutableTransaction coinbaseTx;
@@ -163,7 +163,6 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     // peercoin: if coinstake available add coinstake tx
     if (fProofOfStake)
         pblocktemplate->entries.emplace_back(CTransactionRef(), -1, -1); // updated at end
-    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime(); // only initialized at startup
 
     pblock->nVersion = ComputeBlockVersion(pindexPrev, fProofOfStake ? CBlockHeader::ALGO_POS : CBlockHeader::ALGO_POW_XEVAN, consensusParams);
     // -regtest only: allow overriding block.nVersion with
@@ -172,7 +171,8 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
         pblock->nVersion = gArgs.GetArg("-blockversion", pblock->nVersion);
 
     const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
-    pblock->nTime = std::max(nMedianTimePast+1, GetAdjustedTime());
+    // peercoin: a proof-of-stake block takes the time its kernel was found at
+    pblock->nTime = fProofOfStake ? stake_kernel->nTime : std::max(nMedianTimePast+1, GetAdjustedTime());
     pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, consensusParams);
 
     nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
@@ -215,19 +215,14 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
         pblock->vtx.push_back(entry.tx);
     }
 
-    if (fProofOfStake) { // attempt to find a coinstake
+    if (fProofOfStake) { // attempt to create the coinstake
         *pfPoSCancel = true;
         CMutableTransaction coinstakeTx;
-        int64_t nSearchTime = GetAdjustedTime(); // search to current time
-        if (nSearchTime > nLastCoinStakeSearchTime) {
-            if (CreateCoinStake(coinstakeTx, pblock, pwallet, nHeight, pindexPrev, consensusParams)) {
-                coinbaseTx.vout[0].SetEmpty();
-                pblocktemplate->entries[1].tx = MakeTransactionRef(std::move(coinstakeTx));
-                pblock->vtx[1] = pblocktemplate->entries[1].tx;
-                *pfPoSCancel = false;
-            }
-            nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-            nLastCoinStakeSearchTime = nSearchTime;
+        if (CreateCoinStake(coinstakeTx, pblock, *stake_kernel, nHeight, pindexPrev, consensusParams)) {
+            coinbaseTx.vout[0].SetEmpty();
+            pblocktemplate->entries[1].tx = MakeTransactionRef(std::move(coinstakeTx));
+            pblock->vtx[1] = pblocktemplate->entries[1].tx;
+            *pfPoSCancel = false;
         }
         if (*pfPoSCancel)
             return nullptr; // peercoin: there is no point to continue if we failed to create coinstake
@@ -537,176 +532,116 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 }
 
 
-bool CreateCoinStake(CMutableTransaction& coinstakeTx, CBlock* pblock, std::shared_ptr<CWallet> pwallet, const int& nHeight, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams)
+bool CreateCoinStake(CMutableTransaction& coinstakeTx, CBlock* pblock, const StakeKernel& kernel, const int& nHeight, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams)
 {
+    const std::shared_ptr<CWallet>& pwallet = kernel.wallet;
     AssertLockHeld(pwallet->cs_wallet);
 
-    bool fKernelFound = false;
-    std::set<CInputCoin> setCoins;
-    if (pwallet->SelectStakeCoins(setCoins)) {
-        while ((pblock->nTime & consensusParams.nStakeTimestampMask) != 0)
-            pblock->nTime++;
+    if (::ChainActive().Height() != pindexPrev->nHeight)
+        return false;
 
-        CAmount nCredit = 0;
-        CScript scriptPubKeyKernel;
-        for (const auto& pcoin : setCoins) {
-            if (::ChainActive().Height() != pindexPrev->nHeight)
-                break;
+    // The kernel was found by the stake minter, and is checked again against
+    // the block it is going into.
+    CCoinsViewCache view(&::ChainstateActive().CoinsTip());
+    const COutPoint& prevout = kernel.prevout;
+    Coin coin;
+    if (!view.GetCoin(prevout, coin)) {
+        if (gArgs.GetBoolArg("-debug", false))
+            LogPrintf("%s : failed to find stake input %s in UTXO set\n", __func__, prevout.hash.ToString());
+        return false;
+    }
 
-            CCoinsViewCache view(&::ChainstateActive().CoinsTip());
-            const COutPoint& prevout = pcoin.outpoint;
-            Coin coin;
+    const CBlockIndex* pindexFrom = ::ChainActive()[coin.nHeight];
+    if (!pindexFrom) {
+        LogPrintf("%s : block index not found\n", __func__);
+        return false;
+    }
 
-            if (!view.GetCoin(prevout, coin)) {
-                if (gArgs.GetBoolArg("-debug", false))
-                    LogPrintf("%s : failed to find stake input %s in UTXO set\n", __func__, prevout.hash.ToString());
-                continue;
-            }
+    if (pindexFrom->GetBlockTime() + consensusParams.nStakeMinAge[1] > pblock->nTime || nHeight - pindexFrom->nHeight < consensusParams.nStakeMinDepth[1])
+        return false; // only count coins meeting min age/depth requirement
 
-            const CBlockIndex* pindexFrom = ::ChainActive()[coin.nHeight];
-            if (!pindexFrom) {
-                LogPrintf("%s : block index not found\n", __func__);
-                continue;
-            }
+    unsigned int nInterval = 0;
+    uint256 hashProofOfStake;
+    if (!CheckStakeKernelHash(pblock->nBits, pindexPrev, pindexFrom, kernel.txout, pindexFrom->GetBlockTime(), prevout, pblock->nTime, nInterval, false, hashProofOfStake, gArgs.GetBoolArg("-debug", false)))
+        return false;
+    if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
+        LogPrintf("%s : kernel found\n", __func__);
+
+    // make sure coinstake would meet timestamp protocol
+    // as it would be the same as the block timestamp
+    if (pblock->nTime <= pindexPrev->GetMedianTimePast() || (pblock->nTime & consensusParams.nStakeTimestampMask) != 0 || (pblock->nTime > GetAdjustedTime() + MAX_FUTURE_BLOCK_TIME && Params().NetworkIDString() != CBaseChainParams::REGTEST)) {
+        if (gArgs.GetBoolArg("-debug", false))
+            LogPrintf("%s : Coinstake timestamp does not meet protocol\n", __func__);
+        return false;
+    }
 
-            if (pindexFrom->GetBlockTime() + consensusParams.nStakeMinAge[1] > pblock->nTime || nHeight - pindexFrom->nHeight < consensusParams.nStakeMinDepth[1])
-                continue; // only count coins meeting min age/depth requirement
-
-            unsigned int nInterval = 0;
-            uint256 hashProofOfStake;
-            if (CheckStakeKernelHash(pblock->nBits, pindexPrev, pindexFrom, pcoin.txout, pindexFrom->GetBlockTime(), prevout, pblock->nTime, nInterval, false, hashProofOfStake, gArgs.GetBoolArg("-debug", false))) {
-                // Found a kernel
-                if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                    LogPrintf("%s : kernel found\n", __func__);
-                //LogPrintf("proof-of-stake found\n   hash: %s\n target: %s\n   bits: %08x\n", hashProofOfStake.ToString(), (arith_uint256().SetCompact(pblock->nBits) * arith_uint256(pcoin.txout.nValue)).ToString(), pblock->nBits);
-
-                // make sure coinstake would meet timestamp protocol
-                // as it would be the same as the block timestamp
-                if (pblock->nTime <= pindexPrev->GetMedianTimePast() || (pblock->nTime & consensusParams.nStakeTimestampMask) != 0 || (pblock->nTime > GetAdjustedTime() + MAX_FUTURE_BLOCK_TIME && Params().NetworkIDString() != CBaseChainParams::REGTEST)) {
-                    if (gArgs.GetBoolArg("-debug", false))
-                        LogPrintf("%s : Coinstake timestamp does not meet protocol\n", __func__);
-                    break;
-                }
+    CAmount nCredit = 0;
+    CScript scriptPubKeyOut;
+    const CScript& scriptPubKeyKernel = kernel.txout.scriptPubKey;
+    // The keys and redeem scripts of the kernel are usually looked up already, by the stake minter
+    const StakeSigningInfo info = pwallet->GetStakeSigningInfo(scriptPubKeyKernel);
+    const TxoutType whichType = info.type;
 
-                std::vector<std::vector<unsigned char>> vSolutions;
-                CScript scriptPubKeyOut;
-                scriptPubKeyKernel = pcoin.txout.scriptPubKey;
-                TxoutType whichType = Solver(scriptPubKeyKernel, vSolutions);
-
-                if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                    LogPrintf("%s : parsed kernel type=%s\n", __func__, GetTxnOutputType(whichType));
-
-                if (whichType == TxoutType::PUBKEY || whichType == TxoutType::PUBKEYHASH || whichType == TxoutType::WITNESS_V0_KEYHASH || whichType == TxoutType::SCRIPTHASH || whichType == TxoutType::WITNESS_V0_SCRIPTHASH) { // we support p2pkh, p2wpkh, p2sh-p2wpkh, and p2sh/p2wsh-multisig inputs
-                    if (whichType == TxoutType::SCRIPTHASH || whichType == TxoutType::WITNESS_V0_SCRIPTHASH) { // a p2sh/p2wsh input could be many things, but we only support p2sh-p2wpkh and multisig for now
-                        CScript subscript;
-                        std::unique_ptr<SigningProvider> provider = pwallet->GetSolvingProvider(scriptPubKeyKernel);
-                        uint160 hash;
-                        if (whichType == TxoutType::WITNESS_V0_SCRIPTHASH) {
-                            CRIPEMD160 hasher;
-                            hasher.Write(&vSolutions[0][0], 32).Finalize(hash.begin());
-                        } else // whichType == TxoutType::SCRIPTHASH
-                            hash = uint160(vSolutions[0]);
-                        if (provider && provider->GetCScript(CScriptID(hash), subscript)) { // extract the redeem script
-                            TxoutType scriptType = Solver(subscript, vSolutions);
-                            if (scriptType != TxoutType::WITNESS_V0_KEYHASH && scriptType != TxoutType::MULTISIG /*&& scriptType != TxoutType::MULTISIG_DATA*/) { // this is a script we don't recognize
-                                if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                                    LogPrintf("%s : no support for %s kernel type=%s\n", __func__, GetTxnOutputType(whichType), GetTxnOutputType(scriptType));
-                                continue;
-                            }
-                            whichType = scriptType;
-                        } else {
-                            if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                                LogPrintf("%s : failed to get script for kernel type=%s\n", __func__, GetTxnOutputType(whichType));
-                            continue; // unable to find corresponding script
-                        }
-                    }
+    if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
+        LogPrintf("%s : parsed kernel type=%s\n", __func__, GetTxnOutputType(info.script_type));
 
-                    if (gArgs.GetBoolArg("-quantumsafestaking", false)) { // a new bech32 address is generated for every stake to protect the public key from quantum computers
-                        OutputType output_type = OutputType::BECH32;
-                        CTxDestination dest;
-                        std::string error;
-                        if (pwallet->GetNewChangeDestination(output_type, dest, error)) {
-                            LogPrintf("%s : using new destination for coinstake (%s)\n", __func__, EncodeDestination(dest));
-                            scriptPubKeyOut = GetScriptForDestination(dest);
-                        } else {
-                            LogPrintf("%s : failed to get new destination for coinstake (%s)\n", __func__, error);
-                            scriptPubKeyOut = scriptPubKeyKernel;
-                        }
-                    } else if (whichType == TxoutType::MULTISIG /*|| whichType == TxoutType::MULTISIG_DATA*/) { // try to create a new destination for p2sh/p2wsh-multisig inputs
-                        OutputType output_type = OutputType::BECH32;
-                        CTxDestination dest;
-                        std::string error;
-                        if (pwallet->GetNewChangeDestination(output_type, dest, error)) {
-                            LogPrintf("%s : using new destination for coinstake (%s)\n", __func__, EncodeDestination(dest));
-                            scriptPubKeyOut = GetScriptForDestination(dest);
-                        } else
-                            continue;
-                    } else if (pwallet->IsWalletFlagSet(WALLET_FLAG_DESCRIPTORS) || whichType == TxoutType::PUBKEY) { // descriptor wallets only credit earnings back to the original address and p2pk inputs can be left alone
-                        scriptPubKeyOut = scriptPubKeyKernel;
-                    } else { // on legacy wallets we can convert every input to p2pk for smaller coinstake TXs
-                        // convert to pay to public key type
-                        CPubKey pubkey;
-                        std::unique_ptr<SigningProvider> provider = pwallet->GetSolvingProvider(scriptPubKeyKernel);
-                        if (!provider || !provider->GetPubKey(CKeyID(uint160(vSolutions[0])), pubkey)) {
-                            if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                                LogPrintf("%s : failed to get key for kernel type=%s\n", __func__, GetTxnOutputType(whichType));
-                            continue; // unable to find corresponding public key
-                        }
-                        scriptPubKeyOut << ToByteVector(pubkey) << OP_CHECKSIG;
-                    }
-                } else if (!pwallet->IsWalletFlagSet(WALLET_FLAG_DESCRIPTORS) && (whichType == TxoutType::MULTISIG /*|| whichType == TxoutType::MULTISIG_DATA*/)) { // convert multisig to p2pk
-                    // convert to pay to public key type
-                    CPubKey pubkey;
-                    bool found = false;
-                    if (vSolutions.size() == 3 && vSolutions.front()[0] == 1 && vSolutions.back()[0] == 1) { // only support single pubkey multisig for now
-                        pubkey = CPubKey(vSolutions[1]);
-                        if (pubkey.IsValid())
-                            found = true;
-                    }
-                    if (found) {
-                        scriptPubKeyOut << ToByteVector(pubkey) << OP_CHECKSIG;
-                    } else {
-                        if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                            LogPrintf("%s : failed to get key for kernel type=%s\n", __func__, GetTxnOutputType(whichType));
-                        continue; // unable to find corresponding public key
-                    }
-                } else {
-                    if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                        LogPrintf("%s : no support for kernel type=%s\n", __func__, GetTxnOutputType(whichType));
-                    continue; // only support p2pk, p2pkh, p2wpkh, p2sh-p2wpkh, and p2sh/p2wsh-multisig
-                }
+    if (!info.can_sign || (info.script_type == TxoutType::MULTISIG && pwallet->IsWalletFlagSet(WALLET_FLAG_DESCRIPTORS))) {
+        if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
+            LogPrintf("%s : no support for kernel type=%s\n", __func__, GetTxnOutputType(info.script_type));
+        return false; // only support p2pk, p2pkh, p2wpkh, p2sh-p2wpkh, and p2sh/p2wsh-multisig
+    }
 
-                coinstakeTx.vin.push_back(CTxIn(prevout.hash, prevout.n));
-                nCredit += pcoin.txout.nValue;
-                coinstakeTx.vout.push_back(CTxOut(0, CScript()));
-                if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                    LogPrintf("%s : added kernel type=%s\n", __func__, GetTxnOutputType(whichType));
+    if (info.script_type == TxoutType::MULTISIG) { // convert multisig to p2pk
+        scriptPubKeyOut << ToByteVector(info.pubkey) << OP_CHECKSIG;
+    } else if (gArgs.GetBoolArg("-quantumsafestaking", false)) { // a new bech32 address is generated for every stake to protect the public key from quantum computers
+        CTxDestination dest;
+        std::string error;
+        if (pwallet->GetStakeDestination(dest, error)) {
+            LogPrintf("%s : using new destination for coinstake (%s)\n", __func__, EncodeDestination(dest));
+            scriptPubKeyOut = GetScriptForDestination(dest);
+        } else {
+            LogPrintf("%s : failed to get new destination for coinstake (%s)\n", __func__, error);
+            scriptPubKeyOut = scriptPubKeyKernel;
+        }
+    } else if (whichType == TxoutType::MULTISIG /*|| whichType == TxoutType::MULTISIG_DATA*/) { // try to create a new destination for p2sh/p2wsh-multisig inputs
+        CTxDestination dest;
+        std::string error;
+        if (pwallet->GetStakeDestination(dest, error)) {
+            LogPrintf("%s : using new destination for coinstake (%s)\n", __func__, EncodeDestination(dest));
+            scriptPubKeyOut = GetScriptForDestination(dest);
+        } else
+            return false;
+    } else if (pwallet->IsWalletFlagSet(WALLET_FLAG_DESCRIPTORS) || whichType == TxoutType::PUBKEY) { // descriptor wallets only credit earnings back to the original address and p2pk inputs can be left alone
+        scriptPubKeyOut = scriptPubKeyKernel;
+    } else { // on legacy wallets we can convert every input to p2pk for smaller coinstake TXs
+        scriptPubKeyOut << ToByteVector(info.pubkey) << OP_CHECKSIG;
+    }
 
-                uint64_t nCoinAge = 0;
-                if (!GetCoinAge((const CTransaction)coinstakeTx, view, pblock->nTime, nHeight, nCoinAge))
-                    return error("%s : failed to calculate coin age", __func__);
+    coinstakeTx.vin.push_back(CTxIn(prevout.hash, prevout.n));
+    nCredit += kernel.txout.nValue;
+    coinstakeTx.vout.push_back(CTxOut(0, CScript()));
+    if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
+        LogPrintf("%s : added kernel type=%s\n", __func__, GetTxnOutputType(whichType));
 
-                CAmount nReward = GetBlockSubsidy(nHeight, true, nCoinAge, consensusParams);
-                // Refuse to create mint that has zero or negative reward
-                if (nReward < 0)
-                    return error("%s : not creating mint with negative subsidy", __func__);
-                nCredit += nReward;
-                coinstakeTx.vout.push_back(CTxOut(nCredit, scriptPubKeyOut));
+    uint64_t nCoinAge = 0;
+    if (!GetCoinAge((const CTransaction)coinstakeTx, view, pblock->nTime, nHeight, nCoinAge))
+        return error("%s : failed to calculate coin age", __func__);
 
-                // Add treasury payment
-                FillTreasuryPayee(coinstakeTx, nHeight, consensusParams);
+    CAmount nReward = GetBlockSubsidy(nHeight, true, nCoinAge, consensusParams);
+    // Refuse to create mint that has zero or negative reward
+    if (nReward < 0)
+        return error("%s : not creating mint with negative subsidy", __func__);
+    nCredit += nReward;
+    coinstakeTx.vout.push_back(CTxOut(nCredit, scriptPubKeyOut));
 
-                // Sign
-                if (!pwallet->SignTransaction(coinstakeTx))
-                    return error("%s : failed to sign coinstake", __func__);
+    // Add treasury payment
+    FillTreasuryPayee(coinstakeTx, nHeight, consensusParams);
 
-                fKernelFound = true;
-                break; // if kernel is found stop searching
-            }
-        }
-    }
+    // Sign
+    if (!pwallet->SignTransaction(coinstakeTx))
+        return error("%s : failed to sign coinstake", __func__);
 
-    return fKernelFound;
+    return true;
 }
 
 static inline bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainparams, ChainstateManager* chainman)
@@ -727,23 +662,101 @@ static inline bool ProcessBlockFound(const CBlock* pblock, const CChainParams& c
     return true;
 }
 
-static inline void PoSMiner(std::shared_ptr<CWallet> pwallet, ChainstateManager* chainman, CConnman* connman, CTxMemPool* mempool)
+namespace {
+/** A wallet output that may be a kernel, pooled with those of the other wallets for one search. */
+struct StakeCandidate {
+    size_t wallet; //!< index of the owning wallet
+    COutPoint prevout;
+    CTxOut txout;
+};
+} // namespace
+
+std::vector<std::shared_ptr<CWallet>> GetStakingWallets()
 {
-    LogPrintf("CPUMiner started for proof-of-stake\n");
+    std::vector<std::shared_ptr<CWallet>> wallets = GetWallets();
+    wallets.erase(std::remove_if(wallets.begin(), wallets.end(), [](const std::shared_ptr<CWallet>& wallet) { return wallet->IsLocked(); }), wallets.end());
+    return wallets;
+}
 
-    unsigned int nExtraNonce = 0;
+// peercoin: search the stake coins of all given wallets for kernels at the next
+// timestamp slot. The coins of the wallets are pooled so that a single search
+// per slot covers every loaded wallet.
+bool FindStakeKernels(const std::vector<std::shared_ptr<CWallet>>& wallets, std::vector<StakeKernel>& kernels, size_t& num_coins, int64_t& nLastSearchTime, uint256& hashLastSearchTip)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    kernels.clear();
 
-    // Compute timeout for pos as sqrt(numUTXO)
-    unsigned int pos_timio;
+    // The header the kernels are searched for, as CreateNewBlock will fill it in
+    CBlockHeader header;
+    const CBlockIndex* pindexPrev;
     {
-        LOCK(pwallet->cs_wallet);
+        LOCK(cs_main);
+        pindexPrev = ::ChainActive().Tip();
+        header.nVersion = ComputeBlockVersion(pindexPrev, CBlockHeader::ALGO_POS, consensusParams);
+        if (Params().MineBlocksOnDemand())
+            header.nVersion = gArgs.GetArg("-blockversion", header.nVersion);
+        header.nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
+        while ((header.nTime & consensusParams.nStakeTimestampMask) != 0)
+            header.nTime++;
+        header.nBits = GetNextWorkRequired(pindexPrev, &header, consensusParams);
+    }
+    if (header.nTime == nLastSearchTime && pindexPrev->GetBlockHash() == hashLastSearchTip)
+        return false;
+
+    std::vector<StakeCandidate> candidates;
+    for (size_t i = 0; i < wallets.size(); ++i) {
+        LOCK(wallets[i]->cs_wallet);
+        std::set<CInputCoin> setCoins;
+        if (!wallets[i]->SelectStakeCoins(setCoins))
+            continue;
+        wallets[i]->PrepareStakeSigning(setCoins);
+        for (const CInputCoin& coin : setCoins)
+            candidates.push_back(StakeCandidate{i, coin.outpoint, coin.txout});
+    }
+    num_coins = candidates.size();
+
+    LOCK(cs_main);
+    if (::ChainActive().Tip() != pindexPrev)
+        return false; // the tip moved while the coins were gathered, search again on the new one
+    if (nLastSearchTime != 0)
+        nLastCoinStakeSearchInterval = header.nTime - nLastSearchTime;
+    nLastSearchTime = header.nTime;
+    hashLastSearchTip = pindexPrev->GetBlockHash();
+
+    const int nHeight = pindexPrev->nHeight + 1;
+    const CCoinsViewCache& view = ::ChainstateActive().CoinsTip();
+    for (const StakeCandidate& candidate : candidates) {
+        Coin coin;
+        if (!view.GetCoin(candidate.prevout, coin))
+            continue;
+
+        const CBlockIndex* pindexFrom = ::ChainActive()[coin.nHeight];
+        if (!pindexFrom)
+            continue;
+
+        if (pindexFrom->GetBlockTime() + consensusParams.nStakeMinAge[1] > header.nTime || nHeight - pindexFrom->nHeight < consensusParams.nStakeMinDepth[1])
+            continue; // only count coins meeting min age/depth requirement
 
-        std::vector<COutput> vCoins;
-        CCoinControl coincontrol;
-        pwallet->AvailableCoins(vCoins, false, &coincontrol);
-        pos_timio = gArgs.GetArg("-staketimio", 500) + 30 * sqrt(vCoins.size());
-        LogPrintf("Set proof-of-stake timeout: %ums for %u UTXOs\n", pos_timio, vCoins.size());
+        unsigned int nTime = header.nTime;
+        unsigned int nInterval = 0;
+        uint256 hashProofOfStake;
+        if (CheckStakeKernelHash(header.nBits, pindexPrev, pindexFrom, candidate.txout, pindexFrom->GetBlockTime(), candidate.prevout, nTime, nInterval, false, hashProofOfStake, gArgs.GetBoolArg("-debug", false)))
+            kernels.push_back(StakeKernel{wallets[candidate.wallet], candidate.prevout, candidate.txout, header.nTime});
     }
+    return true;
+}
+
+static inline void PoSMiner(ChainstateManager* chainman, CConnman* connman, CTxMemPool* mempool)
+{
+    LogPrintf("CPUMiner started for proof-of-stake\n");
+
+    unsigned int nExtraNonce = 0;
+
+    // Timeout for pos is computed as sqrt(numUTXO) over the stake coins of all wallets
+    unsigned int pos_timio = gArgs.GetArg("-staketimio", 500);
+    size_t nStakeCoins = 0;
+    int64_t nLastSearchTime = 0;
+    uint256 hashLastSearchTip;
 
     const std::string strMintWalletMessage = _("Info: Minting suspended due to locked wallet.").translated;
     const std::string strMintSyncMessage = _("Info: Minting suspended while synchronizing wallet.").translated;
@@ -760,16 +773,6 @@ static inline void PoSMiner(std::shared_ptr<CWallet> pwallet, ChainstateManager*
     try {
         bool fNeedToClear = false;
         while (true) {
-            while (pwallet->IsLocked()) {
-                if (GetMintWarning() != strMintWalletMessage) {
-                    SetMintWarning(strMintWalletMessage);
-                    uiInterface.NotifyAlertChanged();
-                }
-                fNeedToClear = true;
-                if (!connman->interruptNet.sleep_for(std::chrono::seconds(3)))
-                    return;
-            }
-
             if (Params().NetworkIDString() != CBaseChainParams::REGTEST) { // Params().MiningRequiresPeers()
                 // Busy-wait for the network to come online so we don't waste time mining
                 // on an obsolete chain. In regtest mode we expect to fly solo.
@@ -794,71 +797,101 @@ static inline void PoSMiner(std::shared_ptr<CWallet> pwallet, ChainstateManager*
                 if (!connman->interruptNet.sleep_for(std::chrono::seconds(10)))
                     return;
             }
+
+            // Wallets loaded or unloaded while the node runs take part from the
+            // next round on. Locked wallets can't sign, so they are left out.
+            std::vector<std::shared_ptr<CWallet>> wallets = GetStakingWallets();
+            if (wallets.empty()) {
+                if (!GetWallets().empty() && GetMintWarning() != strMintWalletMessage) {
+                    SetMintWarning(strMintWalletMessage);
+                    uiInterface.NotifyAlertChanged();
+                }
+                fNeedToClear = true;
+                if (!connman->interruptNet.sleep_for(std::chrono::seconds(3)))
+                    return;
+                continue;
+            }
+
             if (fNeedToClear) {
                 SetMintWarning(strMintEmpty);
                 uiInterface.NotifyAlertChanged();
                 fNeedToClear = false;
             }
 
-            //
-            // Create new block
-            //
-            CBlockIndex* pindexPrev = ::ChainActive().Tip();
-            bool fPoSCancel = false;
-            CBlock *pblock;
-            std::unique_ptr<CBlockTemplate> pblocktemplate;
-
-            {
-                LOCK(pwallet->cs_wallet);
+            std::vector<StakeKernel> kernels;
+            FindStakeKernels(wallets, kernels, nStakeCoins, nLastSearchTime, hashLastSearchTip);
+            // The wallets are not held on to between searches, so that they can be unloaded
+            wallets.clear();
 
-                pblocktemplate = BlockAssembler(*mempool, Params()).CreateNewBlock(CScript(), pwallet, &fPoSCancel);
+            const unsigned int timio = gArgs.GetArg("-staketimio", 500) + 30 * sqrt(nStakeCoins);
+            if (timio != pos_timio) {
+                pos_timio = timio;
+                LogPrintf("Set proof-of-stake timeout: %ums for %u UTXOs\n", pos_timio, nStakeCoins);
             }
 
-            if (!pblocktemplate.get()) {
-                if (fPoSCancel == true) {
-                    if (!connman->interruptNet.sleep_for(std::chrono::milliseconds(pos_timio)))
-                        return;
-                    continue;
+            // The block is created and signed by the wallet owning the kernel.
+            // If the coinstake can't be made for a kernel the next one is tried.
+            bool fBlockFound = false;
+            for (const StakeKernel& kernel : kernels) {
+                //
+                // Create new block
+                //
+                CBlockIndex* pindexPrev = ::ChainActive().Tip();
+                bool fPoSCancel = false;
+                CBlock *pblock;
+                std::unique_ptr<CBlockTemplate> pblocktemplate;
+
+                {
+                    LOCK(kernel.wallet->cs_wallet);
+
+                    pblocktemplate = BlockAssembler(*mempool, Params()).CreateNewBlock(CScript(), &kernel, &fPoSCancel);
                 }
-                SetMintWarning(strMintBlockMessage);
-                uiInterface.NotifyAlertChanged();
-                LogPrintf("Error in XUEZMiner: Keypool ran out, please call keypoolrefill before restarting the staking thread\n");
-                if (!connman->interruptNet.sleep_for(std::chrono::seconds(10)))
-                   return;
 
-                return;
-            }
-            pblock = &pblocktemplate->block;
-            CPubKey signingPubKey;
-            bool pubkeyInSig = true;
-            {
-                LOCK(pwallet->cs_wallet);
-
-                if (!pwallet->GetBlockSigningPubKey(*pblock, signingPubKey, pubkeyInSig)) {
-                    LogPrintf("PoSMiner(): failed to get signing pubkey for PoS block\n");
-                    continue;
+                if (!pblocktemplate.get()) {
+                    if (fPoSCancel == true)
+                        continue;
+                    SetMintWarning(strMintBlockMessage);
+                    uiInterface.NotifyAlertChanged();
+                    LogPrintf("Error in XUEZMiner: Keypool ran out, please call keypoolrefill before restarting the staking thread\n");
+                    fNeedToClear = true;
+                    if (!connman->interruptNet.sleep_for(std::chrono::seconds(10)))
+                       return;
+                    break;
                 }
-            }
-            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce, pubkeyInSig ? nullptr : &signingPubKey);
+                pblock = &pblocktemplate->block;
+                CPubKey signingPubKey;
+                bool pubkeyInSig = true;
+                {
+                    LOCK(kernel.wallet->cs_wallet);
+
+                    if (!kernel.wallet->GetBlockSigningPubKey(*pblock, signingPubKey, pubkeyInSig)) {
+                        LogPrintf("PoSMiner(): failed to get signing pubkey for PoS block\n");
+                        continue;
+                    }
+                }
+                IncrementExtraNonce(pblock, pindexPrev, nExtraNonce, pubkeyInSig ? nullptr : &signingPubKey);
 
-            // peercoin: if proof-of-stake block found then process block
-            {
-                LOCK(pwallet->cs_wallet);
+                // peercoin: if proof-of-stake block found then process block
+                {
+                    LOCK(kernel.wallet->cs_wallet);
 
-                if (!pwallet->SignBlock(*pblock, signingPubKey)) {
-                    LogPrintf("PoSMiner(): failed to sign PoS block\n");
-                    continue;
+                    if (!kernel.wallet->SignBlock(*pblock, signingPubKey)) {
+                        LogPrintf("PoSMiner(): failed to sign PoS block\n");
+                        continue;
+                    }
                 }
+                LogPrintf("CPUMiner : proof-of-stake block found %s by wallet %s\n", pblock->GetHash().ToString(), kernel.wallet->GetName());
+                ProcessBlockFound(pblock, Params(), chainman);
+                fBlockFound = true;
+                break;
             }
-            LogPrintf("CPUMiner : proof-of-stake block found %s\n", pblock->GetHash().ToString());
-            ProcessBlockFound(pblock, Params(), chainman);
+            kernels.clear();
+
             // Rest for ~3 minutes after successful block to preserve close quick
-            if (!connman->interruptNet.sleep_for(std::chrono::seconds(60 + GetRand(4))))
+            if (fBlockFound && !connman->interruptNet.sleep_for(std::chrono::seconds(60 + GetRand(4))))
                 return;
             if (!connman->interruptNet.sleep_for(std::chrono::milliseconds(pos_timio)))
                 return;
-
-            continue;
         }
     } catch (boost::thread_interrupted) {
         LogPrintf("XUEZMiner terminated\n");
@@ -871,23 +904,23 @@ static inline void PoSMiner(std::shared_ptr<CWallet> pwallet, ChainstateManager*
 }
 
 // peercoin: stake minter thread
-static void ThreadStakeMinter(std::shared_ptr<CWallet> pwallet, const unsigned int walletNum, ChainstateManager* chainman, CConnman* connman, CTxMemPool* mempool)
+static void ThreadStakeMinter(ChainstateManager* chainman, CConnman* connman, CTxMemPool* mempool)
 {
-    util::ThreadRename("xuez-stake-minter-" + std::to_string(walletNum));
-    LogPrintf("ThreadStakeMinter #%u started\n", walletNum);
+    util::ThreadRename("xuez-stake-minter");
+    LogPrintf("ThreadStakeMinter started\n");
     try {
-        PoSMiner(pwallet, chainman, connman, mempool);
+        PoSMiner(chainman, connman, mempool);
     } catch (std::exception& e) {
         PrintExceptionContinue(&e, "ThreadStakeMinter()");
     } catch (...) {
         PrintExceptionContinue(NULL, "ThreadStakeMinter()");
     }
-    LogPrintf("ThreadStakeMinter #%u exiting\n", walletNum);
+    LogPrintf("ThreadStakeMinter exiting\n");
 }
 
 // peercoin: stake minter
-void MintStake(boost::thread_group& threadGroup, std::shared_ptr<CWallet> pwallet, const unsigned int walletNum, ChainstateManager* chainman, CConnman* connman, CTxMemPool* mempool)
+void MintStake(boost::thread_group& threadGroup, ChainstateManager* chainman, CConnman* connman, CTxMemPool* mempool)
 {
     // peercoin: mint proof-of-stake blocks in the background
-    threadGroup.create_thread(boost::bind(&ThreadStakeMinter, pwallet, walletNum, chainman, connman, mempool));
+    threadGroup.create_thread(boost::bind(&ThreadStakeMinter, chainman, connman, mempool));
 }
@@ -29,6 +29,15 @@ namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
 
+/** A wallet output found by the stake minter to meet the proof-of-stake target at a block time. */
+struct StakeKernel
+{
+    std::shared_ptr<CWallet> wallet; //!< the wallet owning the output, which signs the block
+    COutPoint prevout;
+    CTxOut txout;
+    int64_t nTime;
+};
+
 struct CBlockTemplateEntry
 {
     CTransactionRef tx;
@@ -171,7 +180,7 @@ public:
     explicit BlockAssembler(const CTxMemPool& mempool, const CChainParams& params, const Options& options);
 
     /** Construct a new block template with coinbase to scriptPubKeyIn */
-    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, std::shared_ptr<CWallet> pwallet=nullptr, bool* pfPoSCancel=nullptr);
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, const StakeKernel* stake_kernel=nullptr, bool* pfPoSCancel=nullptr);
 
     static Optional<int64_t> m_last_block_num_txs;
     static Optional<int64_t> m_last_block_weight;
@@ -221,7 +230,13 @@ namespace boost {
     class thread_group;
 } // namespace boost
 
-bool CreateCoinStake(CMutableTransaction& coinstakeTx, CBlock* pblock, std::shared_ptr<CWallet> pwallet, const int& nHeight, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams);
-void MintStake(boost::thread_group& threadGroup, std::shared_ptr<CWallet> pwallet, const unsigned int walletNum, ChainstateManager* chainman, CConnman* connman, CTxMemPool* mempool);
+bool CreateCoinStake(CMutableTransaction& coinstakeTx, CBlock* pblock, const StakeKernel& kernel, const int& nHeight, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams);
+/** The loaded wallets the stake minter searches, leaving out the locked ones, which can't sign. */
+std::vector<std::shared_ptr<CWallet>> GetStakingWallets();
+/** Search the pooled stake coins of the given wallets for kernels at the next timestamp slot.
+ *  Returns false if the slot has already been searched on the current tip. */
+bool FindStakeKernels(const std::vector<std::shared_ptr<CWallet>>& wallets, std::vector<StakeKernel>& kernels, size_t& num_coins, int64_t& nLastSearchTime, uint256& hashLastSearchTip);
+/** Start the stake minter, which stakes the coins of all loaded wallets with one kernel search per timestamp slot. */
+void MintStake(boost::thread_group& threadGroup, ChainstateManager* chainman, CConnman* connman, CTxMemPool* mempool);
 
 #endif // BITCOIN_MINER_H
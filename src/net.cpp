@@ -32,6 +32,14 @@
 #include <poll.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#if HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/upnpcommands.h>
@@ -101,6 +109,21 @@ enum BindFlags {
 // The sleep time needs to be small to avoid new sockets stalling
 static const uint64_t SELECT_TIMEOUT_MILLISECONDS = 50;
 
+#ifdef USE_EPOLL
+/** Maximum number of readiness events collected per epoll_wait() call */
+static constexpr int EPOLL_MAX_EVENTS = 256;
+/** Marks epoll event data that refers to an index in vhListenSocket rather than a NodeId */
+static constexpr uint64_t EPOLL_LISTEN_SOCKET_FLAG = uint64_t{1} << 63;
+#endif
+
+/** Size of the buffer a single recv() call on a peer socket reads into */
+static constexpr size_t SOCKET_RECV_BUFFER_SIZE = 0x10000;
+
+/** Maximum number of message payload buffers kept for reuse */
+static constexpr size_t MAX_POOLED_MESSAGE_BUFFERS = 32;
+/** Maximum total capacity of the message payload buffers kept for reuse */
+static constexpr size_t MAX_POOLED_MESSAGE_BYTES = 8 * 1024 * 1024;
+
 const std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
@@ -116,6 +139,7 @@ RecursiveMutex cs_mapLocalHost;
 std::map<CNetAddr, LocalServiceInfo> mapLocalHost GUARDED_BY(cs_mapLocalHost);
 static bool vfLimited[NET_MAX] GUARDED_BY(cs_mapLocalHost) = {};
 std::string strSubVersion;
+CNetMessageBufferPool g_net_message_buffers;
 
 void CConnman::AddAddrFetch(const std::string& strDest)
 {
@@ -731,6 +755,11 @@ int V1TransportDeserializer::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
+    if (vRecv.capacity() == 0) {
+        // The previous payload buffer was handed over with the last message.
+        g_net_message_buffers.Take(vRecv, hdr.nMessageSize);
+    }
+
     if (vRecv.size() < nDataPos + nCopy) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
         vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
@@ -743,6 +772,44 @@ int V1TransportDeserializer::readData(const char *pch, unsigned int nBytes)
     return nCopy;
 }
 
+void CNetMessageBufferPool::Take(CDataStream& stream, size_t payload_size)
+{
+    LOCK(m_mutex);
+    if (m_buffers.empty()) return;
+
+    // Prefer the smallest buffer the payload fits into, otherwise the largest one.
+    auto best = m_buffers.begin();
+    for (auto it = std::next(best); it != m_buffers.end(); ++it) {
+        const bool fits = it->capacity() >= payload_size;
+        const bool best_fits = best->capacity() >= payload_size;
+        if (fits != best_fits) {
+            if (fits) best = it;
+        } else if (fits ? it->capacity() < best->capacity() : it->capacity() > best->capacity()) {
+            best = it;
+        }
+    }
+
+    const int type = stream.GetType();
+    const int version = stream.GetVersion();
+    m_pooled_bytes -= best->capacity();
+    stream = std::move(*best);
+    stream.SetType(type);
+    stream.SetVersion(version);
+    m_buffers.erase(best);
+}
+
+void CNetMessageBufferPool::Give(CDataStream&& stream)
+{
+    const size_t capacity = stream.capacity();
+    if (capacity == 0) return;
+    stream.clear();
+
+    LOCK(m_mutex);
+    if (m_buffers.size() >= MAX_POOLED_MESSAGE_BUFFERS || m_pooled_bytes + capacity > MAX_POOLED_MESSAGE_BYTES) return;
+    m_pooled_bytes += capacity;
+    m_buffers.push_back(std::move(stream));
+}
+
 const uint256& V1TransportDeserializer::GetMessageHash() const
 {
     assert(Complete());
@@ -789,11 +856,11 @@ Optional<CNetMessage> V1TransportDeserializer::GetMessage(const std::chrono::mic
 }
 
 void V1TransportSerializer::prepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header) {
-    // create dbl-sha256 checksum
-    uint256 hash = Hash(msg.data);
+    // create dbl-sha256 checksum; file payloads come with theirs precomputed
+    uint256 hash = msg.m_file.IsNull() ? Hash(msg.data) : msg.m_file.hash;
 
     // create header
-    CMessageHeader hdr(Params().MessageStart(), msg.m_type.c_str(), msg.data.size());
+    CMessageHeader hdr(Params().MessageStart(), msg.m_type.c_str(), msg.PayloadSize());
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
     // serialize header
@@ -801,20 +868,58 @@ void V1TransportSerializer::prepareForTransport(CSerializedNetMsg& msg, std::vec
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, header, 0, hdr};
 }
 
+/**
+ * Send up to len bytes of a queued file region, starting at offset.
+ * Uses sendfile() where available so the payload never passes through user
+ * space. nBytes is set like the return value of send(). Returns false if the
+ * file could not be read.
+ */
+static bool SendFileRegion(SOCKET hSocket, const CSendQueueEntry& entry, size_t offset, size_t len, int& nBytes)
+{
+#if HAVE_SENDFILE
+    off_t file_offset = entry.file.offset + offset;
+    nBytes = sendfile(hSocket, fileno(entry.fp.get()), &file_offset, len);
+    // Nothing sent means the region runs past the end of the file
+    if (nBytes == 0 || (nBytes < 0 && (errno == EINVAL || errno == ENOSYS))) return false;
+#else
+    char pchBuf[SOCKET_SEND_FILE_CHUNK_SIZE];
+    if (fseek(entry.fp.get(), entry.file.offset + offset, SEEK_SET) != 0) return false;
+    if (fread(pchBuf, 1, len, entry.fp.get()) != len) return false;
+    nBytes = send(hSocket, pchBuf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+    return true;
+}
+
 size_t CConnman::SocketSendData(CNode *pnode) const EXCLUSIVE_LOCKS_REQUIRED(pnode->cs_vSend)
 {
     auto it = pnode->vSendMsg.begin();
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
+        auto &data = *it;
         assert(data.size() > pnode->nSendOffset);
+        if (!data.file.IsNull() && !data.fp) {
+            data.fp = std::shared_ptr<FILE>(fsbridge::fopen(data.file.path, "rb"), [](FILE* f) { if (f) fclose(f); });
+            if (!data.fp.get()) {
+                LogPrintf("cannot open %s for sending to peer=%d\n", data.file.path.string(), pnode->GetId());
+                pnode->CloseSocketDisconnect();
+                break;
+            }
+        }
+        // File regions are sent a chunk at a time
+        const size_t nRequested = data.file.IsNull() ? data.size() - pnode->nSendOffset : std::min<size_t>(data.size() - pnode->nSendOffset, SOCKET_SEND_FILE_CHUNK_SIZE);
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (data.file.IsNull()) {
+                nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data.data()) + pnode->nSendOffset, nRequested, MSG_NOSIGNAL | MSG_DONTWAIT);
+            } else if (!SendFileRegion(pnode->hSocket, data, pnode->nSendOffset, nRequested, nBytes)) {
+                LogPrintf("cannot read %s for sending to peer=%d\n", data.file.path.string(), pnode->GetId());
+                pnode->CloseSocketDisconnect();
+                break;
+            }
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
@@ -826,10 +931,12 @@ size_t CConnman::SocketSendData(CNode *pnode) const EXCLUSIVE_LOCKS_REQUIRED(pno
                 pnode->nSendSize -= data.size();
                 pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
                 it++;
-            } else {
+            } else if ((size_t)nBytes < nRequested) {
                 // could not send full message; stop sending more
                 break;
             }
+            // otherwise the socket took a whole file chunk; keep sending the
+            // region, as no new writable event comes while the buffer has room
         } else {
             if (nBytes < 0) {
                 // error
@@ -1150,6 +1257,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterSocketEvents(pnode);
     }
 
     // We received a new connection, harvest entropy from the time (and our peer count)
@@ -1179,6 +1287,9 @@ void CConnman::DisconnectNodes()
             {
                 // remove from vNodes
                 vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+#ifdef USE_EPOLL
+                m_epoll_nodes.erase(pnode->GetId());
+#endif
 
                 // release outbound grant (if any)
                 pnode->grantOutbound.Release();
@@ -1426,8 +1537,207 @@ void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_s
 }
 #endif
 
+int CConnman::SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[SOCKET_RECV_BUFFER_SIZE];
+    int nBytes = 0;
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            return -1;
+        nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    }
+    if (nBytes > 0)
+    {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+            pnode->CloseSocketDisconnect();
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                // vRecvMsg contains only completed CNetMessage
+                // the single possible partially deserialized message are held by TransportDeserializer
+                nSizeAdded += it->m_raw_message_size;
+            }
+            {
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            WakeMessageHandler();
+        }
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect) {
+            LogPrint(BCLog::NET, "socket closed for peer=%d\n", pnode->GetId());
+        }
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect) {
+                LogPrint(BCLog::NET, "socket recv error for peer=%d: %s\n", pnode->GetId(), NetworkErrorString(nErr));
+            }
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return nBytes;
+}
+
+void CConnman::RegisterSocketEvents(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (m_epoll_fd == -1) return;
+
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET) return;
+
+    // Edge-triggered: the kernel reports each socket once per state change, so
+    // the per-iteration cost is proportional to the number of active peers.
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = static_cast<uint64_t>(pnode->GetId());
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("epoll_ctl failed to register peer=%d: %s\n", pnode->GetId(), NetworkErrorString(WSAGetLastError()));
+        pnode->fDisconnect = true;
+        return;
+    }
+    m_epoll_nodes.emplace(pnode->GetId(), pnode);
+#endif
+}
+
+#ifdef USE_EPOLL
+void CConnman::SocketHandlerEpoll()
+{
+    // Don't block if a peer still has unread data that we are able to receive.
+    int timeout = SELECT_TIMEOUT_MILLISECONDS;
+    std::set<NodeId> recv_nodes;
+    std::set<NodeId> send_nodes;
+    {
+        LOCK(cs_vNodes);
+        for (auto it = m_epoll_recv_pending.begin(); it != m_epoll_recv_pending.end();) {
+            auto node_it = m_epoll_nodes.find(*it);
+            if (node_it == m_epoll_nodes.end()) {
+                it = m_epoll_recv_pending.erase(it);
+                continue;
+            }
+            if (!node_it->second->fPauseRecv) {
+                timeout = 0;
+                recv_nodes.insert(*it);
+            }
+            ++it;
+        }
+    }
+
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int nEvents = epoll_wait(m_epoll_fd, events, EPOLL_MAX_EVENTS, timeout);
+
+    if (interruptNet) return;
+
+    if (nEvents < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; ++i) {
+        const uint64_t data = events[i].data.u64;
+        if (data & EPOLL_LISTEN_SOCKET_FLAG) {
+            // Listen sockets are level-triggered, so one accept per wakeup is enough.
+            const ListenSocket& hListenSocket = vhListenSocket.at(data & ~EPOLL_LISTEN_SOCKET_FLAG);
+            if (hListenSocket.socket != INVALID_SOCKET) {
+                AcceptConnection(hListenSocket);
+            }
+            continue;
+        }
+        const NodeId id = static_cast<NodeId>(data);
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+            m_epoll_recv_pending.insert(id);
+            recv_nodes.insert(id);
+        }
+        if (events[i].events & EPOLLOUT) {
+            send_nodes.insert(id);
+        }
+    }
+
+    // Once per second, look at every peer: check for inactivity, and retry any
+    // send queue left behind as a safety net for a missed writability edge.
+    const int64_t nTime = GetSystemTimeInSeconds();
+    const bool sweep = nTime >= m_epoll_next_sweep;
+    if (sweep) m_epoll_next_sweep = nTime + 1;
+
+    std::vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        if (sweep) {
+            vNodesCopy = vNodes;
+        } else {
+            std::set<NodeId> active_nodes(recv_nodes);
+            active_nodes.insert(send_nodes.begin(), send_nodes.end());
+            for (const NodeId id : active_nodes) {
+                auto it = m_epoll_nodes.find(id);
+                if (it != m_epoll_nodes.end()) vNodesCopy.push_back(it->second);
+            }
+        }
+        for (CNode* pnode : vNodesCopy)
+            pnode->AddRef();
+    }
+    for (CNode* pnode : vNodesCopy)
+    {
+        if (interruptNet)
+            break;
+
+        const NodeId id = pnode->GetId();
+        if (recv_nodes.count(id) && !pnode->fPauseRecv) {
+            // A short read means the socket buffer was drained; the next arrival
+            // will trigger a new edge.
+            if (SocketRecvData(pnode) < static_cast<int>(SOCKET_RECV_BUFFER_SIZE)) {
+                m_epoll_recv_pending.erase(id);
+            }
+        }
+
+        if (send_nodes.count(id) || sweep) {
+            LOCK(pnode->cs_vSend);
+            if (!pnode->vSendMsg.empty()) {
+                size_t nBytes = SocketSendData(pnode);
+                if (nBytes) {
+                    RecordBytesSent(nBytes);
+                }
+            }
+        }
+
+        if (sweep) InactivityCheck(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodesCopy)
+            pnode->Release();
+    }
+}
+#endif
+
 void CConnman::SocketHandler()
 {
+#ifdef USE_EPOLL
+    if (m_epoll_fd != -1) {
+        SocketHandlerEpoll();
+        return;
+    }
+#endif
+
     std::set<SOCKET> recv_set, send_set, error_set;
     SocketEvents(recv_set, send_set, error_set);
 
@@ -1475,58 +1785,7 @@ void CConnman::SocketHandler()
         }
         if (recvSet || errorSet)
         {
-            // typical socket buffer is 8K-64K
-            char pchBuf[0x10000];
-            int nBytes = 0;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-            }
-            if (nBytes > 0)
-            {
-                bool notify = false;
-                if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                    pnode->CloseSocketDisconnect();
-                RecordBytesRecv(nBytes);
-                if (notify) {
-                    size_t nSizeAdded = 0;
-                    auto it(pnode->vRecvMsg.begin());
-                    for (; it != pnode->vRecvMsg.end(); ++it) {
-                        // vRecvMsg contains only completed CNetMessage
-                        // the single possible partially deserialized message are held by TransportDeserializer
-                        nSizeAdded += it->m_raw_message_size;
-                    }
-                    {
-                        LOCK(pnode->cs_vProcessMsg);
-                        pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                        pnode->nProcessQueueSize += nSizeAdded;
-                        pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                    }
-                    WakeMessageHandler();
-                }
-            }
-            else if (nBytes == 0)
-            {
-                // socket closed gracefully
-                if (!pnode->fDisconnect) {
-                    LogPrint(BCLog::NET, "socket closed for peer=%d\n", pnode->GetId());
-                }
-                pnode->CloseSocketDisconnect();
-            }
-            else if (nBytes < 0)
-            {
-                // error
-                int nErr = WSAGetLastError();
-                if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                {
-                    if (!pnode->fDisconnect) {
-                        LogPrint(BCLog::NET, "socket recv error for peer=%d: %s\n", pnode->GetId(), NetworkErrorString(nErr));
-                    }
-                    pnode->CloseSocketDisconnect();
-                }
-            }
+            SocketRecvData(pnode);
         }
 
         //
@@ -1564,9 +1823,9 @@ void CConnman::WakeMessageHandler()
 {
     {
         LOCK(mutexMsgProc);
-        fMsgProcWake = true;
+        m_msgproc_wake.assign(m_msgproc_wake.size(), true);
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
 }
 
 
@@ -2204,10 +2463,11 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterSocketEvents(pnode);
     }
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int worker)
 {
     while (!flagInterruptMsgProc)
     {
@@ -2220,6 +2480,12 @@ void CConnman::ThreadMessageHandler()
             }
         }
 
+        // Let each worker start at a different peer, so that they spread
+        // out over the peer list instead of contending for the same peers.
+        if (m_msghand_threads > 1 && !vNodesCopy.empty()) {
+            std::rotate(vNodesCopy.begin(), vNodesCopy.begin() + (worker * vNodesCopy.size() / m_msghand_threads), vNodesCopy.end());
+        }
+
         bool fMoreWork = false;
 
         for (CNode* pnode : vNodesCopy)
@@ -2227,17 +2493,21 @@ void CConnman::ThreadMessageHandler()
             if (pnode->fDisconnect)
                 continue;
 
+            // Skip peers another worker is currently handling.
+            if (pnode->m_msgproc_claimed.exchange(true))
+                continue;
+
             // Receive messages
             bool fMoreNodeWork = m_msgproc->ProcessMessages(pnode, flagInterruptMsgProc);
             fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
-            if (flagInterruptMsgProc)
-                return;
-            // Send messages
-            {
+            if (!flagInterruptMsgProc) {
+                // Send messages
                 LOCK(pnode->cs_sendProcessing);
                 m_msgproc->SendMessages(pnode);
             }
 
+            pnode->m_msgproc_claimed = false;
+
             if (flagInterruptMsgProc)
                 return;
         }
@@ -2250,9 +2520,9 @@ void CConnman::ThreadMessageHandler()
 
         WAIT_LOCK(mutexMsgProc, lock);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this]() EXCLUSIVE_LOCKS_REQUIRED(mutexMsgProc) { return fMsgProcWake; });
+            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this, worker]() EXCLUSIVE_LOCKS_REQUIRED(mutexMsgProc) { return m_msgproc_wake[worker]; });
         }
-        fMsgProcWake = false;
+        m_msgproc_wake[worker] = false;
     }
 }
 
@@ -2469,6 +2739,25 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         return false;
     }
 
+#ifdef USE_EPOLL
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd == -1) {
+        LogPrintf("Failed to create epoll instance (%s), falling back to poll\n", NetworkErrorString(WSAGetLastError()));
+    } else {
+        for (size_t i = 0; i < vhListenSocket.size(); ++i) {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = EPOLL_LISTEN_SOCKET_FLAG | i;
+            if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, vhListenSocket[i].socket, &event) != 0) {
+                LogPrintf("Failed to register listening socket with epoll (%s), falling back to poll\n", NetworkErrorString(WSAGetLastError()));
+                close(m_epoll_fd);
+                m_epoll_fd = -1;
+                break;
+            }
+        }
+    }
+#endif
+
     for (const auto& strDest : connOptions.vSeedNodes) {
         AddAddrFetch(strDest);
     }
@@ -2521,7 +2810,7 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     {
         LOCK(mutexMsgProc);
-        fMsgProcWake = false;
+        m_msgproc_wake.assign(m_msghand_threads, false);
     }
 
     // Send and receive from sockets, accept connections
@@ -2547,7 +2836,12 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < m_msghand_threads; ++i) {
+        const std::string thread_name = i == 0 ? "msghand" : strprintf("msghand.%d", i);
+        threadMessageHandlers.emplace_back([this, i, thread_name] {
+            TraceThread(thread_name.c_str(), std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i)));
+        });
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery([this] { DumpAddresses(); }, DUMP_PEERS_INTERVAL);
@@ -2596,8 +2890,11 @@ void CConnman::Interrupt()
 
 void CConnman::StopThreads()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (std::thread& thread : threadMessageHandlers) {
+        if (thread.joinable())
+            thread.join();
+    }
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2645,6 +2942,15 @@ void CConnman::StopNodes()
     vhListenSocket.clear();
     semOutbound.reset();
     semAddnode.reset();
+
+#ifdef USE_EPOLL
+    m_epoll_nodes.clear();
+    m_epoll_recv_pending.clear();
+    if (m_epoll_fd != -1) {
+        close(m_epoll_fd);
+        m_epoll_fd = -1;
+    }
+#endif
 }
 
 void CConnman::DeleteNode(CNode* pnode)
@@ -3000,7 +3306,7 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
 
 void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
+    size_t nMessageSize = msg.PayloadSize();
     LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.m_type), nMessageSize, pnode->GetId());
 
     // make sure we use the appropriate network transport format
@@ -3019,9 +3325,11 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.emplace_back(std::move(serializedHeader));
+        if (!msg.m_file.IsNull())
+            pnode->vSendMsg.emplace_back(std::move(msg.m_file));
+        else if (nMessageSize)
+            pnode->vSendMsg.emplace_back(std::move(msg.data));
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
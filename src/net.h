@@ -13,6 +13,7 @@
 #include <chainparams.h>
 #include <compat.h>
 #include <crypto/siphash.h>
+#include <fs.h>
 #include <hash.h>
 #include <net_permissions.h>
 #include <netaddress.h>
@@ -32,6 +33,8 @@
 #include <thread>
 #include <memory>
 #include <condition_variable>
+#include <set>
+#include <unordered_map>
 
 #ifndef WIN32
 #include <arpa/inet.h>
@@ -88,6 +91,12 @@ static const int64_t DEFAULT_PEER_CONNECT_TIMEOUT = 60;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** -msghandthreads default: number of threads processing peer messages */
+static const int DEFAULT_MSGHAND_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHAND_THREADS = 16;
+/** Maximum number of bytes of a queued file region handed to the socket at once */
+static constexpr size_t SOCKET_SEND_FILE_CHUNK_SIZE = 0x10000;
 
 typedef int64_t NodeId;
 
@@ -102,6 +111,22 @@ struct AddedNodeInfo
 class CNodeStats;
 class CClientUIInterface;
 
+/**
+ * A region of a file on disk (e.g. a block in a blk?????.dat file) that is
+ * sent as message payload without being copied into a message buffer first.
+ * The double-SHA256 of the region has to be known up front, as the message
+ * header goes out before the payload.
+ */
+struct CNetMsgFileRegion
+{
+    fs::path path;
+    uint64_t offset{0};
+    uint32_t size{0};
+    uint256 hash;
+
+    bool IsNull() const { return size == 0; }
+};
+
 struct CSerializedNetMsg
 {
     CSerializedNetMsg() = default;
@@ -113,6 +138,24 @@ struct CSerializedNetMsg
 
     std::vector<unsigned char> data;
     std::string m_type;
+    /** If set, the payload is read from this file region instead of data. */
+    CNetMsgFileRegion m_file;
+
+    size_t PayloadSize() const { return m_file.IsNull() ? data.size() : m_file.size; }
+};
+
+/** An entry of a peer's send queue: either serialized bytes or a file region. */
+struct CSendQueueEntry
+{
+    explicit CSendQueueEntry(std::vector<unsigned char>&& data_in) : data(std::move(data_in)) {}
+    explicit CSendQueueEntry(CNetMsgFileRegion&& file_in) : file(std::move(file_in)) {}
+
+    std::vector<unsigned char> data;
+    CNetMsgFileRegion file;
+    /** Opened when the first byte of the region is sent. */
+    std::shared_ptr<FILE> fp;
+
+    size_t size() const { return file.IsNull() ? data.size() : file.size; }
 };
 
 /** Different types of connections to a peer. This enum encapsulates the
@@ -212,6 +255,7 @@ public:
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
         int64_t m_peer_connect_timeout = DEFAULT_PEER_CONNECT_TIMEOUT;
+        int m_msghand_threads = DEFAULT_MSGHAND_THREADS;
         std::vector<std::string> vSeedNodes;
         std::vector<NetWhitelistPermissions> vWhitelistedRange;
         std::vector<NetWhitebindPermissions> vWhiteBinds;
@@ -239,6 +283,7 @@ public:
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
         m_peer_connect_timeout = connOptions.m_peer_connect_timeout;
+        m_msghand_threads = std::max(1, std::min(connOptions.m_msghand_threads, MAX_MSGHAND_THREADS));
         {
             LOCK(cs_totalBytesSent);
             nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
@@ -426,7 +471,7 @@ private:
     void AddAddrFetch(const std::string& strDest);
     void ProcessAddrFetch();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int worker);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void DisconnectNodes();
     void NotifyNumConnectionsChanged();
@@ -434,6 +479,13 @@ private:
     bool GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
     void SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
     void SocketHandler();
+#ifdef USE_EPOLL
+    void SocketHandlerEpoll();
+#endif
+    /** Register a newly added peer's socket with the event backend. */
+    void RegisterSocketEvents(CNode* pnode) EXCLUSIVE_LOCKS_REQUIRED(cs_vNodes);
+    /** Read once from the peer's socket and hand complete messages to the processor. Returns the recv() result. */
+    int SocketRecvData(CNode* pnode);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -506,6 +558,20 @@ private:
     std::vector<CNode*> vNodes GUARDED_BY(cs_vNodes);
     std::list<CNode*> vNodesDisconnected;
     mutable RecursiveMutex cs_vNodes;
+#ifdef USE_EPOLL
+    /** epoll instance used by the socket handler, or -1 to fall back to poll(). */
+    int m_epoll_fd{-1};
+    /** Peers registered with m_epoll_fd, used to map readiness events back to their CNode. */
+    std::unordered_map<NodeId, CNode*> m_epoll_nodes GUARDED_BY(cs_vNodes);
+    /**
+     * Peers that still have unread data in their socket, either because the last
+     * read filled our buffer or because receiving is paused. Edge-triggered
+     * notifications will not be repeated for them. Only used by the socket handler thread.
+     */
+    std::set<NodeId> m_epoll_recv_pending;
+    /** Next time (in seconds) the epoll socket handler sweeps all peers for inactivity. */
+    int64_t m_epoll_next_sweep{0};
+#endif
     std::atomic<NodeId> nLastNodeId{0};
     unsigned int nPrevNodeCount{0};
 
@@ -580,8 +646,8 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake GUARDED_BY(mutexMsgProc);
+    /** flags for waking the message processor, one per message handler thread. */
+    std::vector<bool> m_msgproc_wake GUARDED_BY(mutexMsgProc);
 
     std::condition_variable condMsgProc;
     Mutex mutexMsgProc;
@@ -591,7 +657,10 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
+
+    /** Number of threads processing peer messages concurrently */
+    int m_msghand_threads{DEFAULT_MSGHAND_THREADS};
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of m_max_outbound_full_relay
@@ -747,6 +816,27 @@ public:
     }
 };
 
+/**
+ * Recycles the payload buffers of processed messages. Each new message is
+ * received into a buffer taken from here, so relaying blocks and transaction
+ * floods doesn't allocate and grow a fresh buffer for every message.
+ */
+class CNetMessageBufferPool
+{
+public:
+    /** Give stream the pooled buffer best suited for a payload of the given size, if there is one. */
+    void Take(CDataStream& stream, size_t payload_size);
+    /** Return the buffer of a message that has been processed. */
+    void Give(CDataStream&& stream);
+
+private:
+    Mutex m_mutex;
+    std::vector<CDataStream> m_buffers GUARDED_BY(m_mutex);
+    size_t m_pooled_bytes GUARDED_BY(m_mutex){0};
+};
+
+extern CNetMessageBufferPool g_net_message_buffers;
+
 /** The TransportDeserializer takes care of holding and deserializing the
  * network receive buffer. It can deserialize the network buffer into a
  * transport protocol agnostic CNetMessage (command & payload)
@@ -852,7 +942,7 @@ public:
     size_t nSendSize{0}; // total size of all vSendMsg entries
     size_t nSendOffset{0}; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes GUARDED_BY(cs_vSend){0};
-    std::deque<std::vector<unsigned char>> vSendMsg GUARDED_BY(cs_vSend);
+    std::deque<CSendQueueEntry> vSendMsg GUARDED_BY(cs_vSend);
     RecursiveMutex cs_vSend;
     RecursiveMutex cs_hSocket;
     RecursiveMutex cs_vRecv;
@@ -904,6 +994,11 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv{false};
     std::atomic_bool fPauseSend{false};
+    /**
+     * Set while a message handler thread is processing this peer. A peer is
+     * claimed by at most one thread at a time, which keeps its messages in order.
+     */
+    std::atomic_bool m_msgproc_claimed{false};
 
     bool IsOutboundOrBlockRelayConn() const {
         switch (m_conn_type) {
@@ -986,7 +1081,9 @@ public:
     std::atomic<int> nStartingHeight{-1};
 
     // flood relay
-    std::vector<CAddress> vAddrToSend;
+    /** Protects vAddrToSend and the contents of m_addr_known, which other peers' message handlers may update */
+    Mutex cs_addr_send;
+    std::vector<CAddress> vAddrToSend GUARDED_BY(cs_addr_send);
     std::unique_ptr<CRollingBloomFilter> m_addr_known{nullptr};
     bool fGetAddr{false};
     std::chrono::microseconds m_next_addr_send GUARDED_BY(cs_sendProcessing){0};
@@ -1149,6 +1246,7 @@ public:
     void AddAddressKnown(const CAddress& _addr)
     {
         assert(m_addr_known);
+        LOCK(cs_addr_send);
         m_addr_known->insert(_addr.GetKey());
     }
 
@@ -1163,6 +1261,7 @@ public:
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
         assert(m_addr_known);
+        LOCK(cs_addr_send);
         if (_addr.IsValid() && !m_addr_known->contains(_addr.GetKey()) && addr_format_supported) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] = _addr;
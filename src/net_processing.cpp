@@ -90,8 +90,6 @@ static constexpr auto OVERLOADED_PEER_TX_DELAY = std::chrono::seconds{2};
 static constexpr std::chrono::microseconds GETDATA_TX_INTERVAL{std::chrono::seconds{60}};
 /** Limit to avoid sending big packets. Not used in processing incoming GETDATA for compatibility */
 static const unsigned int MAX_GETDATA_SZ = 1000;
-/** Number of blocks that can be requested at any given time from a single peer. */
-static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -146,6 +144,8 @@ static constexpr uint32_t MAX_GETCFILTERS_SIZE = 1000;
 static constexpr uint32_t MAX_GETCFHEADERS_SIZE = 2000;
 /** the maximum percentage of addresses from our addrman to return in response to a getaddr message. */
 static constexpr size_t MAX_PCT_ADDR_TO_SEND = 23;
+/** Maximum number of served blocks whose payload size and checksum are remembered */
+static constexpr size_t MAX_BLOCK_CHECKSUM_CACHE_SIZE = 100000;
 
 struct COrphanTx {
     // When modifying, adapt the copy of this definition in tests/DoS_tests.
@@ -229,6 +229,7 @@ namespace {
         uint256 hash;
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
+        int64_t m_time_requested;                                //!< When this block was requested (in microseconds).
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight GUARDED_BY(cs_main);
@@ -313,6 +314,10 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Moving average of the time (in microseconds) this peer takes to deliver a requested block, or 0 if unknown.
+    int64_t m_block_download_time;
+    //! When this peer last delivered a block we requested from it (in microseconds).
+    int64_t m_last_block_delivery;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -402,6 +407,8 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        m_block_download_time = 0;
+        m_last_block_delivery = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -515,11 +522,21 @@ static void PushNodeVersion(CNode& pnode, CConnman& connman, int64_t nTime)
 
 // Returns a bool indicating whether we requested this block.
 // Also used if a block was /not/ received and timed out or started with another peer
-static bool MarkBlockAsReceived(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+// If delivered_by is the peer the block was requested from, the time it took feeds
+// that peer's delivery rate estimate.
+static bool MarkBlockAsReceived(const uint256& hash, NodeId delivered_by = -1) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
         assert(state != nullptr);
+        if (delivered_by == itInFlight->second.first) {
+            // Blocks are served one after another, so measure from the later of
+            // the request and the previous delivery.
+            const int64_t now = count_microseconds(GetTime<std::chrono::microseconds>());
+            const int64_t sample = now - std::max(itInFlight->second.second->m_time_requested, state->m_last_block_delivery);
+            state->m_block_download_time = state->m_block_download_time == 0 ? sample : (state->m_block_download_time * 7 + sample) / 8;
+            state->m_last_block_delivery = now;
+        }
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
         if (state->nBlocksInFlightValidHeaders == 0 && itInFlight->second.second->fValidatedHeaders) {
             // Last validated block on the queue was received.
@@ -557,7 +574,7 @@ static bool MarkBlockAsInFlight(CTxMemPool& mempool, NodeId nodeid, const uint25
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
+            {hash, pindex, pindex != nullptr, count_microseconds(GetTime<std::chrono::microseconds>()), std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -673,7 +690,8 @@ static bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex) EXCLUSIV
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
+ *  at most count entries. Blocks in flight from a peer that has fallen behind (see
+ *  IsBlockDownloadOverdue) are added as well, so they get re-requested from this one. */
 static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     if (count == 0)
@@ -711,6 +729,7 @@ static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vec
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    const int64_t now = count_microseconds(GetTime<std::chrono::microseconds>());
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -753,9 +772,22 @@ static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vec
                 if (vBlocks.size() == count) {
                     return;
                 }
-            } else if (waitingfor == -1) {
-                // This is the first already-in-flight block.
-                waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+            } else {
+                const NodeId holder = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                if (waitingfor == -1) {
+                    // This is the first already-in-flight block.
+                    waitingfor = holder;
+                }
+                const CNodeState* holder_state = State(holder);
+                // nDownloadingSince is when the block the holder is currently working on was due to start.
+                if (holder != nodeid && !holder_state->vBlocksInFlight.empty() &&
+                    IsBlockDownloadOverdue(holder_state->m_block_download_time, now - holder_state->nDownloadingSince, state->m_block_download_time)) {
+                    // Don't let a slow peer gate the download window until it stalls out.
+                    vBlocks.push_back(pindex);
+                    if (vBlocks.size() == count) {
+                        return;
+                    }
+                }
             }
         }
     }
@@ -889,6 +921,22 @@ void PeerManager::FinalizeNode(const CNode& node, bool& fUpdateConnectionTime) {
     LogPrint(BCLog::NET, "Cleared nodestate for peer=%d\n", nodeid);
 }
 
+int GetBlocksInFlightLimit(int64_t block_download_time)
+{
+    if (block_download_time == 0) return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    const int64_t limit = BLOCK_DOWNLOAD_TARGET_QUEUE_TIME / block_download_time;
+    return std::max<int64_t>(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, limit));
+}
+
+bool IsBlockDownloadOverdue(int64_t holder_time, int64_t waiting, int64_t candidate_time)
+{
+    if (candidate_time == 0) return false;
+    const int64_t holder_timeout = holder_time == 0 ? BLOCK_DOWNLOAD_OVERDUE_UNKNOWN_RATE :
+                                   std::max(BLOCK_DOWNLOAD_OVERDUE_MIN, BLOCK_DOWNLOAD_OVERDUE_FACTOR * holder_time);
+    return waiting > holder_timeout &&
+           waiting > BLOCK_DOWNLOAD_OVERDUE_FACTOR * candidate_time;
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     {
         LOCK(cs_main);
@@ -1265,6 +1313,18 @@ void PeerManager::BlockDisconnected(const std::shared_ptr<const CBlock> &block,
     g_recent_confirmed_transactions->reset();
 }
 
+void PeerManager::TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence)
+{
+    // Transactions evicted from our mempool (conflicted, expired or trimmed)
+    // may still be in a peer's mempool and end up in a block, so keep them for
+    // compact block reconstruction. Replaced transactions were already added
+    // when their replacement was accepted.
+    if (reason != MemPoolRemovalReason::REPLACED && RecursiveDynamicUsage(*tx) < 100000) {
+        LOCK(g_cs_orphans);
+        AddToCompactExtraTransactions(tx);
+    }
+}
+
 // All of the following cache a recent block, and are protected by cs_most_recent_block
 static RecursiveMutex cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block GUARDED_BY(cs_most_recent_block);
@@ -1484,6 +1544,39 @@ static void RelayAddress(const CAddress& addr, bool fReachable, const CConnman&
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+/** Payload size and double-SHA256 of blocks served from disk, so repeat requests need not read them. */
+static std::map<uint256, std::pair<uint32_t, uint256>> g_block_checksums GUARDED_BY(cs_main);
+/** Insertion order of g_block_checksums, oldest first. */
+static std::deque<uint256> g_block_checksums_order GUARDED_BY(cs_main);
+
+/**
+ * Describe the network serialization of a block as a region of its block file,
+ * which can be sent without copying it into the peer's send queue. Only the
+ * first request for a block reads it, to compute the message checksum.
+ */
+static bool GetBlockFileRegion(CNetMsgFileRegion& region, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    const FlatFilePos pos = pindex->GetBlockPos();
+    auto it = g_block_checksums.find(pindex->GetBlockHash());
+    if (it == g_block_checksums.end()) {
+        std::vector<uint8_t> block_data;
+        if (!ReadRawBlockFromDisk(block_data, pos, message_start)) {
+            return false;
+        }
+        if (g_block_checksums_order.size() >= MAX_BLOCK_CHECKSUM_CACHE_SIZE) {
+            g_block_checksums.erase(g_block_checksums_order.front());
+            g_block_checksums_order.pop_front();
+        }
+        it = g_block_checksums.emplace(pindex->GetBlockHash(), std::make_pair(uint32_t(block_data.size()), Hash(block_data))).first;
+        g_block_checksums_order.push_back(pindex->GetBlockHash());
+    }
+    region.path = GetBlockPosFilename(pos);
+    region.offset = pos.nPos;
+    region.size = it->second.first;
+    region.hash = it->second.second;
+    return true;
+}
+
 void static ProcessGetBlockData(CNode& pfrom, const CChainParams& chainparams, const CInv& inv, CConnman& connman)
 {
     bool send = false;
@@ -1561,12 +1654,23 @@ void static ProcessGetBlockData(CNode& pfrom, const CChainParams& chainparams, c
             pblock = a_recent_block;
         } else if (inv.IsMsgWitnessBlk()) {
             // Fast-path: in this case it is possible to serve the block directly from disk,
-            // as the network format matches the format on disk
-            std::vector<uint8_t> block_data;
-            if (!ReadRawBlockFromDisk(block_data, pindex, chainparams.MessageStart())) {
-                assert(!"cannot load block from disk");
+            // as the network format matches the format on disk. The payload goes from the
+            // block file to the socket without being copied into the send queue, unless the
+            // block has not reached its block file yet or is stored compressed.
+            if (!IsRawBlockOnDisk(pindex->GetBlockPos())) {
+                std::vector<uint8_t> block_data;
+                if (!ReadRawBlockFromDisk(block_data, pindex, chainparams.MessageStart())) {
+                    assert(!"cannot load block from disk");
+                }
+                connman.PushMessage(&pfrom, msgMaker.Make(NetMsgType::BLOCK, MakeSpan(block_data)));
+            } else {
+                CSerializedNetMsg msg;
+                msg.m_type = NetMsgType::BLOCK;
+                if (!GetBlockFileRegion(msg.m_file, pindex, chainparams.MessageStart())) {
+                    assert(!"cannot load block from disk");
+                }
+                connman.PushMessage(&pfrom, std::move(msg));
             }
-            connman.PushMessage(&pfrom, msgMaker.Make(NetMsgType::BLOCK, MakeSpan(block_data)));
             // Don't set pblock as we've sent the block
         } else {
             // Send block from disk
@@ -1884,7 +1988,7 @@ void PeerManager::ProcessHeadersMessage(CNode& pfrom, const std::vector<CBlockHe
             std::vector<const CBlockIndex*> vToFetch;
             const CBlockIndex *pindexWalk = pindexLast;
             // Calculate all the blocks we'd need to switch to pindexLast, up to a limit.
-            while (pindexWalk && !::ChainActive().Contains(pindexWalk) && vToFetch.size() <= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+            while (pindexWalk && !::ChainActive().Contains(pindexWalk) && vToFetch.size() <= (size_t)GetBlocksInFlightLimit(nodestate->m_block_download_time)) {
                 if (!(pindexWalk->nStatus & BLOCK_HAVE_DATA) &&
                         !mapBlocksInFlight.count(pindexWalk->GetBlockHash()) &&
                         (!IsWitnessEnabled(pindexWalk->pprev, m_chainparams.GetConsensus()) || State(pfrom.GetId())->fHaveWitness)) {
@@ -1905,7 +2009,7 @@ void PeerManager::ProcessHeadersMessage(CNode& pfrom, const std::vector<CBlockHe
                 std::vector<CInv> vGetData;
                 // Download as much as possible, from earliest to latest.
                 for (const CBlockIndex *pindex : reverse_iterate(vToFetch)) {
-                    if (nodestate->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                    if (nodestate->nBlocksInFlight >= GetBlocksInFlightLimit(nodestate->m_block_download_time)) {
                         // Can't download any more from this peer
                         break;
                     }
@@ -2671,6 +2775,27 @@ void PeerManager::ProcessMessage(CNode& pfrom, const std::string& msg_type, CDat
             fBlocksOnly = false;
         }
 
+        // Ignore INVs that don't match wtxidrelay setting.
+        // Note that orphan parent fetching always uses MSG_TX GETDATAs regardless of the wtxidrelay setting.
+        // This is fine as no INV messages are involved in that process.
+        const bool wtxid_relay = WITH_LOCK(cs_main, return State(pfrom.GetId())->m_wtxid_relay);
+        auto ignore_inv = [wtxid_relay](const CInv& inv) {
+            return wtxid_relay ? inv.IsMsgTx() : inv.IsMsgWtx();
+        };
+
+        // Transaction inventory bookkeeping only touches per-peer state, so
+        // do it before taking cs_main.
+        for (const CInv& inv : vInv) {
+            if (!inv.IsGenTxMsg() || ignore_inv(inv)) continue;
+
+            pfrom.AddKnownTx(inv.hash);
+            if (fBlocksOnly) {
+                LogPrint(BCLog::NET, "transaction (%s) inv sent in violation of protocol, disconnecting peer=%d\n", inv.hash.ToString(), pfrom.GetId());
+                pfrom.fDisconnect = true;
+                return;
+            }
+        }
+
         LOCK(cs_main);
 
         const auto current_time = GetTime<std::chrono::microseconds>();
@@ -2681,14 +2806,7 @@ void PeerManager::ProcessMessage(CNode& pfrom, const std::string& msg_type, CDat
         for (CInv& inv : vInv) {
             if (interruptMsgProc) return;
 
-            // Ignore INVs that don't match wtxidrelay setting.
-            // Note that orphan parent fetching always uses MSG_TX GETDATAs regardless of the wtxidrelay setting.
-            // This is fine as no INV messages are involved in that process.
-            if (State(pfrom.GetId())->m_wtxid_relay) {
-                if (inv.IsMsgTx()) continue;
-            } else {
-                if (inv.IsMsgWtx()) continue;
-            }
+            if (ignore_inv(inv)) continue;
 
             if (inv.IsMsgBlk()) {
                 const bool fAlreadyHave = AlreadyHaveBlock(inv.hash);
@@ -2709,12 +2827,7 @@ void PeerManager::ProcessMessage(CNode& pfrom, const std::string& msg_type, CDat
                 const bool fAlreadyHave = AlreadyHaveTx(gtxid, m_mempool);
                 LogPrint(BCLog::NET, "got inv: %s  %s peer=%d\n", inv.ToString(), fAlreadyHave ? "have" : "new", pfrom.GetId());
 
-                pfrom.AddKnownTx(inv.hash);
-                if (fBlocksOnly) {
-                    LogPrint(BCLog::NET, "transaction (%s) inv sent in violation of protocol, disconnecting peer=%d\n", inv.hash.ToString(), pfrom.GetId());
-                    pfrom.fDisconnect = true;
-                    return;
-                } else if (!fAlreadyHave && !m_chainman.ActiveChainstate().IsInitialBlockDownload()) {
+                if (!fAlreadyHave && !m_chainman.ActiveChainstate().IsInitialBlockDownload()) {
                     AddTxAnnouncement(pfrom, gtxid, current_time);
                 }
             } else {
@@ -3259,7 +3372,7 @@ void PeerManager::ProcessMessage(CNode& pfrom, const std::string& msg_type, CDat
         // We want to be a bit conservative just to be extra careful about DoS
         // possibilities in compact block processing...
         if (pindex->nHeight <= ::ChainActive().Height() + 2) {
-            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) ||
+            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < GetBlocksInFlightLimit(nodestate->m_block_download_time)) ||
                  (fAlreadyInFlight && blockInFlightIt->second.first == pfrom.GetId())) {
                 std::list<QueuedBlock>::iterator* queuedBlockIt = nullptr;
                 if (!MarkBlockAsInFlight(m_mempool, pfrom.GetId(), pindex->GetBlockHash(), pindex, &queuedBlockIt)) {
@@ -3377,7 +3490,7 @@ void PeerManager::ProcessMessage(CNode& pfrom, const std::string& msg_type, CDat
                 // process from some other peer.  We do this after calling
                 // ProcessNewBlock so that a malleated cmpctblock announcement
                 // can't be used to interfere with block relay.
-                MarkBlockAsReceived(pblock->GetHash());
+                MarkBlockAsReceived(pblock->GetHash(), pfrom.GetId());
             }
         }
         return;
@@ -3435,7 +3548,7 @@ void PeerManager::ProcessMessage(CNode& pfrom, const std::string& msg_type, CDat
                 // though the block was successfully read, and rely on the
                 // handling in ProcessNewBlock to ensure the block index is
                 // updated, etc.
-                MarkBlockAsReceived(resp.blockhash); // it is now an empty pointer
+                MarkBlockAsReceived(resp.blockhash, pfrom.GetId()); // it is now an empty pointer
                 fBlockRead = true;
                 // mapBlockSource is used for potentially punishing peers and
                 // updating which peers send us compact blocks, so the race
@@ -3520,7 +3633,7 @@ void PeerManager::ProcessMessage(CNode& pfrom, const std::string& msg_type, CDat
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
-            forceProcessing |= MarkBlockAsReceived(hash);
+            forceProcessing |= MarkBlockAsReceived(hash, pfrom.GetId());
             // mapBlockSource is only used for punishing peers and setting
             // which peers send us compact blocks, so the race between here and
             // cs_main in ProcessNewBlock is fine.
@@ -3556,7 +3669,7 @@ void PeerManager::ProcessMessage(CNode& pfrom, const std::string& msg_type, CDat
         }
         pfrom.fSentAddr = true;
 
-        pfrom.vAddrToSend.clear();
+        WITH_LOCK(pfrom.cs_addr_send, pfrom.vAddrToSend.clear());
         std::vector<CAddress> vAddr;
         if (pfrom.HasPermission(PF_ADDR)) {
             vAddr = m_connman.GetAddresses(MAX_ADDR_TO_SEND, MAX_PCT_ADDR_TO_SEND);
@@ -3842,7 +3955,14 @@ bool PeerManager::ProcessMessages(CNode* pfrom, std::atomic<bool>& interruptMsgP
         }
     }
 
+    // Only take cs_main when there is orphan work, so that addr, ping and
+    // filter messages from this peer are handled without touching it.
+    bool has_orphan_work;
     {
+        LOCK(g_cs_orphans);
+        has_orphan_work = !peer->m_orphan_work_set.empty();
+    }
+    if (has_orphan_work) {
         LOCK2(cs_main, g_cs_orphans);
         if (!peer->m_orphan_work_set.empty()) {
             ProcessOrphanTx(peer->m_orphan_work_set);
@@ -3900,6 +4020,9 @@ bool PeerManager::ProcessMessages(CNode* pfrom, std::atomic<bool>& interruptMsgP
         LogPrint(BCLog::NET, "%s(%s, %u bytes): Unknown exception caught\n", __func__, SanitizeString(msg_type), nMessageSize);
     }
 
+    // Let the next received message reuse this payload buffer.
+    g_net_message_buffers.Give(std::move(msg.m_recv));
+
     return fMoreWork;
 }
 
@@ -4101,59 +4224,60 @@ bool PeerManager::SendMessages(CNode* pto)
         }
     }
 
-    {
-        LOCK(cs_main);
-
-        CNodeState &state = *State(pto->GetId());
+    // Address refresh broadcast
+    auto current_time = GetTime<std::chrono::microseconds>();
 
-        // Address refresh broadcast
-        auto current_time = GetTime<std::chrono::microseconds>();
+    if (pto->RelayAddrsWithConn() && !::ChainstateActive().IsInitialBlockDownload() && pto->m_next_local_addr_send < current_time) {
+        AdvertiseLocal(pto);
+        pto->m_next_local_addr_send = PoissonNextSend(current_time, AVG_LOCAL_ADDRESS_BROADCAST_INTERVAL);
+    }
 
-        if (pto->RelayAddrsWithConn() && !::ChainstateActive().IsInitialBlockDownload() && pto->m_next_local_addr_send < current_time) {
-            AdvertiseLocal(pto);
-            pto->m_next_local_addr_send = PoissonNextSend(current_time, AVG_LOCAL_ADDRESS_BROADCAST_INTERVAL);
+    //
+    // Message: addr
+    //
+    if (pto->RelayAddrsWithConn() && pto->m_next_addr_send < current_time) {
+        pto->m_next_addr_send = PoissonNextSend(current_time, AVG_ADDRESS_BROADCAST_INTERVAL);
+        std::vector<CAddress> vAddr;
+        LOCK(pto->cs_addr_send);
+        vAddr.reserve(pto->vAddrToSend.size());
+        assert(pto->m_addr_known);
+
+        const char* msg_type;
+        int make_flags;
+        if (pto->m_wants_addrv2) {
+            msg_type = NetMsgType::ADDRV2;
+            make_flags = ADDRV2_FORMAT;
+        } else {
+            msg_type = NetMsgType::ADDR;
+            make_flags = 0;
         }
 
-        //
-        // Message: addr
-        //
-        if (pto->RelayAddrsWithConn() && pto->m_next_addr_send < current_time) {
-            pto->m_next_addr_send = PoissonNextSend(current_time, AVG_ADDRESS_BROADCAST_INTERVAL);
-            std::vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            assert(pto->m_addr_known);
-
-            const char* msg_type;
-            int make_flags;
-            if (pto->m_wants_addrv2) {
-                msg_type = NetMsgType::ADDRV2;
-                make_flags = ADDRV2_FORMAT;
-            } else {
-                msg_type = NetMsgType::ADDR;
-                make_flags = 0;
-            }
-
-            for (const CAddress& addr : pto->vAddrToSend)
+        for (const CAddress& addr : pto->vAddrToSend)
+        {
+            if (!pto->m_addr_known->contains(addr.GetKey()))
             {
-                if (!pto->m_addr_known->contains(addr.GetKey()))
+                pto->m_addr_known->insert(addr.GetKey());
+                vAddr.push_back(addr);
+                // receiver rejects addr messages larger than MAX_ADDR_TO_SEND
+                if (vAddr.size() >= MAX_ADDR_TO_SEND)
                 {
-                    pto->m_addr_known->insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than MAX_ADDR_TO_SEND
-                    if (vAddr.size() >= MAX_ADDR_TO_SEND)
-                    {
-                        m_connman.PushMessage(pto, msgMaker.Make(make_flags, msg_type, vAddr));
-                        vAddr.clear();
-                    }
+                    m_connman.PushMessage(pto, msgMaker.Make(make_flags, msg_type, vAddr));
+                    vAddr.clear();
                 }
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                m_connman.PushMessage(pto, msgMaker.Make(make_flags, msg_type, vAddr));
-            // we only send the big addr message once
-            if (pto->vAddrToSend.capacity() > 40)
-                pto->vAddrToSend.shrink_to_fit();
         }
+        pto->vAddrToSend.clear();
+        if (!vAddr.empty())
+            m_connman.PushMessage(pto, msgMaker.Make(make_flags, msg_type, vAddr));
+        // we only send the big addr message once
+        if (pto->vAddrToSend.capacity() > 40)
+            pto->vAddrToSend.shrink_to_fit();
+    }
+
+    {
+        LOCK(cs_main);
+
+        CNodeState &state = *State(pto->GetId());
 
         // Start block sync
         if (pindexBestHeader == nullptr)
@@ -4544,13 +4668,15 @@ bool PeerManager::SendMessages(CNode* pto)
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && ((fFetch && !pto->m_limited_node) || !::ChainstateActive().IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        const int blocks_in_flight_limit = GetBlocksInFlightLimit(state.m_block_download_time);
+        if (!pto->fClient && ((fFetch && !pto->m_limited_node) || !::ChainstateActive().IsInitialBlockDownload()) && state.nBlocksInFlight < blocks_in_flight_limit) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            FindNextBlocksToDownload(pto->GetId(), blocks_in_flight_limit - state.nBlocksInFlight, vToDownload, staller, consensusParams);
             for (const CBlockIndex *pindex : vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(*pto);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
+                // This also takes the block off a slower peer it may have been requested from.
                 MarkBlockAsInFlight(m_mempool, pto->GetId(), pindex->GetBlockHash(), pindex);
                 LogPrint(BCLog::NET, "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                     pindex->nHeight, pto->GetId());
@@ -31,6 +31,21 @@ static const bool DEFAULT_PEERBLOOMFILTERS = false;
 static const bool DEFAULT_PEERBLOCKFILTERS = false;
 /** Threshold for marking a node to be discouraged, e.g. disconnected and added to the discouragement filter. */
 static const int DISCOURAGEMENT_THRESHOLD{100};
+/** Number of blocks that can be requested at any given time from a single peer, until its delivery rate is known. */
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds on the number of blocks in flight from a peer whose delivery rate is known. */
+static const int MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** Time (in microseconds) the blocks in flight from a peer should take to arrive at its observed delivery rate. */
+static const int64_t BLOCK_DOWNLOAD_TARGET_QUEUE_TIME = 2 * 1000000;
+/** A block is re-requested from a faster peer once the peer it was requested from has made no
+ *  progress for this many times its usual per-block delivery time... */
+static const int BLOCK_DOWNLOAD_OVERDUE_FACTOR = 4;
+/** ...and for at least this long (in microseconds). */
+static const int64_t BLOCK_DOWNLOAD_OVERDUE_MIN = 1000000;
+/** Time (in microseconds) without progress after which a block is re-requested from a peer
+ *  whose delivery rate is not known yet. */
+static const int64_t BLOCK_DOWNLOAD_OVERDUE_UNKNOWN_RATE = 10 * 1000000;
 
 class PeerManager final : public CValidationInterface, public NetEventsInterface {
 public:
@@ -42,6 +57,7 @@ public:
      */
     void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindexConnected) override;
     void BlockDisconnected(const std::shared_ptr<const CBlock> &block, const CBlockIndex* pindex) override;
+    void TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence) override;
     /**
      * Overridden from CValidationInterface.
      */
@@ -155,6 +171,15 @@ struct CNodeStateStats {
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 
+/** Number of blocks to keep in flight from a peer that recently took block_download_time
+ *  microseconds per block (0 while unknown): enough to take about BLOCK_DOWNLOAD_TARGET_QUEUE_TIME. */
+int GetBlocksInFlightLimit(int64_t block_download_time);
+
+/** Whether a peer that recently took holder_time microseconds per block (0 while unknown) and
+ *  has made no progress for waiting microseconds has fallen so far behind that asking a peer
+ *  taking candidate_time per block instead is likely faster. */
+bool IsBlockDownloadOverdue(int64_t holder_time, int64_t waiting, int64_t candidate_time);
+
 /** Relay transaction to every node */
 void RelayTransaction(const uint256& txid, const uint256& wtxid, const CConnman& connman) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
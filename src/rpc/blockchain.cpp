@@ -14,7 +14,9 @@
 #include <core_io.h>
 #include <hash.h>
 #include <index/blockfilterindex.h>
+#include <index/scriptindex.h>
 #include <kernel.h>
+#include <key_io.h>
 #include <node/coinstats.h>
 #include <node/context.h>
 #include <node/utxo_snapshot.h>
@@ -2410,6 +2412,172 @@ static RPCHelpMan getblockfilter()
     };
 }
 
+/** Default number of entries returned by getaddresshistory and getaddressutxos */
+static const int64_t DEFAULT_ADDRESS_QUERY_COUNT = 1000;
+
+/** Return the output script of an address argument, once the script index has caught up with the chain. */
+static CScript GetScriptIndexQueryScript(const UniValue& address)
+{
+    if (!g_scriptindex) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Script index is not enabled. Use -scriptindex to enable it");
+    }
+    const CTxDestination dest = DecodeDestination(address.get_str());
+    if (!IsValidDestination(dest)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
+    if (!g_scriptindex->BlockUntilSyncedToCurrentChain()) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Script index is still in the process of being built");
+    }
+    return GetScriptForDestination(dest);
+}
+
+static void ParseSkipCount(const JSONRPCRequest& request, size_t& skip, size_t& count)
+{
+    const int64_t skip_in = request.params[1].isNull() ? 0 : request.params[1].get_int64();
+    const int64_t count_in = request.params[2].isNull() ? DEFAULT_ADDRESS_QUERY_COUNT : request.params[2].get_int64();
+    if (skip_in < 0 || count_in < 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative skip or count");
+    }
+    skip = skip_in;
+    count = count_in;
+}
+
+static RPCHelpMan getaddresshistory()
+{
+    return RPCHelpMan{"getaddresshistory",
+                "\nReturns the confirmed transactions that paid to or spent from an address, oldest first.\n"
+                "Requires -scriptindex.\n",
+                {
+                    {"address", RPCArg::Type::STR, RPCArg::Optional::NO, "The address"},
+                    {"skip", RPCArg::Type::NUM, /* default */ "0", "The number of leading transactions to leave out"},
+                    {"count", RPCArg::Type::NUM, /* default */ strprintf("%d", DEFAULT_ADDRESS_QUERY_COUNT), "The maximum number of transactions to return"},
+                },
+                RPCResult{
+                    RPCResult::Type::ARR, "", "",
+                    {
+                        {RPCResult::Type::OBJ, "", "",
+                        {
+                            {RPCResult::Type::STR_HEX, "txid", "The transaction id"},
+                            {RPCResult::Type::NUM, "height", "The height of the block containing the transaction"},
+                            {RPCResult::Type::NUM, "blockpos", "The position of the transaction in its block"},
+                            {RPCResult::Type::STR_AMOUNT, "amount", "The amount the transaction paid to the address, minus the amount it spent from it"},
+                        }},
+                    }},
+                RPCExamples{
+                    HelpExampleCli("getaddresshistory", "\"" + EXAMPLE_ADDRESS[0] + "\" 0 100") +
+                    HelpExampleRpc("getaddresshistory", "\"" + EXAMPLE_ADDRESS[0] + "\", 0, 100")
+                },
+        [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
+{
+    const CScript script = GetScriptIndexQueryScript(request.params[0]);
+    size_t skip, count;
+    ParseSkipCount(request, skip, count);
+
+    std::vector<ScriptHistoryEntry> entries;
+    if (!g_scriptindex->FindHistory(script, skip, count, entries)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read script index");
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (const ScriptHistoryEntry& entry : entries) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("txid", entry.txid.GetHex());
+        obj.pushKV("height", entry.height);
+        obj.pushKV("blockpos", (int64_t)entry.tx_pos);
+        obj.pushKV("amount", ValueFromAmount(entry.delta));
+        ret.push_back(obj);
+    }
+    return ret;
+},
+    };
+}
+
+static RPCHelpMan getaddressutxos()
+{
+    return RPCHelpMan{"getaddressutxos",
+                "\nReturns the confirmed unspent outputs paying to an address, ordered by outpoint.\n"
+                "Requires -scriptindex.\n",
+                {
+                    {"address", RPCArg::Type::STR, RPCArg::Optional::NO, "The address"},
+                    {"skip", RPCArg::Type::NUM, /* default */ "0", "The number of leading outputs to leave out"},
+                    {"count", RPCArg::Type::NUM, /* default */ strprintf("%d", DEFAULT_ADDRESS_QUERY_COUNT), "The maximum number of outputs to return"},
+                },
+                RPCResult{
+                    RPCResult::Type::ARR, "", "",
+                    {
+                        {RPCResult::Type::OBJ, "", "",
+                        {
+                            {RPCResult::Type::STR_HEX, "txid", "The transaction id"},
+                            {RPCResult::Type::NUM, "vout", "The output number"},
+                            {RPCResult::Type::NUM, "height", "The height of the block containing the output"},
+                            {RPCResult::Type::STR_AMOUNT, "amount", "The value of the output"},
+                        }},
+                    }},
+                RPCExamples{
+                    HelpExampleCli("getaddressutxos", "\"" + EXAMPLE_ADDRESS[0] + "\"") +
+                    HelpExampleRpc("getaddressutxos", "\"" + EXAMPLE_ADDRESS[0] + "\"")
+                },
+        [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
+{
+    const CScript script = GetScriptIndexQueryScript(request.params[0]);
+    size_t skip, count;
+    ParseSkipCount(request, skip, count);
+
+    std::vector<ScriptUnspentEntry> entries;
+    if (!g_scriptindex->FindUnspent(script, skip, count, entries)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read script index");
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (const ScriptUnspentEntry& entry : entries) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("txid", entry.outpoint.hash.GetHex());
+        obj.pushKV("vout", (int64_t)entry.outpoint.n);
+        obj.pushKV("height", entry.height);
+        obj.pushKV("amount", ValueFromAmount(entry.value));
+        ret.push_back(obj);
+    }
+    return ret;
+},
+    };
+}
+
+static RPCHelpMan getaddressbalance()
+{
+    return RPCHelpMan{"getaddressbalance",
+                "\nReturns the total value of the confirmed unspent outputs paying to an address.\n"
+                "Requires -scriptindex.\n",
+                {
+                    {"address", RPCArg::Type::STR, RPCArg::Optional::NO, "The address"},
+                },
+                RPCResult{
+                    RPCResult::Type::OBJ, "", "",
+                    {
+                        {RPCResult::Type::STR_AMOUNT, "balance", "The total value of the unspent outputs"},
+                        {RPCResult::Type::NUM, "utxos", "The number of unspent outputs"},
+                    }},
+                RPCExamples{
+                    HelpExampleCli("getaddressbalance", "\"" + EXAMPLE_ADDRESS[0] + "\"") +
+                    HelpExampleRpc("getaddressbalance", "\"" + EXAMPLE_ADDRESS[0] + "\"")
+                },
+        [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
+{
+    const CScript script = GetScriptIndexQueryScript(request.params[0]);
+
+    CAmount balance;
+    size_t num_unspent;
+    if (!g_scriptindex->GetBalance(script, balance, num_unspent)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read script index");
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("balance", ValueFromAmount(balance));
+    ret.pushKV("utxos", (uint64_t)num_unspent);
+    return ret;
+},
+    };
+}
+
 /**
  * Serialize the UTXO set to a file for loading elsewhere.
  *
@@ -2548,6 +2716,9 @@ static const CRPCCommand commands[] =
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
     { "blockchain",         "scantxoutset",           &scantxoutset,           {"action", "scanobjects"} },
     { "blockchain",         "getblockfilter",         &getblockfilter,         {"blockhash", "filtertype"} },
+    { "blockchain",         "getaddresshistory",      &getaddresshistory,      {"address", "skip", "count"} },
+    { "blockchain",         "getaddressutxos",        &getaddressutxos,        {"address", "skip", "count"} },
+    { "blockchain",         "getaddressbalance",      &getaddressbalance,      {"address"} },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        {"blockhash"} },
@@ -85,6 +85,10 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "sendmany", 9, "verbose" },
     { "deriveaddresses", 1, "range" },
     { "scantxoutset", 1, "scanobjects" },
+    { "getaddresshistory", 1, "skip" },
+    { "getaddresshistory", 2, "count" },
+    { "getaddressutxos", 1, "skip" },
+    { "getaddressutxos", 2, "count" },
     { "addmultisigaddress", 0, "nrequired" },
     { "addmultisigaddress", 1, "keys" },
     { "createmultisig", 0, "nrequired" },
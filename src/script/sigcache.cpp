@@ -23,6 +23,7 @@ class CSignatureCache
 {
 private:
      //! Entries are SHA256(nonce || 'E' or 'S' || 31 zero bytes || signature hash || public key || signature):
+    uint256 m_nonce;
     CSHA256 m_salted_hasher_ecdsa;
     CSHA256 m_salted_hasher_schnorr;
     typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
@@ -32,15 +33,22 @@ private:
 public:
     CSignatureCache()
     {
-        uint256 nonce = GetRandHash();
+        SetNonce(GetRandHash());
+    }
+
+    void SetNonce(const uint256& nonce)
+    {
         // We want the nonce to be 64 bytes long to force the hasher to process
         // this chunk, which makes later hash computations more efficient. We
         // just write our 32-byte entropy, and then pad with 'E' for ECDSA and
         // 'S' for Schnorr (followed by 0 bytes).
         static constexpr unsigned char PADDING_ECDSA[32] = {'E'};
         static constexpr unsigned char PADDING_SCHNORR[32] = {'S'};
+        m_nonce = nonce;
+        m_salted_hasher_ecdsa = CSHA256();
         m_salted_hasher_ecdsa.Write(nonce.begin(), 32);
         m_salted_hasher_ecdsa.Write(PADDING_ECDSA, 32);
+        m_salted_hasher_schnorr = CSHA256();
         m_salted_hasher_schnorr.Write(nonce.begin(), 32);
         m_salted_hasher_schnorr.Write(PADDING_SCHNORR, 32);
     }
@@ -75,6 +83,23 @@ public:
     {
         return setValid.setup_bytes(n);
     }
+
+    void Dump(uint256& nonce, std::vector<uint256>& entries)
+    {
+        // Entries are inserted under the exclusive lock only.
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonce = m_nonce;
+        setValid.for_each([&entries](const uint256& entry) { entries.push_back(entry); });
+    }
+
+    void Load(const uint256& nonce, const std::vector<uint256>& entries)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        SetNonce(nonce);
+        for (const uint256& entry : entries) {
+            setValid.insert(entry);
+        }
+    }
 };
 
 /* In previous versions of this code, signatureCache was a local static variable
@@ -98,6 +123,16 @@ void InitSignatureCache()
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+void DumpSignatureCache(uint256& nonce, std::vector<uint256>& entries)
+{
+    signatureCache.Dump(nonce, entries);
+}
+
+void LoadSignatureCache(const uint256& nonce, const std::vector<uint256>& entries)
+{
+    signatureCache.Load(nonce, entries);
+}
+
 bool CachingTransactionSignatureChecker::VerifyECDSASignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
@@ -19,6 +19,7 @@ static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
 static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
 class CPubKey;
+class uint256;
 
 /**
  * We're hashing a nonce into the entries themselves, so we don't need extra
@@ -55,4 +56,11 @@ public:
 
 void InitSignatureCache();
 
+/** Copy the salt and the entries of the signature cache, to save them to disk. */
+void DumpSignatureCache(uint256& nonce, std::vector<uint256>& entries);
+
+/** Salt the signature cache with a saved salt and add the entries saved with it. Entries that are
+ * already in the cache become unreachable. */
+void LoadSignatureCache(const uint256& nonce, const std::vector<uint256>& entries);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -300,6 +300,49 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(ProofOfStakePrefillTest)
+{
+    CTxMemPool pool;
+    CBlock block(BuildBlockTestCase());
+
+    // Turn the block into a proof-of-stake block with a coinstake
+    CMutableTransaction coinstake(*block.vtx[1]);
+    coinstake.vout.resize(2);
+    coinstake.vout[0].SetEmpty();
+    coinstake.vout[1].nValue = 42;
+    block.vtx[1] = MakeTransactionRef(coinstake);
+    block.nVersion = CBlockHeader::VERSION_POS;
+    block.vchBlockSig.resize(72);
+    bool mutated;
+    block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
+    BOOST_CHECK(block.IsProofOfStake() && block.vtx[1]->IsCoinStake());
+
+    CBlockHeaderAndShortTxIDs shortIDs(block, true);
+    BOOST_CHECK_EQUAL(shortIDs.BlockTxCount(), 3U);
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+
+    // Neither the coinbase nor the coinstake has to be requested
+    {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
+        BOOST_CHECK( partialBlock.IsTxAvailable(0));
+        BOOST_CHECK( partialBlock.IsTxAvailable(1));
+        BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+    }
+
+    // The remaining transaction is found in the extra transactions
+    {
+        std::vector<std::pair<uint256, CTransactionRef>> extra{{block.vtx[2]->GetWitnessHash(), block.vtx[2]}};
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs2, extra) == READ_STATUS_OK);
+        BOOST_CHECK(partialBlock.IsTxAvailable(2));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = InsecureRand256();
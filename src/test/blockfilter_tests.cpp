@@ -5,11 +5,13 @@
 #include <test/data/blockfilters.json.h>
 #include <test/util/setup_common.h>
 
+#include <arith_uint256.h>
 #include <blockfilter.h>
 #include <core_io.h>
 #include <serialize.h>
 #include <streams.h>
 #include <univalue.h>
+#include <util/golombrice.h>
 #include <util/strencodings.h>
 
 #include <boost/test/unit_test.hpp>
@@ -52,6 +54,58 @@ BOOST_AUTO_TEST_CASE(gcsfilter_default_constructor)
     BOOST_CHECK_EQUAL(params.m_M, 1U);
 }
 
+BOOST_AUTO_TEST_CASE(golombrice_reader_test)
+{
+    for (uint8_t P : {0, 1, 19, 40}) {
+        std::vector<uint64_t> values;
+        for (int i = 0; i < 1000; ++i) {
+            // Include quotients longer than the 64-bit word the reader buffers.
+            const uint64_t q = i % 100 == 0 ? 200 : InsecureRandBits(3);
+            values.push_back((q << P) + (P ? InsecureRandBits(P) : 0));
+        }
+
+        std::vector<unsigned char> encoded;
+        {
+            CVectorWriter stream(SER_NETWORK, 0, encoded, 0);
+            BitStreamWriter<CVectorWriter> bitwriter(stream);
+            for (uint64_t value : values) {
+                GolombRiceEncode(bitwriter, P, value);
+            }
+            bitwriter.Flush();
+        }
+
+        VectorReader stream(SER_NETWORK, 0, encoded, 0);
+        BitStreamReader<VectorReader> bitreader(stream);
+        GolombRiceReader reader(encoded.data(), encoded.data() + encoded.size());
+        for (uint64_t value : values) {
+            BOOST_CHECK_EQUAL(GolombRiceDecode(bitreader, P), value);
+            BOOST_CHECK_EQUAL(reader.Decode(P), value);
+        }
+        BOOST_CHECK(reader.BitsLeft() < 8);
+
+        GolombRiceReader truncated(encoded.data(), encoded.data() + encoded.size() - 1);
+        BOOST_CHECK_THROW(for (size_t i = 0; i < values.size(); ++i) truncated.Decode(P), std::ios_base::failure);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_match_any_batch)
+{
+    std::vector<BlockFilter> filters;
+    std::vector<GCSFilter::Element> elements;
+    for (int i = 0; i < 50; ++i) {
+        const uint256 block_hash = ArithToUint256(arith_uint256(i + 1));
+        elements.emplace_back(32, i);
+        GCSFilter filter({block_hash.GetUint64(0), block_hash.GetUint64(1), BASIC_FILTER_P, BASIC_FILTER_M}, GCSFilter::ElementSet{elements.back()});
+        filters.emplace_back(BlockFilterType::BASIC, block_hash, filter.GetEncoded());
+    }
+
+    const GCSFilter::ElementSet query{elements[3], elements[17], elements[49]};
+    for (int num_threads : {1, 4}) {
+        BOOST_CHECK(MatchAnyBatch(filters, query, num_threads) == std::vector<size_t>({3, 17, 49}));
+    }
+    BOOST_CHECK(MatchAnyBatch(filters, {}, 4).empty());
+}
+
 BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
 {
     CScript included_scripts[5], excluded_scripts[4];
@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <compressor.h>
+#include <streams.h>
+#include <version.h>
 #include <script/standard.h>
 #include <test/util/setup_common.h>
 
@@ -134,4 +136,57 @@ BOOST_AUTO_TEST_CASE(compress_script_to_uncompressed_pubkey_id)
     BOOST_CHECK_EQUAL(out[0], 0x04 | (script[65] & 0x01)); // least significant bit (lsb) of last char of pubkey is mapped into out[0]
 }
 
+BOOST_AUTO_TEST_CASE(compress_block_roundtrip)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript p2pk = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 1234 << OP_0;
+    coinbase.vout.emplace_back(0, CScript());
+
+    CMutableTransaction coinstake;
+    coinstake.nVersion = 1;
+    coinstake.vin.resize(1);
+    coinstake.vin[0].prevout = COutPoint(InsecureRand256(), 1);
+    coinstake.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30);
+    coinstake.vin[0].scriptWitness.stack.push_back({1, 2, 3});
+    coinstake.vin[0].nSequence = CTxIn::SEQUENCE_FINAL - 1;
+    coinstake.vout.emplace_back(0, CScript());
+    coinstake.vout.emplace_back(1234 * COIN, p2pk);
+    coinstake.vout.emplace_back(5 * COIN + 1, GetScriptForDestination(PKHash(key.GetPubKey())));
+    coinstake.nLockTime = 500000;
+
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = InsecureRand256();
+    block.nTime = 1600000000;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(coinstake));
+    BOOST_CHECK(block.vtx[1]->IsCoinStake());
+    block.vchBlockSig = std::vector<unsigned char>(71, 0x42);
+    BOOST_CHECK(IsCompressibleBlock(block));
+
+    CDataStream raw(SER_DISK, PROTOCOL_VERSION);
+    raw << block;
+    CDataStream compressed(SER_DISK, PROTOCOL_VERSION);
+    compressed << Using<BlockCompression>(block);
+    BOOST_CHECK_LT(compressed.size(), raw.size());
+
+    CBlock decoded;
+    compressed >> Using<BlockCompression>(decoded);
+    BOOST_CHECK(compressed.empty());
+    CDataStream reencoded(SER_DISK, PROTOCOL_VERSION);
+    reencoded << decoded;
+    BOOST_CHECK(reencoded.str() == raw.str());
+    BOOST_CHECK(decoded.vchBlockSig == block.vchBlockSig);
+
+    // Amounts outside the money range cannot be compressed
+    coinstake.vout[2].nValue = -1;
+    block.vtx[1] = MakeTransactionRef(coinstake);
+    BOOST_CHECK(!IsCompressibleBlock(block));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
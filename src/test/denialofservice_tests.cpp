@@ -398,4 +398,47 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     BOOST_CHECK(mapOrphanTransactions.empty());
 }
 
+BOOST_AUTO_TEST_CASE(block_download_window)
+{
+    // Peers whose delivery rate is not known yet get the fixed window.
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // Otherwise the window holds about BLOCK_DOWNLOAD_TARGET_QUEUE_TIME worth of blocks...
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(BLOCK_DOWNLOAD_TARGET_QUEUE_TIME / 10), 10);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(BLOCK_DOWNLOAD_TARGET_QUEUE_TIME / 10 + 1), 9);
+
+    // ...within bounds for very fast and very slow peers.
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(1), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(BLOCK_DOWNLOAD_TARGET_QUEUE_TIME / MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(BLOCK_DOWNLOAD_TARGET_QUEUE_TIME), MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(100 * BLOCK_DOWNLOAD_TARGET_QUEUE_TIME), MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_overdue)
+{
+    const int64_t fast = 100000;
+    const int64_t slow = 2 * BLOCK_DOWNLOAD_OVERDUE_MIN;
+
+    // Blocks are never taken away for a peer whose own rate is not known yet.
+    BOOST_CHECK(!IsBlockDownloadOverdue(slow, 100 * slow, 0));
+    BOOST_CHECK(!IsBlockDownloadOverdue(0, 100 * BLOCK_DOWNLOAD_OVERDUE_UNKNOWN_RATE, 0));
+
+    // A holder with a known rate is overdue after BLOCK_DOWNLOAD_OVERDUE_FACTOR times its usual time...
+    BOOST_CHECK(!IsBlockDownloadOverdue(slow, BLOCK_DOWNLOAD_OVERDUE_FACTOR * slow, fast));
+    BOOST_CHECK(IsBlockDownloadOverdue(slow, BLOCK_DOWNLOAD_OVERDUE_FACTOR * slow + 1, fast));
+
+    // ...but never before BLOCK_DOWNLOAD_OVERDUE_MIN, however fast it usually is.
+    BOOST_CHECK(!IsBlockDownloadOverdue(fast, BLOCK_DOWNLOAD_OVERDUE_MIN, fast));
+    BOOST_CHECK(IsBlockDownloadOverdue(fast, BLOCK_DOWNLOAD_OVERDUE_MIN + 1, fast));
+
+    // A holder with no samples yet gets BLOCK_DOWNLOAD_OVERDUE_UNKNOWN_RATE.
+    BOOST_CHECK(!IsBlockDownloadOverdue(0, BLOCK_DOWNLOAD_OVERDUE_UNKNOWN_RATE, fast));
+    BOOST_CHECK(IsBlockDownloadOverdue(0, BLOCK_DOWNLOAD_OVERDUE_UNKNOWN_RATE + 1, fast));
+
+    // The candidate must be expected to deliver well within the time already waited.
+    const int64_t slower = 2 * BLOCK_DOWNLOAD_OVERDUE_UNKNOWN_RATE / BLOCK_DOWNLOAD_OVERDUE_FACTOR;
+    BOOST_CHECK(!IsBlockDownloadOverdue(0, 2 * BLOCK_DOWNLOAD_OVERDUE_UNKNOWN_RATE, slower));
+    BOOST_CHECK(IsBlockDownloadOverdue(0, 2 * BLOCK_DOWNLOAD_OVERDUE_UNKNOWN_RATE + 1, slower));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
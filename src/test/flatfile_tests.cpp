@@ -123,4 +123,107 @@ BOOST_AUTO_TEST_CASE(flatfile_flush)
     BOOST_CHECK_EQUAL(fs::file_size(seq.FileName(FlatFilePos(0, 1))), 1U);
 }
 
+BOOST_AUTO_TEST_CASE(flatfile_writer)
+{
+    const auto data_dir = GetDataDir();
+    FlatFileSeq seq(data_dir, "a", 100);
+    const fs::path path = seq.FileName(FlatFilePos(0, 0));
+
+    // Without the writer thread, writes are done right away
+    FlatFileWriter writer("test", 1000);
+    BOOST_CHECK(writer.Write(path, 2, {1, 2, 3}));
+    BOOST_CHECK_EQUAL(fs::file_size(path), 5U);
+    BOOST_CHECK(writer.Flush());
+
+    writer.Start();
+    writer.Write(path, 5, {4, 5, 6, 7});
+    std::shared_ptr<const std::vector<unsigned char>> data;
+    size_t offset;
+    // Queued data can be read back until written; afterwards it is in the file
+    if (writer.ReadPending(path, 7, data, offset)) {
+        BOOST_CHECK_EQUAL(offset, 2U);
+        BOOST_CHECK_EQUAL((*data)[offset], 6);
+    }
+    BOOST_CHECK(!writer.ReadPending(path, 9, data, offset));
+    BOOST_CHECK(!writer.ReadPending(seq.FileName(FlatFilePos(1, 0)), 5, data, offset));
+    BOOST_CHECK(writer.Flush());
+    BOOST_CHECK(!writer.ReadPending(path, 7, data, offset));
+    writer.Stop();
+
+    std::vector<unsigned char> contents(9);
+    CAutoFile file(seq.Open(FlatFilePos(0, 0), true), SER_DISK, CLIENT_VERSION);
+    file.read((char*)contents.data(), contents.size());
+    BOOST_CHECK(contents == std::vector<unsigned char>({0, 0, 1, 2, 3, 4, 5, 6, 7}));
+}
+
+BOOST_AUTO_TEST_CASE(flatfile_writer_failure)
+{
+    const auto data_dir = GetDataDir();
+    FlatFileSeq seq(data_dir, "a", 100);
+    const fs::path path = seq.FileName(FlatFilePos(0, 0));
+    // A directory cannot be opened as a file, so writes to it fail
+    const fs::path bad_path = data_dir / "a_dir";
+    fs::create_directories(bad_path);
+
+    FlatFileWriter writer("test", 1000);
+    writer.Start();
+    // The failure of a background write is only seen by later calls
+    BOOST_CHECK(writer.Write(bad_path, 0, {1, 2, 3}));
+    BOOST_CHECK(!writer.Flush());
+    // Data written after a failed write may depend on what was lost, so the failure sticks
+    BOOST_CHECK(!writer.Write(path, 0, {4, 5, 6}));
+    BOOST_CHECK(!writer.Flush());
+    writer.Stop();
+    BOOST_CHECK(!writer.Write(path, 3, {7}));
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(flatfile_map_cache)
+{
+    const auto data_dir = GetDataDir();
+    FlatFileSeq seq(data_dir, "a", 100);
+    FlatFileMapCache cache(1);
+    if (sizeof(void*) < 8) {
+        BOOST_CHECK(!cache.Map(seq.FileName(FlatFilePos(0, 0)), 1));
+        return;
+    }
+
+    // Missing files cannot be mapped
+    BOOST_CHECK(!cache.Map(seq.FileName(FlatFilePos(0, 0)), 1));
+
+    {
+        CAutoFile file(seq.Open(FlatFilePos(0, 0)), SER_DISK, CLIENT_VERSION);
+        file << uint32_t{0x01020304};
+    }
+    auto mapping = cache.Map(seq.FileName(FlatFilePos(0, 0)), 4);
+    BOOST_REQUIRE(mapping);
+    BOOST_CHECK_EQUAL(mapping->size(), 4U);
+    BOOST_CHECK_EQUAL(mapping->data()[0], 0x04);
+    BOOST_CHECK(cache.Map(seq.FileName(FlatFilePos(0, 0)), 4) == mapping);
+    BOOST_CHECK(!cache.Map(seq.FileName(FlatFilePos(0, 0)), 5));
+
+    // A file that grew is mapped again; the old mapping stays readable
+    {
+        CAutoFile file(seq.Open(FlatFilePos(0, 4)), SER_DISK, CLIENT_VERSION);
+        file << uint32_t{0x05060708};
+    }
+    auto grown = cache.Map(seq.FileName(FlatFilePos(0, 0)), 8);
+    BOOST_REQUIRE(grown);
+    BOOST_CHECK(grown != mapping);
+    BOOST_CHECK_EQUAL(grown->data()[4], 0x08);
+    BOOST_CHECK_EQUAL(mapping->data()[0], 0x04);
+
+    // Mapping another file evicts the least recently used one
+    {
+        CAutoFile file(seq.Open(FlatFilePos(1, 0)), SER_DISK, CLIENT_VERSION);
+        file << uint32_t{0};
+    }
+    BOOST_CHECK(cache.Map(seq.FileName(FlatFilePos(1, 0)), 4));
+    BOOST_CHECK(cache.Map(seq.FileName(FlatFilePos(0, 0)), 8) != grown);
+
+    cache.Forget(seq.FileName(FlatFilePos(0, 0)));
+    BOOST_CHECK_EQUAL(grown->data()[4], 0x08);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -12,6 +12,8 @@
 #include <serialize.h>
 #include <span.h>
 #include <streams.h>
+#include <sync.h>
+#include <test/util/net.h>
 #include <test/util/setup_common.h>
 #include <util/memory.h>
 #include <util/strencodings.h>
@@ -21,9 +23,13 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <chrono>
 #include <ios>
+#include <map>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 class CAddrManSerializationMock : public CAddrMan
 {
@@ -769,4 +775,220 @@ BOOST_AUTO_TEST_CASE(PoissonNextSend)
     g_mock_deterministic_tests = false;
 }
 
+BOOST_AUTO_TEST_CASE(net_message_buffer_pool)
+{
+    CNetMessageBufferPool pool;
+
+    // Nothing to hand out yet
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    pool.Take(stream, 100);
+    BOOST_CHECK_EQUAL(stream.capacity(), 0U);
+
+    CDataStream small(SER_DISK, INIT_PROTO_VERSION);
+    small.resize(1000);
+    CDataStream large(SER_DISK, INIT_PROTO_VERSION);
+    large.resize(100000);
+    const size_t small_capacity = small.capacity();
+    const size_t large_capacity = large.capacity();
+    pool.Give(std::move(small));
+    pool.Give(std::move(large));
+
+    // The smallest buffer the payload fits into is preferred, and the
+    // stream keeps its own serialization type and version.
+    pool.Take(stream, 500);
+    BOOST_CHECK_EQUAL(stream.capacity(), small_capacity);
+    BOOST_CHECK(stream.empty());
+    BOOST_CHECK_EQUAL(stream.GetType(), SER_NETWORK);
+    BOOST_CHECK_EQUAL(stream.GetVersion(), PROTOCOL_VERSION);
+
+    // Without a fitting buffer, the largest one is handed out.
+    CDataStream stream2(SER_NETWORK, PROTOCOL_VERSION);
+    pool.Take(stream2, 200000);
+    BOOST_CHECK_EQUAL(stream2.capacity(), large_capacity);
+
+    CDataStream stream3(SER_NETWORK, PROTOCOL_VERSION);
+    pool.Take(stream3, 10);
+    BOOST_CHECK_EQUAL(stream3.capacity(), 0U);
+}
+
+/**
+ * Hands out numbered messages per peer, one per ProcessMessages call, and
+ * records the order they are processed in and whether two threads ever
+ * handled the same peer at once.
+ */
+class OrderedMessageHandler : public NetEventsInterface
+{
+public:
+    Mutex m_mutex;
+    std::map<NodeId, size_t> m_queued GUARDED_BY(m_mutex);
+    std::map<NodeId, std::vector<size_t>> m_processed GUARDED_BY(m_mutex);
+    std::map<NodeId, int> m_active GUARDED_BY(m_mutex);
+    bool m_overlap GUARDED_BY(m_mutex){false};
+
+    bool ProcessMessages(CNode* pnode, std::atomic<bool>& interrupt) override
+    {
+        const NodeId id = pnode->GetId();
+        size_t message;
+        {
+            LOCK(m_mutex);
+            if (++m_active[id] > 1) m_overlap = true;
+            message = m_processed[id].size();
+            if (message == m_queued[id]) {
+                --m_active[id];
+                return false;
+            }
+        }
+        // Give another thread the chance to pick up the same peer.
+        std::this_thread::sleep_for(std::chrono::microseconds{100});
+        LOCK(m_mutex);
+        m_processed[id].push_back(message);
+        --m_active[id];
+        return m_processed[id].size() < m_queued[id];
+    }
+    bool SendMessages(CNode* pnode) override { return true; }
+    void InitializeNode(CNode* pnode) override {}
+    void FinalizeNode(const CNode& node, bool& update_connection_time) override {}
+
+    bool Done()
+    {
+        LOCK(m_mutex);
+        for (const auto& queued : m_queued) {
+            if (m_processed[queued.first].size() < queued.second) return false;
+        }
+        return true;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(message_handler_pool)
+{
+    const int num_peers = 8;
+    const size_t num_messages = 50;
+    OrderedMessageHandler handler;
+    ConnmanTestMsg connman(0x1337, 0x1337);
+    for (int i = 0; i < num_peers; ++i) {
+        connman.AddTestNode(*new CNode(i, NODE_NETWORK, 0, INVALID_SOCKET, CAddress(), 0, 0, CAddress(), std::string{}, ConnectionType::INBOUND));
+    }
+    CConnman::Options options;
+    options.m_msgproc = &handler;
+    options.m_msghand_threads = 4;
+    connman.StartMessageHandlers(options);
+
+    for (int round = 0; round < 2; ++round) {
+        {
+            LOCK(handler.m_mutex);
+            for (NodeId id = 0; id < num_peers; ++id) {
+                handler.m_queued[id] += num_messages;
+            }
+        }
+        connman.WakeMessageHandler();
+        // Peers with more work are handled again without waiting for the
+        // 100ms wake up timeout, which would take 5s for 50 messages.
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{4};
+        while (!handler.Done() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        BOOST_REQUIRE(handler.Done());
+    }
+    connman.StopMessageHandlers();
+
+    // Each peer's messages were processed once, in order, by one thread at a time.
+    LOCK(handler.m_mutex);
+    BOOST_CHECK(!handler.m_overlap);
+    for (NodeId id = 0; id < num_peers; ++id) {
+        const std::vector<size_t>& processed = handler.m_processed[id];
+        BOOST_REQUIRE_EQUAL(processed.size(), 2 * num_messages);
+        for (size_t i = 0; i < processed.size(); ++i) {
+            BOOST_CHECK_EQUAL(processed[i], i);
+        }
+    }
+    connman.ClearTestNodes();
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(push_message_file_region)
+{
+    // A file with the payload surrounded by unrelated bytes
+    const std::vector<unsigned char> payload = ParseHex("00112233445566778899aabbccddeeff");
+    const fs::path path = GetDataDir() / "region.dat";
+    {
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        file << uint64_t{0xdeadbeef};
+        file.write((const char*)payload.data(), payload.size());
+        file << uint64_t{0xdeadbeef};
+    }
+
+    int sockets[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    CConnman connman(0x1337, 0x1337);
+    CNode node(0, NODE_NETWORK, 0, sockets[0], CAddress(), 0, 0, CAddress(), std::string{}, ConnectionType::INBOUND);
+
+    CSerializedNetMsg msg;
+    msg.m_type = "block";
+    msg.m_file.path = path;
+    msg.m_file.offset = sizeof(uint64_t);
+    msg.m_file.size = payload.size();
+    msg.m_file.hash = Hash(payload);
+    connman.PushMessage(&node, std::move(msg));
+    {
+        LOCK(node.cs_vSend);
+        BOOST_CHECK(node.vSendMsg.empty());
+    }
+
+    // The header carries the precomputed size and checksum, followed by the file region
+    std::vector<unsigned char> received(CMessageHeader::HEADER_SIZE + payload.size());
+    BOOST_REQUIRE_EQUAL(recv(sockets[1], (char*)received.data(), received.size(), MSG_WAITALL), (ssize_t)received.size());
+    CMessageHeader hdr;
+    CDataStream header_stream((const char*)received.data(), (const char*)received.data() + CMessageHeader::HEADER_SIZE, SER_NETWORK, INIT_PROTO_VERSION);
+    header_stream >> hdr;
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), "block");
+    BOOST_CHECK_EQUAL(hdr.nMessageSize, payload.size());
+    BOOST_CHECK(memcmp(hdr.pchChecksum, Hash(payload).begin(), CMessageHeader::CHECKSUM_SIZE) == 0);
+    BOOST_CHECK(std::equal(payload.begin(), payload.end(), received.begin() + CMessageHeader::HEADER_SIZE));
+    close(sockets[1]);
+}
+
+BOOST_AUTO_TEST_CASE(push_message_large_file_region)
+{
+    // A region several times the size of the chunks it is sent in
+    std::vector<unsigned char> payload(4 * SOCKET_SEND_FILE_CHUNK_SIZE + 100);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = i % 251;
+    }
+    const fs::path path = GetDataDir() / "large_region.dat";
+    {
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        file.write((const char*)payload.data(), payload.size());
+    }
+
+    int sockets[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    CConnman connman(0x1337, 0x1337);
+    CNode node(0, NODE_NETWORK, 0, sockets[0], CAddress(), 0, 0, CAddress(), std::string{}, ConnectionType::INBOUND);
+
+    // Read the other end while sending, as the region does not fit the socket buffer.
+    std::vector<unsigned char> received(CMessageHeader::HEADER_SIZE + payload.size());
+    ssize_t received_size = 0;
+    std::thread reader([&] { received_size = recv(sockets[1], (char*)received.data(), received.size(), MSG_WAITALL); });
+
+    CSerializedNetMsg msg;
+    msg.m_type = "block";
+    msg.m_file.path = path;
+    msg.m_file.size = payload.size();
+    msg.m_file.hash = Hash(payload);
+    connman.PushMessage(&node, std::move(msg));
+
+    // The whole region went out in the one send attempt, instead of a chunk
+    // per writable event.
+    {
+        LOCK(node.cs_vSend);
+        BOOST_CHECK(node.vSendMsg.empty());
+    }
+    node.CloseSocketDisconnect();
+    reader.join();
+    BOOST_REQUIRE_EQUAL(received_size, (ssize_t)received.size());
+    BOOST_CHECK(std::equal(payload.begin(), payload.end(), received.begin() + CMessageHeader::HEADER_SIZE));
+    close(sockets[1]);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
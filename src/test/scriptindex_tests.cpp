@@ -0,0 +1,110 @@
+// Copyright (c) 2020 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/scriptindex.h>
+#include <script/sign.h>
+#include <script/signingprovider.h>
+#include <script/standard.h>
+#include <test/util/setup_common.h>
+#include <util/time.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(scriptindex_tests)
+
+BOOST_FIXTURE_TEST_CASE(scriptindex_initial_sync, TestChain100Setup)
+{
+    ScriptIndex scriptindex(1 << 20, true);
+
+    const CScript coinbase_script = m_coinbase_txns[0]->vout[0].scriptPubKey;
+    std::vector<ScriptHistoryEntry> history;
+    std::vector<ScriptUnspentEntry> unspent;
+
+    // Nothing should be found in the index before it is started.
+    BOOST_CHECK(scriptindex.FindUnspent(coinbase_script, 0, 1000, unspent));
+    BOOST_CHECK(unspent.empty());
+
+    scriptindex.Start();
+
+    // Allow script index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!scriptindex.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        UninterruptibleSleep(std::chrono::milliseconds{100});
+    }
+
+    // Check that the index has all outputs paying to the coinbase script.
+    size_t num_outputs = 0;
+    CAmount total = 0;
+    for (const auto& txn : m_coinbase_txns) {
+        for (const CTxOut& txout : txn->vout) {
+            if (txout.scriptPubKey == coinbase_script) {
+                ++num_outputs;
+                total += txout.nValue;
+            }
+        }
+    }
+    BOOST_CHECK(scriptindex.FindUnspent(coinbase_script, 0, 1000, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), num_outputs);
+    BOOST_CHECK(scriptindex.FindHistory(coinbase_script, 0, 1000, history));
+    BOOST_CHECK_EQUAL(history.size(), m_coinbase_txns.size());
+    BOOST_CHECK(history.front().txid == m_coinbase_txns.front()->GetHash());
+    BOOST_CHECK(history.back().txid == m_coinbase_txns.back()->GetHash());
+    CAmount balance;
+    size_t num_unspent;
+    BOOST_CHECK(scriptindex.GetBalance(coinbase_script, balance, num_unspent));
+    BOOST_CHECK_EQUAL(balance, total);
+    BOOST_CHECK_EQUAL(num_unspent, num_outputs);
+
+    // Pagination returns consecutive ranges.
+    std::vector<ScriptHistoryEntry> page;
+    BOOST_REQUIRE(history.size() >= 7);
+    BOOST_CHECK(scriptindex.FindHistory(coinbase_script, 2, 5, page));
+    BOOST_REQUIRE_EQUAL(page.size(), 5U);
+    BOOST_CHECK(page[0].txid == history[2].txid);
+    BOOST_CHECK(page[4].txid == history[6].txid);
+
+    // Check that a spend in a new block moves the output to its new script.
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript dest_script = GetScriptForDestination(PKHash(key.GetPubKey()));
+    CMutableTransaction spend;
+    spend.nVersion = CTransaction::CURRENT_VERSION;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = dest_script;
+    FillableSigningProvider keystore;
+    keystore.AddKey(coinbaseKey);
+    std::map<COutPoint, Coin> coins;
+    coins[spend.vin[0].prevout].out = m_coinbase_txns[0]->vout[0];
+    std::map<int, std::string> input_errors;
+    BOOST_CHECK(SignTransaction(spend, &keystore, coins, SIGHASH_ALL, input_errors));
+
+    const CBlock block = CreateAndProcessBlock({spend}, CScript() << OP_TRUE);
+    BOOST_REQUIRE(WITH_LOCK(cs_main, return ::ChainActive().Tip()->GetBlockHash()) == block.GetHash());
+    BOOST_CHECK(scriptindex.BlockUntilSyncedToCurrentChain());
+
+    BOOST_CHECK(scriptindex.FindUnspent(dest_script, 0, 1000, unspent));
+    BOOST_REQUIRE_EQUAL(unspent.size(), 1U);
+    BOOST_CHECK(unspent[0].outpoint == COutPoint(spend.GetHash(), 0));
+    BOOST_CHECK_EQUAL(unspent[0].value, 11 * CENT);
+    BOOST_CHECK(scriptindex.GetBalance(coinbase_script, balance, num_unspent));
+    BOOST_CHECK_EQUAL(balance, total - m_coinbase_txns[0]->vout[0].nValue);
+    BOOST_CHECK(scriptindex.FindHistory(coinbase_script, 0, 1000, history));
+    BOOST_REQUIRE_EQUAL(history.size(), m_coinbase_txns.size() + 1);
+    BOOST_CHECK(history.back().txid == spend.GetHash());
+    BOOST_CHECK_EQUAL(history.back().delta, -m_coinbase_txns[0]->vout[0].nValue);
+
+    // shutdown sequence (c.f. Shutdown() in init.cpp)
+    scriptindex.Stop();
+
+    // Let scheduler events finish running to avoid accessing any memory related to scriptindex after it is destructed
+    SyncWithValidationInterfaceQueue();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
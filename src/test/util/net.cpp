@@ -7,6 +7,32 @@
 #include <chainparams.h>
 #include <net.h>
 
+void ConnmanTestMsg::StartMessageHandlers(const Options& options)
+{
+    Init(options);
+    flagInterruptMsgProc = false;
+    {
+        LOCK(mutexMsgProc);
+        m_msgproc_wake.assign(m_msghand_threads, false);
+    }
+    for (int i = 0; i < m_msghand_threads; ++i) {
+        threadMessageHandlers.emplace_back(&CConnman::ThreadMessageHandler, this, i);
+    }
+}
+
+void ConnmanTestMsg::StopMessageHandlers()
+{
+    {
+        LOCK(mutexMsgProc);
+        flagInterruptMsgProc = true;
+    }
+    condMsgProc.notify_all();
+    for (std::thread& thread : threadMessageHandlers) {
+        thread.join();
+    }
+    threadMessageHandlers.clear();
+}
+
 void ConnmanTestMsg::NodeReceiveMsgBytes(CNode& node, const char* pch, unsigned int nBytes, bool& complete) const
 {
     assert(node.ReceiveMsgBytes(pch, nBytes, complete));
@@ -2,9 +2,15 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <chain.h>
 #include <chainparams.h>
+#include <clientversion.h>
+#include <consensus/merkle.h>
 #include <net.h>
+#include <script/sigcache.h>
+#include <script/standard.h>
 #include <signet.h>
+#include <streams.h>
 #include <validation.h>
 
 #include <test/util/setup_common.h>
@@ -58,6 +64,103 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK_EQUAL(nSum, CAmount{2099999997690000});
 }
 
+BOOST_FIXTURE_TEST_CASE(treasury_payment_range_test, TestChain100Setup)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    // Extend the chain past two treasury payments
+    const CScript coinbase_script = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    while (WITH_LOCK(cs_main, return ::ChainActive().Height()) <= params.nTreasuryPaymentsStartBlock + 2 * params.nTreasuryPaymentsCycleBlocks) {
+        CreateAndProcessBlock({}, coinbase_script);
+    }
+    LOCK(cs_main);
+    const int tip_height = ::ChainActive().Height();
+    BOOST_CHECK_GT(tip_height, params.nTreasuryPaymentsStartBlock + 2 * params.nTreasuryPaymentsCycleBlocks);
+    int payments = 0;
+    for (int height = 1; height <= tip_height + 1; ++height) {
+        // Sum the mint of the cycle block by block
+        CAmount expected = 0;
+        if ((height > params.nTreasuryPaymentsStartBlock) && (height - params.nTreasuryPaymentsStartBlock) % params.nTreasuryPaymentsCycleBlocks == 0) {
+            CAmount value = 0;
+            for (int i = std::max(height - params.nTreasuryPaymentsCycleBlocks, 0); i < height; ++i) {
+                value += ::ChainActive()[i]->nMint - ::ChainActive()[i]->nTreasuryPayment;
+            }
+            expected = value * params.nTreasuryRewardPercentage / std::max(100 - params.nTreasuryRewardPercentage, 1u);
+            BOOST_CHECK_GT(expected, 0);
+            ++payments;
+        }
+        BOOST_CHECK_EQUAL(GetTreasuryPayment(height, params), expected);
+    }
+    BOOST_CHECK_GE(payments, 2);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_persist_test)
+{
+    const uint256 nonce = InsecureRand256();
+    const uint256 entry = InsecureRand256();
+    LoadSignatureCache(nonce, {entry});
+    BOOST_CHECK(DumpSignatureCaches());
+
+    // Salt the cache differently, as a restart would, then load it from disk.
+    LoadSignatureCache(InsecureRand256(), {});
+    BOOST_CHECK(LoadSignatureCaches());
+    uint256 loaded_nonce;
+    std::vector<uint256> entries;
+    DumpSignatureCache(loaded_nonce, entries);
+    BOOST_CHECK(loaded_nonce == nonce);
+    BOOST_CHECK(std::find(entries.begin(), entries.end(), entry) != entries.end());
+
+    // A corrupted file is not loaded.
+    FILE* file = fsbridge::fopen(GetDataDir() / "sigcache.dat", "r+b");
+    BOOST_REQUIRE(file);
+    std::fseek(file, 12, SEEK_SET);
+    const int byte = std::fgetc(file);
+    std::fseek(file, 12, SEEK_SET);
+    std::fputc(byte ^ 1, file);
+    std::fclose(file);
+    BOOST_CHECK(!LoadSignatureCaches());
+}
+
+BOOST_AUTO_TEST_CASE(read_trusted_block_test)
+{
+    // A version 4 block carries an accumulator checkpoint in its header.
+    CBlock block;
+    block.nVersion = 4;
+    block.nTime = 1600000000;
+    block.nBits = 0x207fffff;
+    block.nAccumulatorCheckpoint = uint256S("0x01");
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.emplace_back(COIN, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    {
+        CAutoFile file(OpenBlockFile(FlatFilePos(99, 0)), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!file.IsNull());
+        file << Params().MessageStart() << (unsigned int)GetSerializeSize(block, CLIENT_VERSION) << block;
+    }
+
+    const uint256 hash = block.GetHash();
+    CBlockIndex index(block);
+    index.phashBlock = &hash;
+    index.nFile = 99;
+    index.nDataPos = 8;
+    index.nStatus = BLOCK_HAVE_DATA | BLOCK_VALID_SCRIPTS;
+
+    g_trust_block_index_hash = true;
+    CBlock read;
+    BOOST_CHECK(ReadBlockFromDisk(read, &index, Params().GetConsensus()));
+    BOOST_CHECK(read.nAccumulatorCheckpoint == block.nAccumulatorCheckpoint);
+    BOOST_CHECK(read.GetHash() == hash);
+
+    // Any header field that differs from the index, including the checkpoint, fails the read.
+    index.nAccumulatorCheckpoint = uint256S("0x02");
+    BOOST_CHECK(!ReadBlockFromDisk(read, &index, Params().GetConsensus()));
+    index.nAccumulatorCheckpoint = block.nAccumulatorCheckpoint;
+    index.nNonce = 1;
+    BOOST_CHECK(!ReadBlockFromDisk(read, &index, Params().GetConsensus()));
+    g_trust_block_index_hash = DEFAULT_TRUST_BLOCK_INDEX_HASH;
+}
+
 BOOST_AUTO_TEST_CASE(signet_parse_tests)
 {
     ArgsManager signet_argsman;
@@ -12,7 +12,7 @@ ByteVectorHash::ByteVectorHash()
     GetRandBytes(reinterpret_cast<unsigned char*>(&m_k1), sizeof(m_k1));
 }
 
-size_t ByteVectorHash::operator()(const std::vector<unsigned char>& input) const
+size_t ByteVectorHash::Hash(const unsigned char* data, size_t size) const
 {
-    return CSipHasher(m_k0, m_k1).Write(input.data(), input.size()).Finalize();
+    return CSipHasher(m_k0, m_k1).Write(data, size).Finalize();
 }
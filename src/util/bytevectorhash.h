@@ -5,6 +5,8 @@
 #ifndef BITCOIN_UTIL_BYTEVECTORHASH_H
 #define BITCOIN_UTIL_BYTEVECTORHASH_H
 
+#include <prevector.h>
+
 #include <stdint.h>
 #include <vector>
 
@@ -18,9 +20,13 @@ class ByteVectorHash final
 private:
     uint64_t m_k0, m_k1;
 
+    size_t Hash(const unsigned char* data, size_t size) const;
+
 public:
     ByteVectorHash();
-    size_t operator()(const std::vector<unsigned char>& input) const;
+    size_t operator()(const std::vector<unsigned char>& input) const { return Hash(input.data(), input.size()); }
+    template <unsigned int N>
+    size_t operator()(const prevector<N, unsigned char>& input) const { return Hash(input.data(), input.size()); }
 };
 
 #endif // BITCOIN_UTIL_BYTEVECTORHASH_H
@@ -5,9 +5,12 @@
 #ifndef BITCOIN_UTIL_GOLOMBRICE_H
 #define BITCOIN_UTIL_GOLOMBRICE_H
 
+#include <crypto/common.h>
 #include <streams.h>
 
+#include <algorithm>
 #include <cstdint>
+#include <ios>
 
 template <typename OStream>
 void GolombRiceEncode(BitStreamWriter<OStream>& bitwriter, uint8_t P, uint64_t x)
@@ -40,4 +43,83 @@ uint64_t GolombRiceDecode(BitStreamReader<IStream>& bitreader, uint8_t P)
     return (q << P) + r;
 }
 
+/**
+ * Decodes Golomb-Rice coded values like GolombRiceDecode, but from a byte
+ * range and a 64-bit word at a time instead of a bit at a time: unary
+ * quotients are decoded by counting the leading one bits of the buffered word.
+ */
+class GolombRiceReader
+{
+private:
+    const unsigned char* m_it;
+    const unsigned char* const m_end;
+
+    /// Buffered bits, the next one in the most significant position. Bits
+    /// beyond the m_count buffered ones are zero.
+    uint64_t m_bits{0};
+    int m_count{0};
+
+    /** Buffer more bytes from the input, as long as they fit entirely. */
+    void Refill()
+    {
+        while (m_count <= 56 && m_it != m_end) {
+            m_bits |= static_cast<uint64_t>(*m_it++) << (56 - m_count);
+            m_count += 8;
+        }
+    }
+
+    void Consume(int nbits)
+    {
+        m_bits = nbits < 64 ? m_bits << nbits : 0;
+        m_count -= nbits;
+    }
+
+    /** Read up to 32 bits. */
+    uint64_t ReadBits(int nbits)
+    {
+        if (nbits == 0) return 0;
+        if (m_count < nbits) {
+            Refill();
+            if (m_count < nbits) throw std::ios_base::failure("GolombRiceReader: end of data");
+        }
+        uint64_t data = m_bits >> (64 - nbits);
+        Consume(nbits);
+        return data;
+    }
+
+public:
+    GolombRiceReader(const unsigned char* begin, const unsigned char* end) : m_it(begin), m_end(end) {}
+
+    uint64_t Decode(uint8_t P)
+    {
+        // Read unary-encoded quotient: q 1's followed by one 0.
+        uint64_t q = 0;
+        while (true) {
+            Refill();
+            const int ones = 64 - CountBits(~m_bits);
+            if (ones < m_count) {
+                q += ones;
+                Consume(ones + 1);
+                break;
+            }
+            if (m_count == 0) throw std::ios_base::failure("GolombRiceReader: end of data");
+            // All buffered bits are ones.
+            q += m_count;
+            Consume(m_count);
+        }
+
+        uint64_t r = 0;
+        for (int nbits = P; nbits > 0;) {
+            const int n = std::min(nbits, 32);
+            r = (r << n) | ReadBits(n);
+            nbits -= n;
+        }
+
+        return (q << P) + r;
+    }
+
+    /** Number of bits not read yet, including the padding of the last byte read. */
+    uint64_t BitsLeft() const { return static_cast<uint64_t>(m_end - m_it) * 8 + m_count; }
+};
+
 #endif // BITCOIN_UTIL_GOLOMBRICE_H
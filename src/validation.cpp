@@ -9,6 +9,7 @@
 #include <chain.h>
 #include <chainparams.h>
 #include <checkqueue.h>
+#include <compressor.h>
 #include <consensus/consensus.h>
 #include <consensus/merkle.h>
 #include <consensus/tx_check.h>
@@ -143,6 +144,8 @@ bool fPruneMode = false;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool g_trust_block_index_hash = DEFAULT_TRUST_BLOCK_INDEX_HASH;
+bool g_compress_blocks = DEFAULT_COMPRESS_BLOCKS;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 
@@ -1124,43 +1127,217 @@ CTransactionRef GetTransaction(const CBlockIndex* const block_index, const CTxMe
 // CBlock and CBlockIndex
 //
 
-static bool WriteBlockToDisk(const CBlock& block, FlatFilePos& pos, const CMessageHeader::MessageStartChars& messageStart)
+/** Maximum amount of block and undo data queued for writing before validation waits for the disk */
+static const size_t MAX_PENDING_BLOCK_WRITE_BYTES = 64 * 1024 * 1024;
+/** Writes block and undo data in the background. Data is readable from the queue until written;
+ *  FlushBlockFile waits for the queue before syncing the files, so the block index is never
+ *  flushed ahead of the data it points to. */
+static FlatFileWriter g_block_file_writer{"blockwrite", MAX_PENDING_BLOCK_WRITE_BYTES};
+
+void StartBlockFileWriter()
+{
+    g_block_file_writer.Start();
+}
+
+void StopBlockFileWriter()
+{
+    g_block_file_writer.Stop();
+}
+
+void WaitForBlockWrite(const FlatFilePos& pos)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("WriteBlockToDisk: OpenBlockFile failed");
+    g_block_file_writer.WaitForWrite(GetBlockPosFilename(pos), pos.nPos);
+}
+
+/**
+ * Set in the size field of the index header of blocks stored with BlockCompression.
+ * Serialized blocks are smaller than MAX_SIZE, so the bit is otherwise unused.
+ */
+static const uint32_t BLOCK_COMPRESSED_FLAG = 0x80000000;
+
+/** Serialize block as stored in block files: with BlockCompression if compress is set and it round-trips. */
+static std::vector<unsigned char> SerializeBlockForDisk(const CBlock& block, bool compress, bool& compressed)
+{
+    std::vector<unsigned char> data;
+    compressed = false;
+    if (compress && IsCompressibleBlock(block)) {
+        CVectorWriter(SER_DISK, CLIENT_VERSION, data, 0, Using<BlockCompression>(block));
+        if (data.size() < ::GetSerializeSize(block, CLIENT_VERSION)) {
+            compressed = true;
+            return data;
+        }
+        data.clear();
+    }
+    CVectorWriter(SER_DISK, CLIENT_VERSION, data, 0, block);
+    return data;
+}
 
-    // Write index header
-    unsigned int nSize = GetSerializeSize(block, fileout.GetVersion());
-    fileout << messageStart << nSize;
+/** Deserialize a block stored in a block file, with or without BlockCompression. */
+template <typename Stream>
+static void UnserializeBlockFromDisk(Stream& s, CBlock& block, bool compressed)
+{
+    if (compressed) {
+        s >> Using<BlockCompression>(block);
+    } else {
+        s >> block;
+    }
+}
 
-    // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk: ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+static bool WriteBlockToDisk(const std::vector<unsigned char>& block_data, bool compressed, FlatFilePos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // Prepend the index header to the serialized block, and queue them to be appended to the history file
+    const uint32_t nSize = block_data.size() | (compressed ? BLOCK_COMPRESSED_FLAG : 0);
+    std::vector<unsigned char> data;
+    data.reserve(block_data.size() + 8);
+    CVectorWriter(SER_DISK, CLIENT_VERSION, data, 0, messageStart, nSize);
+    data.insert(data.end(), block_data.begin(), block_data.end());
+    if (!g_block_file_writer.Write(BlockFileSeq().FileName(pos), pos.nPos, std::move(data))) {
+        return error("%s: an earlier block or undo write failed", __func__);
+    }
+    pos.nPos += 8;
 
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::Params& consensusParams)
+/** Number of block files kept memory-mapped for reading */
+static const size_t MAX_MAPPED_BLOCK_FILES = 64;
+/** Memory mappings of the block files that blocks were recently read from */
+static FlatFileMapCache g_block_file_maps{MAX_MAPPED_BLOCK_FILES};
+
+/**
+ * Find the stored block at pos, along with the magic bytes in front of it and whether it
+ * is compressed, in the queue of pending block writes or in a memory mapping of its block
+ * file. data keeps the memory alive. Returns false if the file cannot be mapped or the
+ * stored size is implausible; callers then read the block through OpenBlockFile instead.
+ */
+static bool FindBlockData(const FlatFilePos& pos, std::shared_ptr<const void>& data, Span<const unsigned char>& block, CMessageHeader::MessageStartChars& blk_start, bool& compressed)
+{
+    if (pos.IsNull() || pos.nPos < 8) {
+        return false;
+    }
+    const fs::path path = GetBlockPosFilename(pos);
+    std::shared_ptr<const std::vector<unsigned char>> pending;
+    size_t offset;
+    Span<const unsigned char> bytes;
+    if (g_block_file_writer.ReadPending(path, pos.nPos - 8, pending, offset)) {
+        data = pending;
+        bytes = MakeSpan(*pending).subspan(offset);
+    } else {
+        std::shared_ptr<const FlatFileMapping> mapping = g_block_file_maps.Map(path, pos.nPos);
+        if (!mapping) {
+            return false;
+        }
+        data = mapping;
+        bytes = mapping->Bytes().subspan(pos.nPos - 8);
+    }
+    memcpy(blk_start, bytes.data(), CMessageHeader::MESSAGE_START_SIZE);
+    uint32_t blk_size = ReadLE32(bytes.data() + CMessageHeader::MESSAGE_START_SIZE);
+    compressed = blk_size & BLOCK_COMPRESSED_FLAG;
+    blk_size &= ~BLOCK_COMPRESSED_FLAG;
+    if (blk_size > MAX_SIZE) {
+        return false;
+    }
+    if (bytes.size() < 8 + size_t{blk_size}) {
+        if (pending) {
+            return false;
+        }
+        // The block was appended after the file was mapped
+        std::shared_ptr<const FlatFileMapping> mapping = g_block_file_maps.Map(path, size_t{pos.nPos} + blk_size);
+        if (!mapping) {
+            return false;
+        }
+        data = mapping;
+        bytes = mapping->Bytes().subspan(pos.nPos - 8);
+    }
+    block = bytes.subspan(8, blk_size);
+    return true;
+}
+
+/** Read the size and compression of the stored block at pos from its index header. */
+static bool ReadBlockIndexHeader(const FlatFilePos& pos, unsigned int& blk_size, bool& compressed)
+{
+    std::shared_ptr<const void> data;
+    Span<const unsigned char> block_data;
+    CMessageHeader::MessageStartChars blk_start;
+    if (FindBlockData(pos, data, block_data, blk_start, compressed)) {
+        blk_size = block_data.size();
+        return true;
+    }
+    if (pos.IsNull() || pos.nPos < 8) {
+        return false;
+    }
+
+    FlatFilePos hpos = pos;
+    hpos.nPos -= 8;
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        return false;
+    }
+    try {
+        filein >> blk_start >> blk_size;
+    } catch (const std::exception&) {
+        return false;
+    }
+    compressed = blk_size & BLOCK_COMPRESSED_FLAG;
+    blk_size &= ~BLOCK_COMPRESSED_FLAG;
+    return true;
+}
+
+bool IsRawBlockOnDisk(const FlatFilePos& pos)
+{
+    std::shared_ptr<const std::vector<unsigned char>> pending;
+    size_t offset;
+    if (g_block_file_writer.ReadPending(GetBlockPosFilename(pos), pos.nPos, pending, offset)) {
+        return false;
+    }
+    unsigned int blk_size;
+    bool compressed;
+    return ReadBlockIndexHeader(pos, blk_size, compressed) && !compressed;
+}
+
+/** Deserialize the block at pos, without any checks on its header. */
+static bool ReadBlockDataFromDisk(CBlock& block, const FlatFilePos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    std::shared_ptr<const void> data;
+    Span<const unsigned char> block_data;
+    CMessageHeader::MessageStartChars blk_start;
+    bool compressed;
+    if (FindBlockData(pos, data, block_data, blk_start, compressed)) {
+        try {
+            SpanReader reader(SER_DISK, CLIENT_VERSION, block_data);
+            UnserializeBlockFromDisk(reader, block, compressed);
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+        return true;
+    }
+
+    // Open history file to read, including the index header
+    FlatFilePos hpos = pos;
+    hpos.nPos -= 8;
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
     // Read block
     try {
-        filein >> block;
+        uint32_t blk_size;
+        filein >> blk_start >> blk_size;
+        UnserializeBlockFromDisk(filein, block, blk_size & BLOCK_COMPRESSED_FLAG);
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::Params& consensusParams)
+{
+    if (!ReadBlockDataFromDisk(block, pos))
+        return false;
 
     // Check the header
     const int algo = CBlockHeader::GetAlgo(block.nVersion);
@@ -1178,9 +1355,25 @@ bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::P
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
     FlatFilePos blockPos;
+    bool trust_hash;
     {
         LOCK(cs_main);
         blockPos = pindex->GetBlockPos();
+        trust_hash = g_trust_block_index_hash && pindex->IsValid(BLOCK_VALID_SCRIPTS);
+    }
+
+    if (trust_hash) {
+        // The block was fully validated when it was connected. Make sure this is the
+        // same block without recomputing its (Xevan) header hash.
+        if (!ReadBlockDataFromDisk(block, blockPos))
+            return false;
+        if (block.nVersion != pindex->nVersion || block.hashMerkleRoot != pindex->hashMerkleRoot ||
+            block.nTime != pindex->nTime || block.nBits != pindex->nBits || block.nNonce != pindex->nNonce ||
+            block.nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint ||
+            block.hashPrevBlock != (pindex->pprev ? pindex->pprev->GetBlockHash() : uint256()))
+            return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): header doesn't match index for %s at %s",
+                    pindex->ToString(), blockPos.ToString());
+        return true;
     }
 
     if (!ReadBlockFromDisk(block, blockPos, consensusParams))
@@ -1193,6 +1386,32 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start)
 {
+    std::shared_ptr<const void> data;
+    Span<const unsigned char> block_data;
+    CMessageHeader::MessageStartChars mapped_start;
+    bool compressed;
+    if (FindBlockData(pos, data, block_data, mapped_start, compressed)) {
+        if (memcmp(mapped_start, message_start, CMessageHeader::MESSAGE_START_SIZE)) {
+            return error("%s: Block magic mismatch for %s: %s versus expected %s", __func__, pos.ToString(),
+                    HexStr(mapped_start),
+                    HexStr(message_start));
+        }
+        if (!compressed) {
+            block.assign(block_data.begin(), block_data.end());
+            return true;
+        }
+        // Expand to the network serialization
+        try {
+            CBlock decoded;
+            SpanReader(SER_DISK, CLIENT_VERSION, block_data) >> Using<BlockCompression>(decoded);
+            block.clear();
+            CVectorWriter(SER_DISK, CLIENT_VERSION, block, 0, decoded);
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+        return true;
+    }
+
     FlatFilePos hpos = pos;
     hpos.nPos -= 8; // Seek back 8 bytes for meta header
     CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
@@ -1212,6 +1431,14 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, c
                     HexStr(message_start));
         }
 
+        if (blk_size & BLOCK_COMPRESSED_FLAG) {
+            CBlock decoded;
+            filein >> Using<BlockCompression>(decoded);
+            block.clear();
+            CVectorWriter(SER_DISK, CLIENT_VERSION, block, 0, decoded);
+            return true;
+        }
+
         if (blk_size > MAX_SIZE) {
             return error("%s: Block data is larger than maximum deserialization size for %s: %s versus %s", __func__, pos.ToString(),
                     blk_size, MAX_SIZE);
@@ -1303,22 +1530,14 @@ CAmount GetTreasuryPayment(int nHeight, const Consensus::Params& consensusParams
 {
     if (IsTreasuryBlock(nHeight, consensusParams)) {
         int startHeight = std::max(nHeight - consensusParams.nTreasuryPaymentsCycleBlocks, 0);
-        CAmount blockValue = 0;
-
-        for (int i = startHeight; i < nHeight; i++) {
-            const CBlockIndex* const pindex = ::ChainActive()[i];
-            if (!IsTreasuryBlock(i, consensusParams)) // make sure previous treasury rewards aren't counted
-                blockValue += pindex->nMint; // add up coins from previous nTreasuryPaymentsCycleBlocks blocks
-            else {
-                /*uint64_t nCoinAge = 0;
-                if (pindex->IsProofOfStake()) {
-                    CBlock block;
-                    ReadBlockFromDisk(block, pindex, consensusParams);
-                    GetCoinAge(*block.vtx[1], ::ChainstateActive().CoinsTip(), block.nTime, i, nCoinAge);
-                }
-                blockValue += GetBlockSubsidy(i, pindex->IsProofOfStake(), nCoinAge, consensusParams, false);*/
-                blockValue += pindex->nMint - pindex->nTreasuryPayment;
-            }
+
+        // add up coins from previous nTreasuryPaymentsCycleBlocks blocks, without previous treasury rewards
+        // (nTreasuryPayment is zero outside of treasury blocks)
+        const CBlockIndex* const pindexLast = ::ChainActive()[nHeight - 1];
+        CAmount blockValue = pindexLast->nChainMint - pindexLast->nChainTreasuryPayment;
+        if (startHeight > 0) {
+            const CBlockIndex* const pindexBefore = ::ChainActive()[startHeight - 1];
+            blockValue -= pindexBefore->nChainMint - pindexBefore->nChainTreasuryPayment;
         }
         return blockValue * consensusParams.nTreasuryRewardPercentage / std::max(100 - consensusParams.nTreasuryRewardPercentage, 1u); // 3% of block value paid to treasury
     } else {
@@ -1555,17 +1774,25 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 }
 
 
-static CuckooCache::cache<uint256, SignatureCacheHasher> g_scriptExecutionCache;
-static CSHA256 g_scriptExecutionCacheHasher;
+static CuckooCache::cache<uint256, SignatureCacheHasher> g_scriptExecutionCache GUARDED_BY(cs_main);
+static uint256 g_scriptExecutionCacheNonce GUARDED_BY(cs_main);
+static CSHA256 g_scriptExecutionCacheHasher GUARDED_BY(cs_main);
 
-void InitScriptExecutionCache() {
-    // Setup the salted hasher
-    uint256 nonce = GetRandHash();
+static void SetScriptExecutionCacheNonce(const uint256& nonce) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
     // We want the nonce to be 64 bytes long to force the hasher to process
     // this chunk, which makes later hash computations more efficient. We
     // just write our 32-byte entropy twice to fill the 64 bytes.
+    g_scriptExecutionCacheNonce = nonce;
+    g_scriptExecutionCacheHasher = CSHA256();
     g_scriptExecutionCacheHasher.Write(nonce.begin(), 32);
     g_scriptExecutionCacheHasher.Write(nonce.begin(), 32);
+}
+
+void InitScriptExecutionCache() {
+    LOCK(cs_main);
+    // Setup the salted hasher
+    SetScriptExecutionCacheNonce(GetRandHash());
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
     // setup_bytes creates the minimum possible cache (2 elements).
     size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
@@ -1680,21 +1907,11 @@ bool CheckInputScripts(const CTransaction& tx, TxValidationState &state, const C
 
 static bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Write index header
-    unsigned int nSize = GetSerializeSize(blockundo, fileout.GetVersion());
-    fileout << messageStart << nSize;
-
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    // Serialize index header and undo data, and queue them to be appended to the history file
+    unsigned int nSize = GetSerializeSize(blockundo, CLIENT_VERSION);
+    std::vector<unsigned char> data;
+    data.reserve(nSize + 40);
+    CVectorWriter fileout(SER_DISK, CLIENT_VERSION, data, 0, messageStart, nSize, blockundo);
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
@@ -1702,24 +1919,20 @@ static bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const
     hasher << blockundo;
     fileout << hasher.GetHash();
 
+    if (!g_block_file_writer.Write(UndoFileSeq().FileName(pos), pos.nPos, std::move(data))) {
+        return error("%s: an earlier block or undo write failed", __func__);
+    }
+    pos.nPos += 8;
+
     return true;
 }
 
-bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
+template <typename Stream>
+static bool UndoReadFromStream(Stream& filein, CBlockUndo& blockundo, const CBlockIndex* pindex)
 {
-    FlatFilePos pos = pindex->GetUndoPos();
-    if (pos.IsNull()) {
-        return error("%s: no undo data available", __func__);
-    }
-
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
     // Read block
     uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
+    CHashVerifier<Stream> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
     try {
         verifier << pindex->pprev->GetBlockHash();
         verifier >> blockundo;
@@ -1736,6 +1949,29 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
     return true;
 }
 
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    FlatFilePos pos = pindex->GetUndoPos();
+    if (pos.IsNull()) {
+        return error("%s: no undo data available", __func__);
+    }
+
+    // Undo data that is still queued for writing is read from the queue
+    std::shared_ptr<const std::vector<unsigned char>> pending;
+    size_t offset;
+    if (g_block_file_writer.ReadPending(UndoFileSeq().FileName(pos), pos.nPos, pending, offset)) {
+        SpanReader filein(SER_DISK, CLIENT_VERSION, MakeSpan(*pending).subspan(offset));
+        return UndoReadFromStream(filein, blockundo, pindex);
+    }
+
+    // Open history file to read
+    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenUndoFile failed", __func__);
+
+    return UndoReadFromStream(filein, blockundo, pindex);
+}
+
 /** Abort with a message */
 static bool AbortNode(const std::string& strMessage, bilingual_str user_message = bilingual_str())
 {
@@ -1856,24 +2092,39 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
-static void FlushUndoFile(int block_file, bool finalize = false)
+/** Wait for queued block and undo data to reach the files; abort if any of it could not be written. */
+static bool FlushBlockWrites()
+{
+    if (!g_block_file_writer.Flush()) {
+        return AbortNode("Failed to write block or undo data. This is likely the result of an I/O error.");
+    }
+    return true;
+}
+
+/** Returns false if queued block or undo data could not be written. */
+static bool FlushUndoFile(int block_file, bool finalize = false)
 {
+    if (!FlushBlockWrites()) return false;
     FlatFilePos undo_pos_old(block_file, vinfoBlockFile[block_file].nUndoSize);
     if (!UndoFileSeq().Flush(undo_pos_old, finalize)) {
         AbortNode("Flushing undo file to disk failed. This is likely the result of an I/O error.");
     }
+    return true;
 }
 
-static void FlushBlockFile(bool fFinalize = false, bool finalize_undo = false)
+/** Returns false if queued block or undo data could not be written. */
+static bool FlushBlockFile(bool fFinalize = false, bool finalize_undo = false)
 {
     LOCK(cs_LastBlockFile);
+    if (!FlushBlockWrites()) return false;
     FlatFilePos block_pos_old(nLastBlockFile, vinfoBlockFile[nLastBlockFile].nSize);
     if (!BlockFileSeq().Flush(block_pos_old, fFinalize)) {
         AbortNode("Flushing block file to disk failed. This is likely the result of an I/O error.");
     }
     // we do not always flush the undo file, as the chain tip may be lagging behind the incoming blocks,
     // e.g. during IBD or a sync after a node going offline
-    if (!fFinalize || finalize_undo) FlushUndoFile(nLastBlockFile, finalize_undo);
+    if (!fFinalize || finalize_undo) return FlushUndoFile(nLastBlockFile, finalize_undo);
+    return true;
 }
 
 static bool FindUndoPos(BlockValidationState &state, int nFile, FlatFilePos &pos, unsigned int nAddSize);
@@ -1893,7 +2144,8 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, BlockValidationSt
         // with the block writes (usually when a synced up node is getting newly mined blocks) -- this case is caught in
         // the FindBlockPos function
         if (_pos.nFile < nLastBlockFile && static_cast<uint32_t>(pindex->nHeight) == vinfoBlockFile[_pos.nFile].nHeightLast) {
-            FlushUndoFile(_pos.nFile, true);
+            if (!FlushUndoFile(_pos.nFile, true))
+                return state.Error("Failed to write undo data");
         }
 
         // update nUndoPos in block index
@@ -2457,6 +2709,8 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
     pindex->nMint = nActualBlockReward;
     pindex->nMoneySupply = (pindex->pprev ? pindex->pprev->nMoneySupply : 0) + pindex->nMint + nZerocoinSpent - nAmountBurned;
     pindex->nTreasuryPayment = nTreasuryPayment;
+    pindex->nChainMint = (pindex->pprev ? pindex->pprev->nChainMint : 0) + pindex->nMint;
+    pindex->nChainTreasuryPayment = (pindex->pprev ? pindex->pprev->nChainTreasuryPayment : 0) + pindex->nTreasuryPayment;
     //LogPrintf("ConnectBlock(): INFO: nValueOut: %s, nValueIn: %s, nFees: %s, nMint: %s\n", FormatMoney(nValueOut), FormatMoney(nValueIn), FormatMoney(nFees), FormatMoney(pindex->nMint));
 
     // peercoin: fees are not collected by miners as in xuez
@@ -2586,7 +2840,9 @@ bool CChainState::FlushStateToDisk(
                 LOG_TIME_MILLIS_WITH_CATEGORY("write block and undo data to disk", BCLog::BENCH);
 
                 // First make sure all block and undo data is flushed to disk.
-                FlushBlockFile();
+                if (!FlushBlockFile()) {
+                    return state.Error("Failed to write block or undo data");
+                }
             }
 
             // Then update all block file information (which may refer to block and undo files).
@@ -3534,7 +3790,9 @@ static bool FindBlockPos(FlatFilePos &pos, unsigned int nAddSize, unsigned int n
         if (!fKnown) {
             LogPrintf("Leaving block file %i: %s\n", nLastBlockFile, vinfoBlockFile[nLastBlockFile].ToString());
         }
-        FlushBlockFile(!fKnown, finalize_undo);
+        if (!FlushBlockFile(!fKnown, finalize_undo)) {
+            return false;
+        }
         nLastBlockFile = nFile;
     }
 
@@ -4071,7 +4329,20 @@ bool ChainstateManager::ProcessNewBlockHeaders(const std::vector<CBlockHeader>&
 
 /** Store block on disk. If dbp is non-nullptr, the file is known to already reside on disk */
 static FlatFilePos SaveBlockToDisk(const CBlock& block, int nHeight, const CChainParams& chainparams, const FlatFilePos* dbp) {
-    unsigned int nBlockSize = ::GetSerializeSize(block, CLIENT_VERSION);
+    std::vector<unsigned char> block_data;
+    bool compressed = false;
+    unsigned int nBlockSize;
+    if (dbp == nullptr) {
+        block_data = SerializeBlockForDisk(block, g_compress_blocks, compressed);
+        nBlockSize = block_data.size();
+    } else {
+        // The block is already on disk, possibly compressed
+        bool stored_compressed;
+        if (!ReadBlockIndexHeader(*dbp, nBlockSize, stored_compressed)) {
+            error("%s: cannot read stored block at %s", __func__, dbp->ToString());
+            return FlatFilePos();
+        }
+    }
     FlatFilePos blockPos;
     if (dbp != nullptr)
         blockPos = *dbp;
@@ -4080,7 +4351,7 @@ static FlatFilePos SaveBlockToDisk(const CBlock& block, int nHeight, const CChai
         return FlatFilePos();
     }
     if (dbp == nullptr) {
-        if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart())) {
+        if (!WriteBlockToDisk(block_data, compressed, blockPos, chainparams.MessageStart())) {
             AbortNode("Failed to write block");
             return FlatFilePos();
         }
@@ -4295,8 +4566,10 @@ void BlockManager::PruneOneBlockFile(const int fileNumber)
 
 void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
+    FlushBlockWrites();
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         FlatFilePos pos(*it, 0);
+        g_block_file_maps.Forget(BlockFileSeq().FileName(pos));
         fs::remove(BlockFileSeq().FileName(pos));
         fs::remove(UndoFileSeq().FileName(pos));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4463,6 +4736,8 @@ bool BlockManager::LoadBlockIndex(
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
+        pindex->nChainMint = (pindex->pprev ? pindex->pprev->nChainMint : 0) + pindex->nMint;
+        pindex->nChainTreasuryPayment = (pindex->pprev ? pindex->pprev->nChainTreasuryPayment : 0) + pindex->nTreasuryPayment;
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
         if (pindex->nTx > 0) {
@@ -5035,6 +5310,7 @@ void LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFi
             nRewind++; // start one byte further next time, in case of failure
             blkdat.SetLimit(); // remove former limit
             unsigned int nSize = 0;
+            bool compressed = false;
             try {
                 // locate a header
                 unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
@@ -5045,6 +5321,8 @@ void LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFi
                     continue;
                 // read size
                 blkdat >> nSize;
+                compressed = nSize & BLOCK_COMPRESSED_FLAG;
+                nSize &= ~BLOCK_COMPRESSED_FLAG;
                 if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
                     continue;
             } catch (const std::exception&) {
@@ -5059,7 +5337,13 @@ void LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFi
                 blkdat.SetLimit(nBlockPos + nSize);
                 std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
                 CBlock& block = *pblock;
-                blkdat >> block;
+                if (compressed) {
+                    std::vector<unsigned char> block_data(nSize);
+                    blkdat.read((char*)block_data.data(), nSize);
+                    SpanReader(SER_DISK, CLIENT_VERSION, block_data) >> Using<BlockCompression>(block);
+                } else {
+                    blkdat >> block;
+                }
                 nRewind = blkdat.GetPos();
 
                 uint256 hash = block.GetHash();
@@ -5545,6 +5829,109 @@ bool DumpMempool(const CTxMemPool& pool)
     return true;
 }
 
+static const uint64_t SIGCACHE_DUMP_VERSION = 1;
+
+/** Everything saved in sigcache.dat, which ends with the hash of the serialization of this. */
+struct SigCacheDump {
+    uint64_t version{SIGCACHE_DUMP_VERSION};
+    //! Validation rules may change between releases, so entries are only reused by the same one.
+    int client_version{CLIENT_VERSION};
+    uint256 sig_nonce;
+    std::vector<uint256> sig_entries;
+    uint256 script_nonce;
+    std::vector<uint256> script_entries;
+
+    SERIALIZE_METHODS(SigCacheDump, obj) { READWRITE(obj.version, obj.client_version, obj.sig_nonce, obj.sig_entries, obj.script_nonce, obj.script_entries); }
+};
+
+bool LoadSignatureCaches()
+{
+    int64_t start = GetTimeMicros();
+    FILE* filestr = fsbridge::fopen(GetDataDir() / "sigcache.dat", "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open signature cache file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    SigCacheDump dump;
+    try {
+        CHashVerifier<CAutoFile> verifier(&file);
+        verifier >> dump.version;
+        if (dump.version != SIGCACHE_DUMP_VERSION) {
+            return false;
+        }
+        verifier >> dump.client_version;
+        if (dump.client_version != CLIENT_VERSION) {
+            LogPrintf("Signature cache file was written by another version. Continuing anyway.\n");
+            return false;
+        }
+        verifier >> dump.sig_nonce >> dump.sig_entries >> dump.script_nonce >> dump.script_entries;
+        uint256 hash;
+        file >> hash;
+        if (hash != verifier.GetHash()) {
+            LogPrintf("Signature cache file is corrupt. Continuing anyway.\n");
+            return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize signature cache data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LoadSignatureCache(dump.sig_nonce, dump.sig_entries);
+    {
+        LOCK(cs_main);
+        SetScriptExecutionCacheNonce(dump.script_nonce);
+        for (const uint256& entry : dump.script_entries) {
+            g_scriptExecutionCache.insert(entry);
+        }
+    }
+    LogPrintf("Imported signature caches from disk: %u signatures, %u script executions in %gs\n",
+              dump.sig_entries.size(), dump.script_entries.size(), (GetTimeMicros() - start) * MICRO);
+    return true;
+}
+
+bool DumpSignatureCaches()
+{
+    int64_t start = GetTimeMicros();
+
+    static Mutex dump_mutex;
+    LOCK(dump_mutex);
+
+    SigCacheDump dump;
+    DumpSignatureCache(dump.sig_nonce, dump.sig_entries);
+    {
+        LOCK(cs_main);
+        dump.script_nonce = g_scriptExecutionCacheNonce;
+        g_scriptExecutionCache.for_each([&dump](const uint256& entry) { dump.script_entries.push_back(entry); });
+    }
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fsbridge::fopen(GetDataDir() / "sigcache.dat.new", "wb");
+        if (!filestr) {
+            return false;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        hasher << dump;
+        file << dump << hasher.GetHash();
+
+        if (!FileCommit(file.Get()))
+            throw std::runtime_error("FileCommit failed");
+        file.fclose();
+        RenameOver(GetDataDir() / "sigcache.dat.new", GetDataDir() / "sigcache.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped signature caches: %gs to copy, %gs to dump\n", (mid-start)*MICRO, (last-mid)*MICRO);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump signature caches: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
 //! Guess how far we are in the verification process at the given block index
 //! require cs_main if pindex has not been validated yet (because nChainTx might be unset)
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
@@ -25,6 +25,7 @@
 #include <serialize.h>
 
 #include <atomic>
+#include <chrono>
 #include <map>
 #include <memory>
 #include <set>
@@ -73,9 +74,14 @@ static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_SCRIPTINDEX = false;
 static const char* const DEFAULT_BLOCKFILTERINDEX = "0";
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -persistsigcache */
+static const bool DEFAULT_PERSIST_SIGCACHE = false;
+/** Interval at which the signature caches are saved with -persistsigcache */
+static constexpr std::chrono::minutes DUMP_SIGCACHE_INTERVAL{30};
 /** Default for using fee filter */
 static const bool DEFAULT_FEEFILTER = true;
 /** Default for -stopatheight */
@@ -84,6 +90,10 @@ static const int DEFAULT_STOPATHEIGHT = 0;
 static const unsigned int MIN_BLOCKS_TO_KEEP = 2160; // Number of blocks in the past two days
 static const signed int DEFAULT_CHECKBLOCKS = 45; // Number of blocks in the past hour
 static const unsigned int DEFAULT_CHECKLEVEL = 4;
+/** Default for -trustblockindexhash */
+static const bool DEFAULT_TRUST_BLOCK_INDEX_HASH = false;
+/** Default for -compressblocks */
+static const bool DEFAULT_COMPRESS_BLOCKS = false;
 // Require that user allocate at least 550 MiB for block & undo files (blk???.dat and rev???.dat)
 // At 1MB per block, 288 blocks = 288MB.
 // Add 15% for Undo data = 331MB
@@ -124,6 +134,10 @@ extern bool g_parallel_script_checks;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Whether blocks read from disk that are already fully validated skip re-hashing their header. */
+extern bool g_trust_block_index_hash;
+/** Whether new blocks are stored in block files in compressed form. */
+extern bool g_compress_blocks;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** If the tip is older than this (in seconds), the node is considered to be in initial block download. */
@@ -293,6 +307,15 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
+/** Start/stop the background thread that writes new blocks and undo data to disk. Without it, they are written synchronously. */
+void StartBlockFileWriter();
+void StopBlockFileWriter();
+/** Whether the block at pos is in its block file in network serialization, i.e. it is
+ *  neither queued for writing nor stored compressed, so it can be sent straight from the file. */
+bool IsRawBlockOnDisk(const FlatFilePos& pos);
+/** Wait until the block at pos, if queued for writing, is in its block file. */
+void WaitForBlockWrite(const FlatFilePos& pos);
+
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
@@ -976,6 +999,13 @@ bool DumpMempool(const CTxMemPool& pool);
 /** Load the mempool from disk. */
 bool LoadMempool(CTxMemPool& pool);
 
+/** Save the signature and script execution caches, with their salts, to disk. */
+bool DumpSignatureCaches();
+
+/** Load the signature and script execution caches from disk. Must be called after they are
+ * initialized and before they are used. */
+bool LoadSignatureCaches();
+
 // peercoin:
 bool GetCoinAge(const CTransaction& tx, const CCoinsViewCache& view, unsigned int nTimeTx, int nHeightCurrent, uint64_t& nCoinAge, const CBlockIndex* pindexFrom = nullptr); // peercoin: get transaction coin age
 bool CheckBlockSignature(const CBlock& block);
@@ -4,7 +4,6 @@
 
 #include <wallet/coinselection.h>
 
-#include <optional.h>
 #include <policy/feerate.h>
 #include <util/system.h>
 #include <util/moneystr.h>
@@ -85,6 +84,20 @@ bool SelectCoinsBnB(std::vector<OutputGroup>& utxo_pool, const CAmount& target_v
     // Sort the utxo_pool
     std::sort(utxo_pool.begin(), utxo_pool.end(), descending);
 
+    // UTXOs that exceed the target range on their own can never be part of a solution. They are
+    // dropped up front, as each of them would otherwise use up tries before the search gets to the
+    // UTXOs that can be combined, which on large pools can be all of them.
+    auto first_in_range = std::find_if(utxo_pool.begin(), utxo_pool.end(), [&](const OutputGroup& utxo) {
+        return utxo.effective_value <= actual_target + cost_of_change;
+    });
+    for (auto it = utxo_pool.begin(); it != first_in_range; ++it) {
+        curr_available_value -= it->effective_value;
+    }
+    utxo_pool.erase(utxo_pool.begin(), first_in_range);
+    if (utxo_pool.empty() || curr_available_value < actual_target) {
+        return false;
+    }
+
     CAmount curr_waste = 0;
     std::vector<bool> best_selection;
     CAmount best_waste = MAX_MONEY;
@@ -170,7 +183,7 @@ bool SelectCoinsBnB(std::vector<OutputGroup>& utxo_pool, const CAmount& target_v
     return true;
 }
 
-static void ApproximateBestSubset(const std::vector<OutputGroup>& groups, const CAmount& nTotalLower, const CAmount& nTargetValue,
+static void ApproximateBestSubset(const std::vector<const OutputGroup*>& groups, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   std::vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     std::vector<char> vfIncluded;
@@ -197,7 +210,7 @@ static void ApproximateBestSubset(const std::vector<OutputGroup>& groups, const
                 //the selection random.
                 if (nPass == 0 ? insecure_rand.randbool() : !vfIncluded[i])
                 {
-                    nTotal += groups[i].m_value;
+                    nTotal += groups[i]->m_value;
                     vfIncluded[i] = true;
                     if (nTotal >= nTargetValue)
                     {
@@ -207,7 +220,7 @@ static void ApproximateBestSubset(const std::vector<OutputGroup>& groups, const
                             nBest = nTotal;
                             vfBest = vfIncluded;
                         }
-                        nTotal -= groups[i].m_value;
+                        nTotal -= groups[i]->m_value;
                         vfIncluded[i] = false;
                     }
                 }
@@ -221,9 +234,10 @@ bool KnapsackSolver(const CAmount& nTargetValue, std::vector<OutputGroup>& group
     setCoinsRet.clear();
     nValueRet = 0;
 
-    // List of values less than target
-    Optional<OutputGroup> lowest_larger;
-    std::vector<OutputGroup> applicable_groups;
+    // List of values less than target. The groups are referred to rather than copied, as
+    // there can be as many of them as the wallet has outputs.
+    const OutputGroup* lowest_larger = nullptr;
+    std::vector<const OutputGroup*> applicable_groups;
     CAmount nTotalLower = 0;
 
     Shuffle(groups.begin(), groups.end(), FastRandomContext());
@@ -234,17 +248,17 @@ bool KnapsackSolver(const CAmount& nTargetValue, std::vector<OutputGroup>& group
             nValueRet += group.m_value;
             return true;
         } else if (group.m_value < nTargetValue + MIN_CHANGE) {
-            applicable_groups.push_back(group);
+            applicable_groups.push_back(&group);
             nTotalLower += group.m_value;
         } else if (!lowest_larger || group.m_value < lowest_larger->m_value) {
-            lowest_larger = group;
+            lowest_larger = &group;
         }
     }
 
     if (nTotalLower == nTargetValue) {
-        for (const auto& group : applicable_groups) {
-            util::insert(setCoinsRet, group.m_outputs);
-            nValueRet += group.m_value;
+        for (const OutputGroup* group : applicable_groups) {
+            util::insert(setCoinsRet, group->m_outputs);
+            nValueRet += group->m_value;
         }
         return true;
     }
@@ -257,7 +271,9 @@ bool KnapsackSolver(const CAmount& nTargetValue, std::vector<OutputGroup>& group
     }
 
     // Solve subset sum by stochastic approximation
-    std::sort(applicable_groups.begin(), applicable_groups.end(), descending);
+    std::sort(applicable_groups.begin(), applicable_groups.end(), [](const OutputGroup* a, const OutputGroup* b) {
+        return descending(*a, *b);
+    });
     std::vector<char> vfBest;
     CAmount nBest;
 
@@ -275,8 +291,8 @@ bool KnapsackSolver(const CAmount& nTargetValue, std::vector<OutputGroup>& group
     } else {
         for (unsigned int i = 0; i < applicable_groups.size(); i++) {
             if (vfBest[i]) {
-                util::insert(setCoinsRet, applicable_groups[i].m_outputs);
-                nValueRet += applicable_groups[i].m_value;
+                util::insert(setCoinsRet, applicable_groups[i]->m_outputs);
+                nValueRet += applicable_groups[i]->m_value;
             }
         }
 
@@ -284,7 +300,7 @@ bool KnapsackSolver(const CAmount& nTargetValue, std::vector<OutputGroup>& group
             LogPrint(BCLog::SELECTCOINS, "SelectCoins() best subset: "); /* Continued */
             for (unsigned int i = 0; i < applicable_groups.size(); i++) {
                 if (vfBest[i]) {
-                    LogPrint(BCLog::SELECTCOINS, "%s ", FormatMoney(applicable_groups[i].m_value)); /* Continued */
+                    LogPrint(BCLog::SELECTCOINS, "%s ", FormatMoney(applicable_groups[i]->m_value)); /* Continued */
                 }
             }
             LogPrint(BCLog::SELECTCOINS, "total %s\n", FormatMoney(nBest));
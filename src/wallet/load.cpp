@@ -132,6 +132,7 @@ void StartWallets(CScheduler& scheduler, const ArgsManager& args)
     }
     scheduler.scheduleEvery(MaybeResendWalletTxs, std::chrono::milliseconds{1000});
     scheduler.scheduleEvery(AbandonOrphanedCoinStakes, std::chrono::seconds{600});
+    scheduler.scheduleEvery(MaybeConsolidateStakeCoins, std::chrono::seconds{600});
 }
 
 void FlushWallets()
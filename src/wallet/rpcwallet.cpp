@@ -1016,6 +1016,82 @@ static RPCHelpMan getstakingstatus()
     };
 }
 
+static RPCHelpMan getconsolidationplan()
+{
+    return RPCHelpMan{"getconsolidationplan",
+                "\nReturns the transactions the wallet would make to merge its small outputs into staking outputs.\n"
+                "Outputs smaller than -stakeconsolidatesize that pay to the same address are merged until no more than\n"
+                "-stakeconsolidatecount spendable outputs are left. Outputs that reach the stake minimum age and depth soon are left alone.\n"
+                "With -stakeconsolidate, the wallet makes these transactions itself while the fee rate is at most -stakeconsolidatemaxfee.\n",
+                {},
+                RPCResult{
+                    RPCResult::Type::OBJ, "", "",
+                    {
+                        {RPCResult::Type::BOOL, "enabled", "whether the wallet makes the transactions itself"},
+                        {RPCResult::Type::NUM, "utxo_count", "the number of spendable confirmed outputs"},
+                        {RPCResult::Type::NUM, "target_count", "the number of spendable outputs to merge down to"},
+                        {RPCResult::Type::STR_AMOUNT, "target_size", "outputs smaller than this are merged, in " + CURRENCY_UNIT},
+                        {RPCResult::Type::NUM, "maturing_count", "the number of small outputs left alone as they reach the stake minimum age and depth soon"},
+                        {RPCResult::Type::STR_AMOUNT, "feerate", "the fee rate the transactions would pay, in " + CURRENCY_UNIT + "/kB"},
+                        {RPCResult::Type::STR_AMOUNT, "max_feerate", "the highest fee rate the transactions are made at, in " + CURRENCY_UNIT + "/kB"},
+                        {RPCResult::Type::BOOL, "fee_ok", "whether the fee rate is low enough for the transactions to be made"},
+                        {RPCResult::Type::ARR, "transactions", "",
+                        {
+                            {RPCResult::Type::OBJ, "", "",
+                            {
+                                {RPCResult::Type::STR, "address", /* optional */ true, "the address the merged outputs pay to"},
+                                {RPCResult::Type::STR_HEX, "scriptPubKey", "the script the merged outputs pay to"},
+                                {RPCResult::Type::NUM, "inputs", "the number of outputs merged"},
+                                {RPCResult::Type::STR_AMOUNT, "amount", "the amount merged, before fees, in " + CURRENCY_UNIT},
+                            }},
+                        }},
+                    }
+                },
+                RPCExamples{
+                    HelpExampleCli("getconsolidationplan", "")
+            + HelpExampleRpc("getconsolidationplan", "")
+                },
+        [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
+{
+    std::shared_ptr<CWallet> const wallet = GetWalletForJSONRPCRequest(request);
+    if (!wallet) return NullUniValue;
+    const CWallet* const pwallet = wallet.get();
+
+    // Make sure the results are valid at least up to the most recent block
+    // the user could have gotten from another RPC command prior to now
+    pwallet->BlockUntilSyncedToCurrentChain();
+
+    LOCK(pwallet->cs_wallet);
+
+    const StakeConsolidationPlan plan = pwallet->PlanStakeConsolidation();
+    UniValue transactions(UniValue::VARR);
+    for (const StakeConsolidation& consolidation : plan.consolidations) {
+        UniValue entry(UniValue::VOBJ);
+        CTxDestination dest;
+        if (ExtractDestination(consolidation.script, dest)) {
+            entry.pushKV("address", EncodeDestination(dest));
+        }
+        entry.pushKV("scriptPubKey", HexStr(consolidation.script));
+        entry.pushKV("inputs", (uint64_t)consolidation.inputs.size());
+        entry.pushKV("amount", ValueFromAmount(consolidation.amount));
+        transactions.push_back(entry);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("enabled", pwallet->m_stake_consolidate);
+    result.pushKV("utxo_count", (uint64_t)plan.utxo_count);
+    result.pushKV("target_count", (uint64_t)pwallet->m_stake_consolidate_count);
+    result.pushKV("target_size", ValueFromAmount(pwallet->m_stake_consolidate_size));
+    result.pushKV("maturing_count", (uint64_t)plan.maturing_count);
+    result.pushKV("feerate", ValueFromAmount(plan.feerate.GetFeePerK()));
+    result.pushKV("max_feerate", ValueFromAmount(pwallet->m_stake_consolidate_max_fee.GetFeePerK()));
+    result.pushKV("fee_ok", plan.fee_ok);
+    result.pushKV("transactions", transactions);
+    return result;
+},
+    };
+}
+
 static RPCHelpMan getunconfirmedbalance()
 {
     return RPCHelpMan{"getunconfirmedbalance",
@@ -4752,6 +4828,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "getstakingstatus",                 &getstakingstatus,              {} },
     { "wallet",             "getunconfirmedbalance",            &getunconfirmedbalance,         {} },
     { "wallet",             "getbalances",                      &getbalances,                   {} },
+    { "wallet",             "getconsolidationplan",             &getconsolidationplan,          {} },
     { "wallet",             "getwalletinfo",                    &getwalletinfo,                 {} },
     { "wallet",             "importaddress",                    &importaddress,                 {"address","label","rescan","p2sh"} },
     { "wallet",             "importdescriptors",                &importdescriptors,             {"requests"} },
@@ -215,6 +215,90 @@ isminetype LegacyScriptPubKeyMan::IsMine(const CScript& script) const
     assert(false);
 }
 
+std::vector<std::pair<CScript, isminetype>> LegacyScriptPubKeyMan::GetIsMineScripts() const
+{
+    LOCK(cs_KeyStore);
+    // Only scripts paying to a key of the wallet, P2SH scripts and witness
+    // programs of its scripts, and watch-only scripts can be mine. The result
+    // for each of them is left to IsMine.
+    std::set<CScript> candidates(setWatchOnly.begin(), setWatchOnly.end());
+    const auto add_pubkey = [&candidates](const CPubKey& pubkey) {
+        candidates.insert(GetScriptForRawPubKey(pubkey));
+        candidates.insert(GetScriptForDestination(PKHash(pubkey)));
+    };
+    for (const auto& entry : mapKeys) {
+        auto it = m_plain_pubkeys.find(entry.first);
+        add_pubkey(it != m_plain_pubkeys.end() ? it->second : entry.second.GetPubKey());
+    }
+    for (const auto& entry : mapCryptedKeys) {
+        add_pubkey(entry.second.first);
+    }
+    for (const auto& entry : mapScripts) {
+        candidates.insert(GetScriptForDestination(ScriptHash(entry.second)));
+        int witness_version;
+        std::vector<unsigned char> witness_program;
+        if (entry.second.IsWitnessProgram(witness_version, witness_program)) {
+            candidates.insert(entry.second);
+        }
+    }
+
+    return GetIsMineScripts(candidates);
+}
+
+std::vector<std::pair<CScript, isminetype>> LegacyScriptPubKeyMan::GetIsMineScripts(const std::set<CScript>& candidates) const
+{
+    std::vector<std::pair<CScript, isminetype>> scripts;
+    for (const CScript& script : candidates) {
+        const isminetype mine = IsMine(script);
+        if (mine != ISMINE_NO) scripts.emplace_back(script, mine);
+    }
+    return scripts;
+}
+
+std::set<CScript> LegacyScriptPubKeyMan::GetKeyScripts(const CPubKey& pubkey)
+{
+    const CScript witness_script = GetScriptForDestination(WitnessV0KeyHash(pubkey));
+    return {
+        GetScriptForRawPubKey(pubkey),
+        GetScriptForDestination(PKHash(pubkey)),
+        witness_script,
+        GetScriptForDestination(ScriptHash(witness_script)),
+    };
+}
+
+std::set<CScript> LegacyScriptPubKeyMan::GetRedeemScriptScripts(const CScript& redeem_script)
+{
+    std::set<CScript> scripts{GetScriptForDestination(ScriptHash(redeem_script))};
+    int witness_version;
+    std::vector<unsigned char> witness_program;
+    if (redeem_script.IsWitnessProgram(witness_version, witness_program)) {
+        scripts.insert(redeem_script);
+    }
+    return scripts;
+}
+
+void LegacyScriptPubKeyMan::AddCompositeScript(const CScript& redeem_script)
+{
+    // P2WPKH scripts, e.g. learned for a key, are mine exactly when the key is.
+    int witness_version;
+    std::vector<unsigned char> witness_program;
+    if (redeem_script.IsWitnessProgram(witness_version, witness_program) && witness_version == 0 && witness_program.size() == WITNESS_V0_KEYHASH_SIZE) return;
+    LOCK(cs_KeyStore);
+    m_composite_scripts.insert(redeem_script);
+}
+
+void LegacyScriptPubKeyMan::NotifyScriptsAdded(std::set<CScript> candidates)
+{
+    LOCK(cs_KeyStore);
+    // A key or script may complete scripts of other keys and scripts, e.g.
+    // multisig ones, so the scripts wrapping those are checked again too.
+    for (const CScript& redeem_script : m_composite_scripts) {
+        const std::set<CScript> scripts = GetRedeemScriptScripts(redeem_script);
+        candidates.insert(scripts.begin(), scripts.end());
+    }
+    m_storage.NotifyIsMineScriptsAdded(GetIsMineScripts(candidates));
+}
+
 bool LegacyScriptPubKeyMan::CheckDecryptionKey(const CKeyingMaterial& master_key, bool accept_no_keys)
 {
     {
@@ -266,6 +350,7 @@ bool LegacyScriptPubKeyMan::Encrypt(const CKeyingMaterial& master_key, WalletBat
 
     KeyMap keys_to_encrypt;
     keys_to_encrypt.swap(mapKeys); // Clear mapKeys so AddCryptedKeyInner will succeed.
+    m_plain_pubkeys.clear();
     for (const KeyMap::value_type& mKey : keys_to_encrypt)
     {
         const CKey &key = mKey.second;
@@ -697,7 +782,9 @@ void LegacyScriptPubKeyMan::UpdateTimeFirstKey(int64_t nCreateTime)
 
 bool LegacyScriptPubKeyMan::LoadKey(const CKey& key, const CPubKey &pubkey)
 {
-    return AddKeyPubKeyInner(key, pubkey);
+    if (!AddKeyPubKeyInner(key, pubkey)) return false;
+    m_storage.NotifyIsMineChanged();
+    return true;
 }
 
 bool LegacyScriptPubKeyMan::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
@@ -726,6 +813,7 @@ bool LegacyScriptPubKeyMan::AddKeyPubKeyWithDB(WalletBatch& batch, const CKey& s
         return false;
     }
     if (needsDB) encrypted_batch = nullptr;
+    NotifyScriptsAdded(GetKeyScripts(pubkey));
 
     // check if we need to remove from watch-only
     CScript script;
@@ -759,7 +847,10 @@ bool LegacyScriptPubKeyMan::LoadCScript(const CScript& redeemScript)
         return true;
     }
 
-    return FillableSigningProvider::AddCScript(redeemScript);
+    if (!FillableSigningProvider::AddCScript(redeemScript)) return false;
+    AddCompositeScript(redeemScript);
+    m_storage.NotifyIsMineChanged();
+    return true;
 }
 
 void LegacyScriptPubKeyMan::LoadKeyMetadata(const CKeyID& keyID, const CKeyMetadata& meta)
@@ -780,7 +871,9 @@ bool LegacyScriptPubKeyMan::AddKeyPubKeyInner(const CKey& key, const CPubKey &pu
 {
     LOCK(cs_KeyStore);
     if (!m_storage.HasEncryptionKeys()) {
-        return FillableSigningProvider::AddKeyPubKey(key, pubkey);
+        if (!FillableSigningProvider::AddKeyPubKey(key, pubkey)) return false;
+        m_plain_pubkeys[pubkey.GetID()] = pubkey;
+        return true;
     }
 
     if (m_storage.IsLocked()) {
@@ -806,7 +899,9 @@ bool LegacyScriptPubKeyMan::LoadCryptedKey(const CPubKey &vchPubKey, const std::
         fDecryptionThoroughlyChecked = false;
     }
 
-    return AddCryptedKeyInner(vchPubKey, vchCryptedSecret);
+    if (!AddCryptedKeyInner(vchPubKey, vchCryptedSecret)) return false;
+    m_storage.NotifyIsMineChanged();
+    return true;
 }
 
 bool LegacyScriptPubKeyMan::AddCryptedKeyInner(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
@@ -868,6 +963,7 @@ bool LegacyScriptPubKeyMan::RemoveWatchOnly(const CScript &dest)
         // Related CScripts are not removed; having superfluous scripts around is
         // harmless (see comment in ImplicitlyLearnRelatedKeyScripts).
     }
+    m_storage.NotifyIsMineChanged();
 
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
@@ -891,6 +987,7 @@ bool LegacyScriptPubKeyMan::AddWatchOnlyInMem(const CScript &dest)
         mapWatchKeys[pubKey.GetID()] = pubKey;
         ImplicitlyLearnRelatedKeyScripts(pubKey);
     }
+    m_storage.NotifyIsMineChanged();
     return true;
 }
 
@@ -1483,6 +1580,8 @@ bool LegacyScriptPubKeyMan::AddCScriptWithDB(WalletBatch& batch, const CScript&
 {
     if (!FillableSigningProvider::AddCScript(redeemScript))
         return false;
+    AddCompositeScript(redeemScript);
+    NotifyScriptsAdded(GetRedeemScriptScripts(redeemScript));
     if (batch.WriteCScript(Hash160(redeemScript), redeemScript)) {
         m_storage.UnsetBlankWalletFlag(batch);
         return true;
@@ -1510,6 +1609,7 @@ bool LegacyScriptPubKeyMan::ImportScripts(const std::set<CScript> scripts, int64
             continue;
         }
         if (!AddCScriptWithDB(batch, entry)) {
+            m_storage.NotifyIsMineChanged();
             return false;
         }
 
@@ -1520,6 +1620,8 @@ bool LegacyScriptPubKeyMan::ImportScripts(const std::set<CScript> scripts, int64
     if (timestamp > 0) {
         UpdateTimeFirstKey(timestamp);
     }
+    // Imported scripts may complete others the wallet has, e.g. wrapped ones.
+    m_storage.NotifyIsMineChanged();
 
     return true;
 }
@@ -1540,10 +1642,13 @@ bool LegacyScriptPubKeyMan::ImportPrivKeys(const std::map<CKeyID, CKey>& privkey
         mapKeyMetadata[id].nCreateTime = timestamp;
         // If the private key is not present in the wallet, insert it.
         if (!AddKeyPubKeyWithDB(batch, key, pubkey)) {
+            m_storage.NotifyIsMineChanged();
             return false;
         }
         UpdateTimeFirstKey(timestamp);
     }
+    // Imported keys may complete scripts the wallet has, e.g. multisig ones.
+    m_storage.NotifyIsMineChanged();
     return true;
 }
 
@@ -1660,6 +1765,17 @@ isminetype DescriptorScriptPubKeyMan::IsMine(const CScript& script) const
     return ISMINE_NO;
 }
 
+std::vector<std::pair<CScript, isminetype>> DescriptorScriptPubKeyMan::GetIsMineScripts() const
+{
+    LOCK(cs_desc_man);
+    std::vector<std::pair<CScript, isminetype>> scripts;
+    scripts.reserve(m_map_script_pub_keys.size());
+    for (const auto& entry : m_map_script_pub_keys) {
+        scripts.emplace_back(entry.first, ISMINE_SPENDABLE);
+    }
+    return scripts;
+}
+
 bool DescriptorScriptPubKeyMan::CheckDecryptionKey(const CKeyingMaterial& master_key, bool accept_no_keys)
 {
     LOCK(cs_desc_man);
@@ -1777,6 +1893,7 @@ bool DescriptorScriptPubKeyMan::TopUp(unsigned int size)
 
     WalletBatch batch(m_storage.GetDatabase());
     uint256 id = GetID();
+    std::vector<std::pair<CScript, isminetype>> new_scripts;
     for (int32_t i = m_max_cached_index + 1; i < new_range_end; ++i) {
         FlatSigningProvider out_keys;
         std::vector<CScript> scripts_temp;
@@ -1788,6 +1905,7 @@ bool DescriptorScriptPubKeyMan::TopUp(unsigned int size)
         // Add all of the scriptPubKeys to the scriptPubKey set
         for (const CScript& script : scripts_temp) {
             m_map_script_pub_keys[script] = i;
+            new_scripts.emplace_back(script, ISMINE_SPENDABLE);
         }
         for (const auto& pk_pair : out_keys.pubkeys) {
             const CPubKey& pubkey = pk_pair.second;
@@ -1835,6 +1953,7 @@ bool DescriptorScriptPubKeyMan::TopUp(unsigned int size)
     // By this point, the cache size should be the size of the entire range
     assert(m_wallet_descriptor.range_end - 1 == m_max_cached_index);
 
+    if (!new_scripts.empty()) m_storage.NotifyIsMineScriptsAdded(std::move(new_scripts));
     NotifyCanGetAddressesChanged();
     return true;
 }
@@ -2242,6 +2361,7 @@ void DescriptorScriptPubKeyMan::SetCache(const DescriptorCache& cache)
         }
         m_max_cached_index++;
     }
+    m_storage.NotifyIsMineChanged();
 }
 
 bool DescriptorScriptPubKeyMan::AddKey(const CKeyID& key_id, const CKey& key)
@@ -2293,3 +2413,9 @@ const std::vector<CScript> DescriptorScriptPubKeyMan::GetScriptPubKeys() const
     }
     return script_pub_keys;
 }
+
+size_t DescriptorScriptPubKeyMan::GetScriptPubKeyCount() const
+{
+    LOCK(cs_desc_man);
+    return m_map_script_pub_keys.size();
+}
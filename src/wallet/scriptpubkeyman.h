@@ -41,6 +41,10 @@ public:
     virtual const CKeyingMaterial& GetEncryptionKey() const = 0;
     virtual bool HasEncryptionKeys() const = 0;
     virtual bool IsLocked() const = 0;
+    //! Called when the scripts a ScriptPubKeyMan considers mine may have changed.
+    virtual void NotifyIsMineChanged() = 0;
+    //! Called when a ScriptPubKeyMan considers more scripts mine, e.g. new keys, and no others changed.
+    virtual void NotifyIsMineScriptsAdded(std::vector<std::pair<CScript, isminetype>> scripts) = 0;
 };
 
 //! Default for -keypool
@@ -175,6 +179,8 @@ public:
     virtual ~ScriptPubKeyMan() {};
     virtual bool GetNewDestination(const OutputType type, CTxDestination& dest, std::string& error) { return false; }
     virtual isminetype IsMine(const CScript& script) const { return ISMINE_NO; }
+    //! The scripts IsMine returns other than ISMINE_NO for, with their isminetype.
+    virtual std::vector<std::pair<CScript, isminetype>> GetIsMineScripts() const { return {}; }
 
     //! Check that the given decryption key is valid for this ScriptPubKeyMan, i.e. it decrypts all of the keys handled by it.
     virtual bool CheckDecryptionKey(const CKeyingMaterial& master_key, bool accept_no_keys = false) { return false; }
@@ -271,12 +277,26 @@ private:
     CryptedKeyMap mapCryptedKeys GUARDED_BY(cs_KeyStore);
     WatchOnlySet setWatchOnly GUARDED_BY(cs_KeyStore);
     WatchKeyMap mapWatchKeys GUARDED_BY(cs_KeyStore);
+    //! Public keys of mapKeys, so the scripts of GetIsMineScripts don't need them derived again
+    WatchKeyMap m_plain_pubkeys GUARDED_BY(cs_KeyStore);
 
     int64_t nTimeFirstKey GUARDED_BY(cs_KeyStore) = 0;
 
     bool AddKeyPubKeyInner(const CKey& key, const CPubKey &pubkey);
     bool AddCryptedKeyInner(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
 
+    //! Scripts of mapScripts, other than P2WPKH ones, which keys and scripts added later may complete
+    std::set<CScript> m_composite_scripts GUARDED_BY(cs_KeyStore);
+    void AddCompositeScript(const CScript& redeem_script);
+
+    //! Scripts that can be mine because of a key or a redeem script
+    static std::set<CScript> GetKeyScripts(const CPubKey& pubkey);
+    static std::set<CScript> GetRedeemScriptScripts(const CScript& redeem_script);
+    //! Candidate scripts that are mine, with the result of IsMine for each
+    std::vector<std::pair<CScript, isminetype>> GetIsMineScripts(const std::set<CScript>& candidates) const;
+    //! Tell the wallet which scripts became mine after a key or script was added
+    void NotifyScriptsAdded(std::set<CScript> candidates);
+
     /**
      * Private version of AddWatchOnly method which does not accept a
      * timestamp, and which will reset the wallet's nTimeFirstKey value to 1 if
@@ -354,6 +374,7 @@ public:
 
     bool GetNewDestination(const OutputType type, CTxDestination& dest, std::string& error) override;
     isminetype IsMine(const CScript& script) const override;
+    std::vector<std::pair<CScript, isminetype>> GetIsMineScripts() const override;
 
     bool CheckDecryptionKey(const CKeyingMaterial& master_key, bool accept_no_keys = false) override;
     bool Encrypt(const CKeyingMaterial& master_key, WalletBatch* batch) override;
@@ -563,6 +584,7 @@ public:
 
     bool GetNewDestination(const OutputType type, CTxDestination& dest, std::string& error) override;
     isminetype IsMine(const CScript& script) const override;
+    std::vector<std::pair<CScript, isminetype>> GetIsMineScripts() const override;
 
     bool CheckDecryptionKey(const CKeyingMaterial& master_key, bool accept_no_keys = false) override;
     bool Encrypt(const CKeyingMaterial& master_key, WalletBatch* batch) override;
@@ -619,6 +641,7 @@ public:
 
     const WalletDescriptor GetWalletDescriptor() const EXCLUSIVE_LOCKS_REQUIRED(cs_desc_man);
     const std::vector<CScript> GetScriptPubKeys() const;
+    size_t GetScriptPubKeyCount() const;
 };
 
 #endif // BITCOIN_WALLET_SCRIPTPUBKEYMAN_H
@@ -19,6 +19,9 @@ private:
     SQLiteDatabase& m_database;
 
     bool m_cursor_init = false;
+    //! Whether this batch began the transaction in progress. Batches share the
+    //! database connection, so writes of other batches are part of it too.
+    bool m_txn = false;
 
     sqlite3_stmt* m_read_stmt{nullptr};
     sqlite3_stmt* m_insert_stmt{nullptr};
@@ -261,6 +261,21 @@ BOOST_AUTO_TEST_CASE(bnb_search_test)
         BOOST_CHECK(!SelectCoinsBnB(GroupCoins(utxo_pool), 1 * CENT, 2 * CENT, selection, value_ret, not_input_fees));
     }
 
+    // Make sure that UTXOs too large to be part of any solution don't use up the tries
+    utxo_pool.clear();
+    actual_selection.clear();
+    selection.clear();
+    for (int i = 0; i < 120000; ++i) {
+        add_coin((10 + i % 100) * CENT, 0, utxo_pool);
+    }
+    add_coin(3 * CENT, 0, utxo_pool);
+    add_coin(2 * CENT, 0, utxo_pool);
+    add_coin(3 * CENT, 0, actual_selection);
+    add_coin(2 * CENT, 0, actual_selection);
+    BOOST_CHECK(SelectCoinsBnB(GroupCoins(utxo_pool), 5 * CENT, 0.5 * CENT, selection, value_ret, not_input_fees));
+    BOOST_CHECK_EQUAL(value_ret, 5 * CENT);
+    BOOST_CHECK(equal_sets(selection, actual_selection));
+
     // Make sure that effective value is working in SelectCoinsMinConf when BnB is used
     CoinSelectionParams coin_selection_params_bnb(true, 0, 0, CFeeRate(3000), 0);
     CoinSet setCoinsRet;
@@ -417,4 +417,70 @@ BOOST_AUTO_TEST_CASE(ismine_standard)
     }
 }
 
+BOOST_AUTO_TEST_CASE(ismine_index)
+{
+    CKey keys[2];
+    CPubKey pubkeys[2];
+    for (int i = 0; i < 2; i++) {
+        keys[i].MakeNewKey(true);
+        pubkeys[i] = keys[i].GetPubKey();
+    }
+
+    CKey uncompressedKey;
+    uncompressedKey.MakeNewKey(false);
+    CPubKey uncompressedPubkey = uncompressedKey.GetPubKey();
+    NodeContext node;
+    std::unique_ptr<interfaces::Chain> chain = interfaces::MakeChain(node);
+
+    CWallet keystore(chain.get(), "", CreateDummyWalletDatabase());
+    keystore.SetupLegacyScriptPubKeyMan();
+    LegacyScriptPubKeyMan* spk_man = keystore.GetLegacyScriptPubKeyMan();
+    LOCK2(keystore.cs_wallet, spk_man->cs_KeyStore);
+
+    const CScript multisig = GetScriptForMultisig(2, {pubkeys[0], pubkeys[1]});
+    const CScript p2wsh = GetScriptForDestination(WitnessV0ScriptHash(multisig));
+    const CScript p2wpkh = GetScriptForDestination(WitnessV0KeyHash(pubkeys[0]));
+    const std::vector<CScript> scripts{
+        GetScriptForRawPubKey(pubkeys[0]),
+        GetScriptForDestination(PKHash(pubkeys[0])),
+        p2wpkh,
+        GetScriptForDestination(ScriptHash(p2wpkh)),
+        GetScriptForRawPubKey(uncompressedPubkey),
+        GetScriptForDestination(PKHash(uncompressedPubkey)),
+        multisig,
+        GetScriptForDestination(ScriptHash(multisig)),
+        p2wsh,
+        GetScriptForDestination(ScriptHash(p2wsh)),
+    };
+    // The wallet answers from its index what the keystore computes.
+    const auto check_index = [&] {
+        for (const CScript& script : scripts) {
+            BOOST_CHECK_EQUAL(keystore.IsMine(script), spk_man->IsMine(script));
+        }
+    };
+
+    check_index();
+    BOOST_CHECK(spk_man->AddKey(keys[0]));
+    check_index();
+    BOOST_CHECK_EQUAL(keystore.IsMine(p2wpkh), ISMINE_SPENDABLE);
+
+    // Scripts become mine once all of their keys are known
+    BOOST_CHECK(spk_man->AddCScript(multisig));
+    BOOST_CHECK(spk_man->AddCScript(p2wsh));
+    check_index();
+    BOOST_CHECK_EQUAL(keystore.IsMine(GetScriptForDestination(ScriptHash(p2wsh))), ISMINE_NO);
+    BOOST_CHECK(spk_man->AddKey(keys[1]));
+    check_index();
+    BOOST_CHECK_EQUAL(keystore.IsMine(GetScriptForDestination(ScriptHash(p2wsh))), ISMINE_SPENDABLE);
+
+    // Watch-only scripts
+    BOOST_CHECK(spk_man->AddKey(uncompressedKey));
+    BOOST_CHECK(spk_man->AddWatchOnly(multisig, 0));
+    check_index();
+    BOOST_CHECK_EQUAL(keystore.IsMine(multisig), ISMINE_WATCH_ONLY);
+    BOOST_CHECK(spk_man->RemoveWatchOnly(multisig));
+    check_index();
+    BOOST_CHECK_EQUAL(keystore.IsMine(multisig), ISMINE_NO);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
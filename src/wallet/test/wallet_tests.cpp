@@ -5,17 +5,27 @@
 #include <wallet/wallet.h>
 
 #include <future>
+#include <limits>
 #include <memory>
 #include <stdint.h>
+#include <thread>
 #include <vector>
 
+#include <index/blockfilterindex.h>
 #include <interfaces/chain.h>
+#include <key_io.h>
+#include <miner.h>
 #include <node/context.h>
 #include <policy/policy.h>
 #include <rpc/server.h>
+#include <script/descriptor.h>
+#include <script/sign.h>
+#include <script/signingprovider.h>
 #include <test/util/logging.h>
 #include <test/util/setup_common.h>
 #include <util/ref.h>
+#include <util/string.h>
+#include <util/time.h>
 #include <util/translation.h>
 #include <validation.h>
 #include <wallet/coincontrol.h>
@@ -24,6 +34,10 @@
 #include <boost/test/unit_test.hpp>
 #include <univalue.h>
 
+#if defined(HAVE_CONFIG_H)
+#include <config/xuez-config.h>
+#endif
+
 RPCHelpMan importmulti();
 RPCHelpMan dumpwallet();
 RPCHelpMan importwallet();
@@ -175,6 +189,279 @@ BOOST_FIXTURE_TEST_CASE(scan_for_wallet_transactions, TestChain100Setup)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(scan_for_wallet_transactions_block_filter, TestChain100Setup)
+{
+    // Mine blocks the wallet has nothing to do with.
+    CKey other_key;
+    other_key.MakeNewKey(true);
+    for (int i = 0; i < 5; ++i) {
+        CreateAndProcessBlock({}, GetScriptForRawPubKey(other_key.GetPubKey()));
+    }
+
+    BOOST_REQUIRE(InitBlockFilterIndex(BlockFilterType::BASIC, 1 << 20, true /* f_memory */));
+    BlockFilterIndex& filter_index = *GetBlockFilterIndex(BlockFilterType::BASIC);
+    filter_index.Start();
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!filter_index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        UninterruptibleSleep(std::chrono::milliseconds{100});
+    }
+
+    NodeContext node;
+    auto chain = interfaces::MakeChain(node);
+    const CBlockIndex* genesis = ::ChainActive().Genesis();
+    const CBlockIndex* tip = ::ChainActive().Tip();
+
+    // The filters of several blocks are matched at once.
+    const CScript coinbase_script = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    const GCSFilter::ElementSet elements{GCSFilter::Element(coinbase_script.begin(), coinbase_script.end())};
+    const std::vector<Optional<bool>> matches = chain->blockFiltersMatchAny(BlockFilterType::BASIC, {genesis->GetBlockHash(), ::ChainActive()[1]->GetBlockHash(), tip->GetBlockHash(), uint256::ONE}, elements, 2);
+    BOOST_CHECK(matches == std::vector<Optional<bool>>({false, true, false, nullopt}));
+
+    // A legacy wallet reads every block.
+    CWallet legacy_wallet(chain.get(), "", CreateDummyWalletDatabase());
+    {
+        LOCK(legacy_wallet.cs_wallet);
+        legacy_wallet.SetLastBlockProcessed(tip->nHeight, tip->GetBlockHash());
+    }
+    AddKey(legacy_wallet, coinbaseKey);
+    {
+        WalletRescanReserver reserver(legacy_wallet);
+        reserver.reserve();
+        CWallet::ScanResult result = legacy_wallet.ScanForWalletTransactions(genesis->GetBlockHash(), 0 /* start_height */, {} /* max_height */, reserver, false /* update */);
+        BOOST_CHECK_EQUAL(result.status, CWallet::ScanResult::SUCCESS);
+    }
+
+    // A descriptor wallet for the same key skips the genesis block and the
+    // blocks paying to the other key, and finds the same transactions.
+    CWallet wallet(chain.get(), "", CreateDummyWalletDatabase());
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.SetWalletFlag(WALLET_FLAG_DESCRIPTORS);
+        wallet.SetLastBlockProcessed(tip->nHeight, tip->GetBlockHash());
+        FlatSigningProvider provider;
+        std::string error;
+        std::unique_ptr<Descriptor> desc = Parse("combo(" + EncodeSecret(coinbaseKey) + ")", provider, error, /* require_checksum */ false);
+        BOOST_REQUIRE(desc);
+        WalletDescriptor w_desc(std::move(desc), 0, 0, 1, 1);
+        BOOST_REQUIRE(wallet.AddWalletDescriptor(w_desc, provider, "", false));
+    }
+    {
+        ASSERT_DEBUG_LOG("Rescan skipped 6 blocks");
+        WalletRescanReserver reserver(wallet);
+        reserver.reserve();
+        CWallet::ScanResult result = wallet.ScanForWalletTransactions(genesis->GetBlockHash(), 0 /* start_height */, {} /* max_height */, reserver, false /* update */);
+        BOOST_CHECK_EQUAL(result.status, CWallet::ScanResult::SUCCESS);
+        BOOST_CHECK_EQUAL(result.last_scanned_block, tip->GetBlockHash());
+        BOOST_CHECK_EQUAL(*result.last_scanned_height, tip->nHeight);
+    }
+    BOOST_CHECK_EQUAL(WITH_LOCK(wallet.cs_wallet, return wallet.mapWallet.size()), WITH_LOCK(legacy_wallet.cs_wallet, return legacy_wallet.mapWallet.size()));
+    BOOST_CHECK_EQUAL(wallet.GetBalance().m_mine_immature, legacy_wallet.GetBalance().m_mine_immature);
+    BOOST_CHECK_EQUAL(wallet.GetBalance().m_mine_trusted, legacy_wallet.GetBalance().m_mine_trusted);
+
+    filter_index.Stop();
+    DestroyBlockFilterIndex(BlockFilterType::BASIC);
+}
+
+BOOST_FIXTURE_TEST_CASE(scan_for_wallet_transactions_read_ahead, TestChain100Setup)
+{
+    // Spend a coinbase output to a key the wallet doesn't have, so the spend
+    // is only found through its input.
+    CKey other_key;
+    other_key.MakeNewKey(true);
+    CMutableTransaction spend;
+    spend.nVersion = CTransaction::CURRENT_VERSION;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = GetScriptForDestination(PKHash(other_key.GetPubKey()));
+    FillableSigningProvider keystore;
+    keystore.AddKey(coinbaseKey);
+    std::map<COutPoint, Coin> coins;
+    coins[spend.vin[0].prevout].out = m_coinbase_txns[0]->vout[0];
+    std::map<int, std::string> input_errors;
+    BOOST_REQUIRE(SignTransaction(spend, &keystore, coins, SIGHASH_ALL, input_errors));
+    CreateAndProcessBlock({spend}, GetScriptForRawPubKey(other_key.GetPubKey()));
+    for (int i = 0; i < 3; ++i) {
+        CreateAndProcessBlock({}, GetScriptForRawPubKey(other_key.GetPubKey()));
+    }
+
+    NodeContext node;
+    auto chain = interfaces::MakeChain(node);
+    const CBlockIndex* genesis = ::ChainActive().Genesis();
+    const CBlockIndex* tip = ::ChainActive().Tip();
+
+    CWallet legacy_wallet(chain.get(), "", CreateDummyWalletDatabase());
+    {
+        LOCK(legacy_wallet.cs_wallet);
+        legacy_wallet.SetLastBlockProcessed(tip->nHeight, tip->GetBlockHash());
+    }
+    AddKey(legacy_wallet, coinbaseKey);
+    {
+        WalletRescanReserver reserver(legacy_wallet);
+        reserver.reserve();
+        CWallet::ScanResult result = legacy_wallet.ScanForWalletTransactions(genesis->GetBlockHash(), 0 /* start_height */, {} /* max_height */, reserver, false /* update */);
+        BOOST_CHECK_EQUAL(result.status, CWallet::ScanResult::SUCCESS);
+    }
+
+    // A descriptor wallet for the same key only syncs the transactions matched
+    // while reading ahead, and those spending from the wallet.
+    CWallet wallet(chain.get(), "", CreateDummyWalletDatabase());
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.SetWalletFlag(WALLET_FLAG_DESCRIPTORS);
+        wallet.SetLastBlockProcessed(tip->nHeight, tip->GetBlockHash());
+        FlatSigningProvider provider;
+        std::string error;
+        std::unique_ptr<Descriptor> desc = Parse("combo(" + EncodeSecret(coinbaseKey) + ")", provider, error, /* require_checksum */ false);
+        BOOST_REQUIRE(desc);
+        WalletDescriptor w_desc(std::move(desc), 0, 0, 1, 1);
+        BOOST_REQUIRE(wallet.AddWalletDescriptor(w_desc, provider, "", false));
+    }
+    {
+        WalletRescanReserver reserver(wallet);
+        reserver.reserve();
+        CWallet::ScanResult result = wallet.ScanForWalletTransactions(genesis->GetBlockHash(), 0 /* start_height */, {} /* max_height */, reserver, false /* update */);
+        BOOST_CHECK_EQUAL(result.status, CWallet::ScanResult::SUCCESS);
+        BOOST_CHECK_EQUAL(result.last_scanned_block, tip->GetBlockHash());
+        BOOST_CHECK_EQUAL(*result.last_scanned_height, tip->nHeight);
+    }
+    BOOST_CHECK(WITH_LOCK(legacy_wallet.cs_wallet, return legacy_wallet.mapWallet.count(spend.GetHash())));
+    BOOST_CHECK(WITH_LOCK(wallet.cs_wallet, return wallet.mapWallet.count(spend.GetHash())));
+    BOOST_CHECK_EQUAL(WITH_LOCK(wallet.cs_wallet, return wallet.mapWallet.size()), WITH_LOCK(legacy_wallet.cs_wallet, return legacy_wallet.mapWallet.size()));
+    BOOST_CHECK_EQUAL(wallet.GetBalance().m_mine_trusted, legacy_wallet.GetBalance().m_mine_trusted);
+}
+
+#ifdef USE_SQLITE
+BOOST_FIXTURE_TEST_CASE(scan_for_wallet_transactions_write_batch, TestChain100Setup)
+{
+    NodeContext node;
+    auto chain = interfaces::MakeChain(node);
+    DatabaseOptions options;
+    options.require_create = true;
+    options.require_format = DatabaseFormat::SQLITE;
+    DatabaseStatus status;
+    bilingual_str error;
+    std::unique_ptr<WalletDatabase> database = MakeDatabase(GetDataDir() / "rescan_batch", options, status, error);
+    BOOST_REQUIRE(database);
+    database->Open();
+    CWallet wallet(chain.get(), "", std::move(database));
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.SetLastBlockProcessed(::ChainActive().Height(), ::ChainActive().Tip()->GetBlockHash());
+    }
+    AddKey(wallet, coinbaseKey);
+
+    // Write to the wallet from another thread while the rescan is running. It
+    // must not find a transaction of the rescan open on the connection.
+    gArgs.ForceSetArg("-rescanbatchblocks", "1000");
+    std::thread writer;
+    bool txn_begun = false;
+    auto handler = wallet.NotifyTransactionChanged.connect([&](CWallet*, const uint256&, ChangeType) {
+        if (writer.joinable()) return;
+        writer = std::thread([&] {
+            LOCK(wallet.cs_wallet);
+            WalletBatch batch(wallet.GetDatabase());
+            txn_begun = batch.TxnBegin();
+            if (txn_begun) batch.TxnAbort();
+        });
+    });
+    {
+        WalletRescanReserver reserver(wallet);
+        reserver.reserve();
+        CWallet::ScanResult result = wallet.ScanForWalletTransactions(::ChainActive().Genesis()->GetBlockHash(), 0 /* start_height */, {} /* max_height */, reserver, false /* update */);
+        BOOST_CHECK_EQUAL(result.status, CWallet::ScanResult::SUCCESS);
+    }
+    handler.disconnect();
+    BOOST_REQUIRE(writer.joinable());
+    writer.join();
+    BOOST_CHECK(txn_begun);
+    gArgs.ForceSetArg("-rescanbatchblocks", ToString(DEFAULT_RESCAN_BATCH_BLOCKS));
+    BOOST_CHECK_EQUAL(WITH_LOCK(wallet.cs_wallet, return wallet.mapWallet.size()), m_coinbase_txns.size());
+}
+#endif
+
+BOOST_FIXTURE_TEST_CASE(wallet_summary, TestChain100Setup)
+{
+    // A confirmed transaction paying to a key the wallet doesn't have, so its
+    // output is only listed if it was restored from the summary.
+    CKey other_key;
+    other_key.MakeNewKey(true);
+    CMutableTransaction mtx;
+    mtx.nVersion = CTransaction::CURRENT_VERSION;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 11 * CENT;
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(PKHash(other_key.GetPubKey()));
+    const CTransactionRef tx = MakeTransactionRef(mtx);
+    const CBlockIndex* tip = ::ChainActive().Tip();
+
+    NodeContext node;
+    auto chain = interfaces::MakeChain(node);
+    auto load_with_summary = [&](uint64_t tx_count) {
+        auto wallet = MakeUnique<CWallet>(chain.get(), "", CreateMockWalletDatabase());
+        {
+            WalletBatch batch(wallet->GetDatabase());
+            CWalletTx wtx(wallet.get(), tx);
+            wtx.m_confirm = CWalletTx::Confirmation(CWalletTx::CONFIRMED, tip->nHeight, tip->GetBlockHash(), 1);
+            BOOST_REQUIRE(batch.WriteTx(wtx));
+            CBlockLocator locator;
+            locator.vHave.push_back(tip->GetBlockHash());
+            BOOST_REQUIRE(batch.WriteBestBlock(locator));
+            CWalletSummary summary;
+            summary.best_block = tip->GetBlockHash();
+            summary.tx_count = tx_count;
+            summary.outputs.push_back({COutPoint(tx->GetHash(), 0), ISMINE_SPENDABLE, true});
+            BOOST_REQUIRE(batch.WriteWalletSummary(summary));
+        }
+        bool first_run;
+        BOOST_CHECK(wallet->LoadWallet(first_run) == DBErrors::LOAD_OK);
+        CWalletSummary summary;
+        BOOST_CHECK(!WalletBatch(wallet->GetDatabase()).ReadWalletSummary(summary));
+        LOCK(wallet->cs_wallet);
+        wallet->SetLastBlockProcessed(tip->nHeight, tip->GetBlockHash());
+        std::vector<COutput> coins;
+        wallet->AvailableCoins(coins, false /* fOnlySafe */);
+        return coins.size();
+    };
+    BOOST_CHECK_EQUAL(load_with_summary(1), 1U);
+    // A summary that doesn't match the transactions loaded is ignored.
+    BOOST_CHECK_EQUAL(load_with_summary(2), 0U);
+
+#ifdef USE_SQLITE
+    // Unloading a wallet writes its summary as well.
+    auto load = [&] {
+        DatabaseOptions options;
+        options.require_format = DatabaseFormat::SQLITE;
+        options.create_flags = WALLET_FLAG_DESCRIPTORS;
+        DatabaseStatus status;
+        bilingual_str error;
+        std::vector<bilingual_str> warnings;
+        auto database = MakeWalletDatabase("summary", options, status, error);
+        BOOST_REQUIRE(database);
+        auto wallet = CWallet::Create(*chain, "summary", std::move(database), options.create_flags, error, warnings);
+        BOOST_REQUIRE(wallet);
+        wallet->postInitProcess();
+        return wallet;
+    };
+    auto wallet = load();
+    {
+        LOCK(wallet->cs_wallet);
+        std::vector<COutput> coins;
+        wallet->AvailableCoins(coins);
+    }
+    TestUnloadWallet(std::move(wallet));
+    {
+        ASSERT_DEBUG_LOG("Restored 0 wallet outputs from the wallet summary");
+        wallet = load();
+    }
+    TestUnloadWallet(std::move(wallet));
+#endif
+}
+
 BOOST_FIXTURE_TEST_CASE(importmulti_rescan, TestChain100Setup)
 {
     // Cap last block file size, and mine new block in a new block file.
@@ -610,6 +897,384 @@ BOOST_FIXTURE_TEST_CASE(ListCoins, ListCoinsTestingSetup)
     BOOST_CHECK_EQUAL(list.begin()->second.size(), 2U);
 }
 
+// Check that the balance totals kept up to date by wallet, mempool and block
+// events match the totals computed from scratch after MarkDirty.
+BOOST_FIXTURE_TEST_CASE(incremental_balance_totals, ListCoinsTestingSetup)
+{
+    auto check_totals = [&] {
+        const CWallet::Balance running = wallet->GetBalance();
+        wallet->MarkDirty();
+        const CWallet::Balance full = wallet->GetBalance();
+        BOOST_CHECK_EQUAL(running.m_mine_trusted, full.m_mine_trusted);
+        BOOST_CHECK_EQUAL(running.m_mine_untrusted_pending, full.m_mine_untrusted_pending);
+        BOOST_CHECK_EQUAL(running.m_mine_immature, full.m_mine_immature);
+        return full;
+    };
+    const CWallet::Balance initial = check_totals();
+
+    // Spend the mature coin. Its change is trusted once the transaction is in the mempool.
+    CTransactionRef tx;
+    CAmount fee;
+    int change_pos = -1;
+    bilingual_str error;
+    CCoinControl dummy;
+    FeeCalculation fee_calc_out;
+    BOOST_CHECK(wallet->CreateTransaction({CRecipient{GetScriptForRawPubKey({}), 1 * COIN, false /* subtract fee */}}, tx, fee, change_pos, error, dummy, fee_calc_out));
+    wallet->CommitTransaction(tx, {}, {});
+    BOOST_CHECK(check_totals().m_mine_trusted <= initial.m_mine_trusted - 1 * COIN);
+    wallet->transactionAddedToMempool(tx, 0 /* mempool_sequence */);
+    BOOST_CHECK_EQUAL(check_totals().m_mine_trusted, initial.m_mine_trusted - 1 * COIN - fee);
+
+    // Confirm it in a block, which also adds an immature coinbase and
+    // matures an older one.
+    const CBlock block = CreateAndProcessBlock({CMutableTransaction(*tx)}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+    const int height = WITH_LOCK(cs_main, return ::ChainActive().Height());
+    wallet->blockConnected(block, height);
+    const CWallet::Balance connected = check_totals();
+    BOOST_CHECK(connected.m_mine_trusted > initial.m_mine_trusted - 1 * COIN - fee);
+
+    // Disconnecting the block makes the matured coinbase immature again.
+    wallet->blockDisconnected(block, height);
+    BOOST_CHECK_EQUAL(check_totals().m_mine_immature, initial.m_mine_immature);
+}
+
+// Check that the outputs AvailableCoins finds through the wallet output index,
+// as kept up to date when transactions are added, spent and erased, match
+// the ones found after rebuilding the index from scratch.
+BOOST_FIXTURE_TEST_CASE(wallet_utxo_index, ListCoinsTestingSetup)
+{
+    auto check_available = [&] {
+        LOCK(wallet->cs_wallet);
+        std::vector<COutput> coins;
+        wallet->AvailableCoins(coins);
+        std::set<COutPoint> running;
+        for (const COutput& out : coins) running.insert(COutPoint(out.tx->GetHash(), out.i));
+        wallet->MarkDirty();
+        wallet->NotifyIsMineChanged();
+        wallet->AvailableCoins(coins);
+        std::set<COutPoint> full;
+        for (const COutput& out : coins) full.insert(COutPoint(out.tx->GetHash(), out.i));
+        BOOST_CHECK(running == full);
+        return full;
+    };
+    const std::set<COutPoint> initial = check_available();
+
+    // Adding a transaction adds its outputs and spends its inputs.
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript script = GetScriptForRawPubKey(key.GetPubKey());
+    const CWalletTx& wtx = AddTx(CRecipient{script, 1 * COIN, false /* subtract fee */});
+    const uint256 txid = wtx.GetHash();
+    const COutPoint spent = wtx.tx->vin[0].prevout;
+    std::set<COutPoint> available = check_available();
+    BOOST_CHECK(initial.count(spent));
+    BOOST_CHECK(!available.count(spent));
+    BOOST_CHECK_EQUAL(std::count_if(available.begin(), available.end(), [&](const COutPoint& out) { return out.hash == txid; }), 1);
+
+    // An output becomes available once the wallet gets its key.
+    unsigned int script_pos = 0;
+    while (wtx.tx->vout[script_pos].scriptPubKey != script) ++script_pos;
+    BOOST_CHECK(!available.count(COutPoint(txid, script_pos)));
+    AddKey(*wallet, key);
+    available = check_available();
+    BOOST_CHECK(available.count(COutPoint(txid, script_pos)));
+    BOOST_CHECK_EQUAL(std::count_if(available.begin(), available.end(), [&](const COutPoint& out) { return out.hash == txid; }), 2);
+
+    // Erasing the transaction takes its outputs out and makes its input available again.
+    {
+        LOCK(wallet->cs_wallet);
+        std::vector<uint256> hashes_in{txid}, hashes_out;
+        BOOST_CHECK_EQUAL(wallet->ZapSelectTx(hashes_in, hashes_out), DBErrors::LOAD_OK);
+        BOOST_CHECK_EQUAL(hashes_out.size(), 1U);
+    }
+    std::set<COutPoint> expected;
+    for (const COutPoint& out : available) {
+        if (out.hash != txid) expected.insert(out);
+    }
+    expected.insert(spent);
+    BOOST_CHECK(check_available() == expected);
+
+    // Newly generated addresses are mine without the index being rebuilt, and
+    // so are the outputs paying to them.
+    for (OutputType type : {OutputType::P2SH_SEGWIT, OutputType::BECH32, OutputType::LEGACY}) {
+        CTxDestination dest;
+        std::string error;
+        BOOST_CHECK(WITH_LOCK(wallet->cs_wallet, return wallet->GetNewDestination(type, "", dest, error)));
+        BOOST_CHECK_EQUAL(WITH_LOCK(wallet->cs_wallet, return wallet->IsMine(dest)), ISMINE_SPENDABLE);
+    }
+    CTxDestination dest;
+    std::string error;
+    BOOST_CHECK(WITH_LOCK(wallet->cs_wallet, return wallet->GetNewDestination(OutputType::LEGACY, "", dest, error)));
+    const uint256 new_txid = AddTx(CRecipient{GetScriptForDestination(dest), 1 * COIN, false /* subtract fee */}).GetHash();
+    available = check_available();
+    BOOST_CHECK_EQUAL(std::count_if(available.begin(), available.end(), [&](const COutPoint& out) { return out.hash == new_txid; }), 2);
+}
+
+BOOST_FIXTURE_TEST_CASE(ismine_index_descriptor_topup, TestChain100Setup)
+{
+    NodeContext node;
+    auto chain = interfaces::MakeChain(node);
+    gArgs.ForceSetArg("-keypool", "2");
+    CWallet wallet(chain.get(), "", CreateDummyWalletDatabase());
+    LOCK(wallet.cs_wallet);
+    wallet.SetWalletFlag(WALLET_FLAG_DESCRIPTORS);
+    wallet.SetupDescriptorScriptPubKeyMans();
+
+    // Addresses beyond the keypool top up the descriptors, whose new scripts
+    // are added to the IsMine index as they are derived.
+    std::vector<CScript> scripts;
+    for (int i = 0; i < 5; ++i) {
+        CTxDestination dest;
+        std::string error;
+        BOOST_CHECK(wallet.GetNewDestination(OutputType::BECH32, "", dest, error));
+        scripts.push_back(GetScriptForDestination(dest));
+        BOOST_CHECK_EQUAL(wallet.IsMine(scripts.back()), ISMINE_SPENDABLE);
+    }
+    wallet.NotifyIsMineChanged();
+    for (const CScript& script : scripts) {
+        BOOST_CHECK_EQUAL(wallet.IsMine(script), ISMINE_SPENDABLE);
+    }
+    gArgs.ForceSetArg("-keypool", ToString(DEFAULT_KEYPOOL_SIZE));
+}
+
+BOOST_FIXTURE_TEST_CASE(plan_stake_consolidation, ListCoinsTestingSetup)
+{
+    // Split off two small outputs paying to the coinbase key.
+    const CScript script = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    AddTx(CRecipient{script, 1 * COIN, false /* subtract fee */});
+    AddTx(CRecipient{script, 2 * COIN, false /* subtract fee */});
+
+    LOCK(wallet->cs_wallet);
+    std::vector<COutput> coins;
+    wallet->AvailableCoins(coins);
+    int64_t oldest_time = std::numeric_limits<int64_t>::max();
+    int64_t newest_time = 0;
+    size_t script_count = 0;
+    for (const COutput& out : coins) {
+        if (out.tx->tx->vout[out.i].scriptPubKey != script) continue;
+        int64_t block_time;
+        BOOST_REQUIRE(wallet->chain().findBlock(out.tx->m_confirm.hashBlock, interfaces::FoundBlock().time(block_time)));
+        oldest_time = std::min(oldest_time, block_time);
+        newest_time = std::max(newest_time, block_time);
+        ++script_count;
+    }
+    BOOST_REQUIRE_GE(script_count, 2U);
+    const int64_t stake_min_age = Params().GetConsensus().nStakeMinAge[1];
+    BOOST_REQUIRE_LT(newest_time - oldest_time, stake_min_age / 2);
+    wallet->m_stake_consolidate_count = 1;
+    wallet->m_stake_consolidate_size = 3 * COIN;
+
+    // Only the young small outputs paying to the same script are merged.
+    SetMockTime(newest_time);
+    const StakeConsolidationPlan young_plan = wallet->PlanStakeConsolidation();
+    BOOST_CHECK_EQUAL(young_plan.utxo_count, coins.size());
+    BOOST_CHECK_EQUAL(young_plan.maturing_count, 0U);
+    BOOST_REQUIRE_EQUAL(young_plan.consolidations.size(), 1U);
+    BOOST_CHECK(young_plan.consolidations[0].script == script);
+    BOOST_CHECK_EQUAL(young_plan.consolidations[0].inputs.size(), 2U);
+    BOOST_CHECK_EQUAL(young_plan.consolidations[0].amount, 3 * COIN);
+
+    // The outputs are about to reach the stake minimum age, counted from
+    // their confirming block, and are left alone.
+    SetMockTime(newest_time + stake_min_age / 2);
+    StakeConsolidationPlan plan = wallet->PlanStakeConsolidation();
+    BOOST_CHECK_GE(plan.maturing_count, 2U);
+    BOOST_CHECK(plan.consolidations.empty());
+
+    // Once all of them can stake, the small outputs are merged again.
+    SetMockTime(newest_time + stake_min_age);
+    plan = wallet->PlanStakeConsolidation();
+    BOOST_CHECK_EQUAL(plan.maturing_count, 0U);
+    BOOST_REQUIRE_EQUAL(plan.consolidations.size(), 1U);
+    BOOST_CHECK(plan.consolidations[0].script == script);
+    BOOST_CHECK_EQUAL(plan.consolidations[0].inputs.size(), 2U);
+    BOOST_CHECK_EQUAL(plan.consolidations[0].amount, 3 * COIN);
+
+    SetMockTime(newest_time);
+    // Nothing is merged while the wallet has no more outputs than the target.
+    wallet->m_stake_consolidate_count = coins.size();
+    BOOST_CHECK(wallet->PlanStakeConsolidation().consolidations.empty());
+
+    // Once merged, the outputs are spent and no longer planned for.
+    wallet->m_stake_consolidate_count = 1;
+    BOOST_CHECK_EQUAL(wallet->ConsolidateStakeCoins(young_plan), 1U);
+    plan = wallet->PlanStakeConsolidation();
+    BOOST_CHECK_EQUAL(plan.utxo_count, coins.size() - 2);
+    BOOST_CHECK(plan.consolidations.empty());
+    SetMockTime(0);
+}
+
+BOOST_FIXTURE_TEST_CASE(stake_signing_info, ListCoinsTestingSetup)
+{
+    LOCK(wallet->cs_wallet);
+    const CPubKey coinbase_pubkey = coinbaseKey.GetPubKey();
+
+    StakeSigningInfo info = wallet->GetStakeSigningInfo(GetScriptForRawPubKey(coinbase_pubkey));
+    BOOST_CHECK(info.can_sign);
+    BOOST_CHECK(info.type == TxoutType::PUBKEY);
+    BOOST_CHECK(info.pubkey == coinbase_pubkey);
+
+    info = wallet->GetStakeSigningInfo(GetScriptForDestination(PKHash(coinbase_pubkey)));
+    BOOST_CHECK(info.can_sign);
+    BOOST_CHECK(info.type == TxoutType::PUBKEYHASH);
+    BOOST_CHECK(info.pubkey == coinbase_pubkey);
+
+    // Scripts of unknown keys are cached as not stakeable until the wallet gets the key.
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript script = GetScriptForDestination(WitnessV0KeyHash(key.GetPubKey()));
+    BOOST_CHECK(!wallet->GetStakeSigningInfo(script).can_sign);
+    BOOST_CHECK(wallet->GetLegacyScriptPubKeyMan()->AddKeyPubKey(key, key.GetPubKey()));
+    info = wallet->GetStakeSigningInfo(script);
+    BOOST_CHECK(info.can_sign);
+    BOOST_CHECK(info.type == TxoutType::WITNESS_V0_KEYHASH);
+    BOOST_CHECK(info.pubkey == key.GetPubKey());
+
+    // Only 1-of-1 bare multisig scripts are supported.
+    BOOST_CHECK(wallet->GetStakeSigningInfo(GetScriptForMultisig(1, {coinbase_pubkey})).can_sign);
+    BOOST_CHECK(!wallet->GetStakeSigningInfo(GetScriptForMultisig(1, {coinbase_pubkey, key.GetPubKey()})).can_sign);
+}
+
+BOOST_FIXTURE_TEST_CASE(sign_block_replaced_descriptor, TestChain100Setup)
+{
+    NodeContext node;
+    auto chain = interfaces::MakeChain(node);
+    CWallet wallet(chain.get(), "", CreateDummyWalletDatabase());
+    wallet.SetWalletFlag(WALLET_FLAG_DESCRIPTORS);
+    auto add_descriptor = [&] {
+        FlatSigningProvider provider;
+        std::string error;
+        std::unique_ptr<Descriptor> desc = Parse("pkh(" + EncodeSecret(coinbaseKey) + ")", provider, error, /* require_checksum */ false);
+        BOOST_REQUIRE(desc);
+        WalletDescriptor w_desc(std::move(desc), 0, 0, 1, 1);
+        BOOST_REQUIRE(wallet.AddWalletDescriptor(w_desc, provider, "", false));
+    };
+    add_descriptor();
+
+    LOCK(wallet.cs_wallet);
+    CBlock block;
+    BOOST_CHECK(wallet.SignBlock(block, coinbaseKey.GetPubKey()));
+
+    // Adding the descriptor again replaces the ScriptPubKeyMan that signed the
+    // block, and the next block is signed with the new one.
+    add_descriptor();
+    block.vchBlockSig.clear();
+    BOOST_CHECK(wallet.SignBlock(block, coinbaseKey.GetPubKey()));
+    BOOST_CHECK(coinbaseKey.GetPubKey().Verify(block.GetHash(), block.vchBlockSig));
+}
+
+static std::shared_ptr<CWallet> CreateStakingWallet(interfaces::Chain& chain, const std::string& name, const CKey& key)
+{
+    std::shared_ptr<CWallet> wallet = std::make_shared<CWallet>(&chain, name, CreateMockWalletDatabase());
+    {
+        LOCK2(wallet->cs_wallet, ::cs_main);
+        wallet->SetLastBlockProcessed(::ChainActive().Height(), ::ChainActive().Tip()->GetBlockHash());
+    }
+    bool first_run;
+    wallet->LoadWallet(first_run);
+    AddKey(*wallet, key);
+    WalletRescanReserver reserver(*wallet);
+    reserver.reserve();
+    CWallet::ScanResult result = wallet->ScanForWalletTransactions(::ChainActive().Genesis()->GetBlockHash(), 0 /* start_height */, {} /* max_height */, reserver, false /* update */);
+    BOOST_CHECK_EQUAL(result.status, CWallet::ScanResult::SUCCESS);
+    return wallet;
+}
+
+BOOST_FIXTURE_TEST_CASE(stake_minter_pooled_wallets, TestChain100Setup)
+{
+    // Give a second key coinbase outputs and let them mature.
+    CKey other_key;
+    other_key.MakeNewKey(true);
+    for (int i = 0; i < 3; ++i) {
+        CreateAndProcessBlock({}, GetScriptForRawPubKey(other_key.GetPubKey()));
+    }
+    for (int i = 0; i < COINBASE_MATURITY; ++i) {
+        CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+    }
+
+    auto chain = interfaces::MakeChain(m_node);
+    std::shared_ptr<CWallet> wallet_a = CreateStakingWallet(*chain, "a", coinbaseKey);
+    std::shared_ptr<CWallet> wallet_b = CreateStakingWallet(*chain, "b", other_key);
+    // Unload the wallets and reset the mock time even if a check below fails.
+    struct Cleanup {
+        ~Cleanup()
+        {
+            for (const std::shared_ptr<CWallet>& wallet : GetWallets()) {
+                RemoveWallet(wallet, nullopt);
+            }
+            SetMockTime(0);
+        }
+    } cleanup;
+    BOOST_REQUIRE(AddWallet(wallet_a));
+    BOOST_REQUIRE(AddWallet(wallet_b));
+    BOOST_CHECK_EQUAL(GetStakingWallets().size(), 2U);
+
+    // All coins are past the stake minimum age, and the coins of both wallets
+    // are searched together.
+    const int64_t stake_min_age = Params().GetConsensus().nStakeMinAge[1];
+    const int64_t tip_time = WITH_LOCK(cs_main, return ::ChainActive().Tip()->GetBlockTime());
+    SetMockTime(tip_time + 2 * stake_min_age);
+    std::vector<StakeKernel> kernels;
+    size_t num_coins = 0;
+    int64_t last_search_time = 0;
+    uint256 last_search_tip;
+    BOOST_REQUIRE(FindStakeKernels(GetStakingWallets(), kernels, num_coins, last_search_time, last_search_tip));
+    BOOST_CHECK_GE(num_coins, kernels.size());
+
+    // The slot is searched once per tip.
+    std::vector<StakeKernel> search_again;
+    BOOST_CHECK(!FindStakeKernels(GetStakingWallets(), search_again, num_coins, last_search_time, last_search_tip));
+
+    // Each kernel is found for the wallet owning its coin.
+    const StakeKernel* kernel_b = nullptr;
+    bool found_a = false;
+    for (const StakeKernel& kernel : kernels) {
+        const std::shared_ptr<CWallet>& other = kernel.wallet == wallet_a ? wallet_b : wallet_a;
+        BOOST_CHECK(WITH_LOCK(kernel.wallet->cs_wallet, return kernel.wallet->IsMine(kernel.txout)) == ISMINE_SPENDABLE);
+        BOOST_CHECK(WITH_LOCK(other->cs_wallet, return other->IsMine(kernel.txout)) == ISMINE_NO);
+        if (kernel.wallet == wallet_a) found_a = true;
+        if (kernel.wallet == wallet_b) kernel_b = &kernel;
+    }
+    BOOST_CHECK(found_a);
+    BOOST_REQUIRE(kernel_b);
+
+    // The block of a kernel is created and signed by the owning wallet only.
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    bool pos_cancel = false;
+    {
+        LOCK(wallet_b->cs_wallet);
+        pblocktemplate = BlockAssembler(*m_node.mempool, Params()).CreateNewBlock(CScript(), kernel_b, &pos_cancel);
+    }
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK(!pos_cancel);
+    CBlock& block = pblocktemplate->block;
+    BOOST_REQUIRE(block.IsProofOfStake());
+    BOOST_CHECK(block.vtx[1]->vin[0].prevout == kernel_b->prevout);
+    CPubKey signing_pubkey;
+    bool pubkey_in_sig = true;
+    BOOST_REQUIRE(WITH_LOCK(wallet_b->cs_wallet, return wallet_b->GetBlockSigningPubKey(block, signing_pubkey, pubkey_in_sig)));
+    BOOST_CHECK(signing_pubkey == other_key.GetPubKey());
+    unsigned int extra_nonce = 0;
+    IncrementExtraNonce(&block, WITH_LOCK(cs_main, return ::ChainActive().Tip()), extra_nonce, pubkey_in_sig ? nullptr : &signing_pubkey);
+    BOOST_CHECK(!WITH_LOCK(wallet_a->cs_wallet, return wallet_a->SignBlock(block, signing_pubkey)));
+    BOOST_REQUIRE(WITH_LOCK(wallet_b->cs_wallet, return wallet_b->SignBlock(block, signing_pubkey)));
+    BOOST_CHECK(CheckBlockSignature(block));
+    BOOST_CHECK(m_node.chainman->ProcessNewBlock(Params(), std::make_shared<const CBlock>(block), true, nullptr));
+    BOOST_CHECK_EQUAL(WITH_LOCK(cs_main, return ::ChainActive().Tip()->GetBlockHash()), block.GetHash());
+
+    // An unloaded wallet drops out of the next search.
+    BOOST_REQUIRE(RemoveWallet(wallet_b, nullopt));
+    const std::vector<std::shared_ptr<CWallet>> staking_wallets = GetStakingWallets();
+    BOOST_REQUIRE_EQUAL(staking_wallets.size(), 1U);
+    BOOST_CHECK(staking_wallets[0] == wallet_a);
+    SetMockTime(tip_time + 3 * stake_min_age);
+    BOOST_REQUIRE(FindStakeKernels(staking_wallets, kernels, num_coins, last_search_time, last_search_tip));
+    BOOST_CHECK(!kernels.empty());
+    for (const StakeKernel& kernel : kernels) {
+        BOOST_CHECK(kernel.wallet == wallet_a);
+    }
+}
+
 BOOST_FIXTURE_TEST_CASE(wallet_disableprivkeys, TestChain100Setup)
 {
     NodeContext node;
@@ -30,6 +30,8 @@
 #include <util/moneystr.h>
 #include <util/rbf.h>
 #include <util/string.h>
+#include <util/system.h>
+#include <util/threadnames.h>
 #include <util/translation.h>
 #include <wallet/coincontrol.h>
 #include <wallet/fees.h>
@@ -39,6 +41,10 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 
@@ -165,6 +171,7 @@ static void ReleaseWallet(CWallet* wallet)
 {
     const std::string name = wallet->GetName();
     wallet->WalletLogPrintf("Releasing wallet\n");
+    WITH_LOCK(wallet->cs_wallet, wallet->WriteWalletSummary());
     wallet->Flush();
     delete wallet;
     // Wallet is now released, notify UnloadWallet, if any.
@@ -434,6 +441,8 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
 
 void CWallet::chainStateFlushed(const CBlockLocator& loc)
 {
+    // Keep the locator at or before the block whose writes were lost.
+    if (m_block_write_failed) return;
     WalletBatch batch(*database);
     batch.WriteBestBlock(loc);
 }
@@ -491,6 +500,10 @@ void CWallet::Flush()
 
 void CWallet::Close()
 {
+    {
+        LOCK(cs_wallet);
+        WriteWalletSummary();
+    }
     database->Close();
 }
 
@@ -580,6 +593,179 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+bool CWallet::IsSpentByConfirmed(const COutPoint& outpoint) const
+{
+    const auto range = mapTxSpends.equal_range(outpoint);
+    for (auto it = range.first; it != range.second; ++it) {
+        const auto mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.isConfirmed()) return true;
+    }
+    return false;
+}
+
+void CWallet::UpdateWalletUTXO(const CWalletTx& wtx, unsigned int n) const
+{
+    const COutPoint outpoint(wtx.GetHash(), n);
+    const CTxOut& txout = wtx.tx->vout[n];
+    const isminetype mine = IsSpentByConfirmed(outpoint) ? ISMINE_NO : IsMine(txout);
+    if (mine == ISMINE_NO) {
+        m_wallet_utxos.erase(outpoint);
+        return;
+    }
+    auto it = m_wallet_utxos.find(outpoint);
+    if (it != m_wallet_utxos.end() && it->second.mine == mine) return;
+
+    std::unique_ptr<SigningProvider> provider = GetSolvingProvider(txout.scriptPubKey);
+    m_wallet_utxos[outpoint] = WalletUTXO{mine, provider ? IsSolvable(*provider, txout.scriptPubKey) : false};
+}
+
+void CWallet::UpdateWalletUTXOs(const CWalletTx& wtx)
+{
+    // A dirty index is rebuilt before it is used anyway.
+    if (m_wallet_utxos_dirty) return;
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); ++i) {
+        UpdateWalletUTXO(wtx, i);
+    }
+    if (wtx.IsCoinBase()) return;
+    for (const CTxIn& txin : wtx.tx->vin) {
+        const auto it = mapWallet.find(txin.prevout.hash);
+        if (it != mapWallet.end() && txin.prevout.n < it->second.tx->vout.size()) {
+            UpdateWalletUTXO(it->second, txin.prevout.n);
+        }
+    }
+}
+
+void CWallet::RemoveWalletUTXOs(const CWalletTx& wtx)
+{
+    if (m_wallet_utxos_dirty) return;
+    const uint256& txid = wtx.GetHash();
+    auto it = m_wallet_utxos.lower_bound(COutPoint(txid, 0));
+    while (it != m_wallet_utxos.end() && it->first.hash == txid) {
+        it = m_wallet_utxos.erase(it);
+    }
+    if (wtx.IsCoinBase()) return;
+    for (const CTxIn& txin : wtx.tx->vin) {
+        const auto prev_it = mapWallet.find(txin.prevout.hash);
+        if (prev_it != mapWallet.end() && txin.prevout.n < prev_it->second.tx->vout.size()) {
+            UpdateWalletUTXO(prev_it->second, txin.prevout.n);
+        }
+    }
+}
+
+void CWallet::UpdateWalletUTXOIndex() const
+{
+    AssertLockHeld(cs_wallet);
+    // Merge the scripts that became mine, so their outputs are known.
+    UpdateIsMineIndex();
+    // Changes made while the index is rebuilt mark it dirty again.
+    if (m_wallet_utxos_dirty.exchange(false)) {
+        m_wallet_utxos_added_scripts.clear();
+        m_wallet_utxos.clear();
+        for (const auto& entry : mapWallet) {
+            for (unsigned int i = 0; i < entry.second.tx->vout.size(); ++i) {
+                UpdateWalletUTXO(entry.second, i);
+            }
+        }
+        return;
+    }
+    if (m_wallet_utxos_added_scripts.empty()) return;
+    for (const auto& entry : mapWallet) {
+        for (unsigned int i = 0; i < entry.second.tx->vout.size(); ++i) {
+            if (m_wallet_utxos_added_scripts.count(entry.second.tx->vout[i].scriptPubKey)) {
+                UpdateWalletUTXO(entry.second, i);
+            }
+        }
+    }
+    m_wallet_utxos_added_scripts.clear();
+}
+
+bool CWallet::LoadWalletSummary()
+{
+    WalletBatch batch(*database);
+    CWalletSummary summary;
+    if (!batch.ReadWalletSummary(summary)) return false;
+    // The summary only describes the wallet as it was closed, so it is never used twice.
+    batch.EraseWalletSummary();
+
+    // A wallet opened by a version that does not know about the summary may have
+    // changed since, in which case it will have moved its best block or added transactions.
+    CBlockLocator locator;
+    if (summary.nVersion != CWalletSummary::CURRENT_VERSION || summary.tx_count != mapWallet.size() ||
+        !batch.ReadBestBlock(locator) || locator.vHave.empty() || locator.vHave[0] != summary.best_block) {
+        return false;
+    }
+    UpdateIsMineIndex();
+    if (summary.script_count != m_ismine_index.size()) return false;
+
+    m_wallet_utxos.clear();
+    for (const CWalletSummary::Output& output : summary.outputs) {
+        const auto it = mapWallet.find(output.outpoint.hash);
+        if (it == mapWallet.end() || output.outpoint.n >= it->second.tx->vout.size() ||
+            output.mine == ISMINE_NO || (output.mine & ~ISMINE_ALL)) {
+            m_wallet_utxos.clear();
+            return false;
+        }
+        m_wallet_utxos.emplace(output.outpoint, WalletUTXO{static_cast<isminetype>(output.mine), output.solvable});
+    }
+    m_wallet_utxos_dirty = false;
+    WalletLogPrintf("Restored %u wallet outputs from the wallet summary\n", m_wallet_utxos.size());
+    return true;
+}
+
+void CWallet::WriteWalletSummary()
+{
+    AssertLockHeld(cs_wallet);
+    if (!m_write_summary_on_close) return;
+    m_write_summary_on_close = false;
+    // The outputs in memory may not all be on disk.
+    if (m_block_write_failed) return;
+    // Nothing to save if the output index was not built since it last changed.
+    if (m_wallet_utxos_dirty) return;
+    UpdateWalletUTXOIndex();
+
+    WalletBatch batch(*database);
+    CBlockLocator locator;
+    if (!batch.ReadBestBlock(locator) || locator.vHave.empty()) return;
+
+    CWalletSummary summary;
+    summary.best_block = locator.vHave[0];
+    summary.tx_count = mapWallet.size();
+    UpdateIsMineIndex();
+    summary.script_count = m_ismine_index.size();
+    summary.outputs.reserve(m_wallet_utxos.size());
+    for (const auto& entry : m_wallet_utxos) {
+        summary.outputs.push_back({entry.first, static_cast<uint8_t>(entry.second.mine), entry.second.solvable});
+    }
+    if (!batch.WriteWalletSummary(summary)) {
+        WalletLogPrintf("Failed to write the wallet summary\n");
+    }
+}
+
+void CWallet::BeginWriteBatch()
+{
+    AssertLockHeld(cs_wallet);
+    if (m_write_batch) return;
+    m_write_batch = MakeUnique<WalletBatch>(*database, /* fFlushOnClose */ false);
+    // A Berkeley DB transaction would lock out the writes made through other
+    // batches, e.g. by key pool top ups, so only SQLite writes are grouped.
+    m_write_batch_txn = database->Format() == "sqlite" && m_write_batch->TxnBegin();
+}
+
+bool CWallet::CommitWriteBatch()
+{
+    AssertLockHeld(cs_wallet);
+    if (!m_write_batch) return true;
+    bool ok = true;
+    if (m_write_batch_txn && !m_write_batch->TxnCommit()) {
+        WalletLogPrintf("%s: Failed to commit wallet database writes\n", __func__);
+        m_write_batch->TxnAbort();
+        ok = false;
+    }
+    m_write_batch_txn = false;
+    m_write_batch.reset();
+    return ok;
+}
+
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
     if (IsCrypted())
@@ -757,6 +943,9 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (std::pair<const uint256, CWalletTx>& item : mapWallet)
             item.second.MarkDirty();
+        // Imported keys and scripts may change which outputs are ours.
+        m_wallet_utxos_dirty = true;
+        InvalidateBalanceTotals();
     }
 }
 
@@ -848,7 +1037,9 @@ CWalletTx* CWallet::AddToWallet(CTransactionRef tx, const CWalletTx::Confirmatio
 {
     LOCK(cs_wallet);
 
-    WalletBatch batch(*database, fFlushOnClose);
+    std::unique_ptr<WalletBatch> own_batch;
+    if (!m_write_batch) own_batch = MakeUnique<WalletBatch>(*database, fFlushOnClose);
+    WalletBatch& batch = m_write_batch ? *m_write_batch : *own_batch;
 
     uint256 hash = tx->GetHash();
 
@@ -916,6 +1107,8 @@ CWalletTx* CWallet::AddToWallet(CTransactionRef tx, const CWalletTx::Confirmatio
 
     // Break debit/credit balance caches:
     wtx.MarkDirty();
+    UpdateWalletUTXOs(wtx);
+    UpdateBalanceContributions(wtx);
 
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1037,6 +1230,16 @@ bool CWallet::TransactionCanBeAbandoned(const uint256& hashTx) const
     return wtx && !wtx->isAbandoned() && wtx->GetDepthInMainChain() == 0 && !wtx->InMempool();
 }
 
+bool CWallet::MayInvolveWallet(const CTransaction& tx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (mapWallet.count(tx.GetHash())) return true;
+    for (const CTxIn& txin : tx.vin) {
+        if (mapWallet.count(txin.prevout.hash) || mapTxSpends.count(txin.prevout)) return true;
+    }
+    return false;
+}
+
 void CWallet::MarkInputsDirty(const CTransactionRef& tx)
 {
     for (const CTxIn& txin : tx->vin) {
@@ -1051,7 +1254,9 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
 {
     LOCK(cs_wallet);
 
-    WalletBatch batch(*database);
+    std::unique_ptr<WalletBatch> own_batch;
+    if (!m_write_batch) own_batch = MakeUnique<WalletBatch>(*database);
+    WalletBatch& batch = m_write_batch ? *m_write_batch : *own_batch;
 
     std::set<uint256> todo;
     std::set<uint256> done;
@@ -1095,6 +1300,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             // If a transaction changes 'conflicted' state, that changes the balance
             // available of the outputs it spends. So force those to be recomputed
             MarkInputsDirty(wtx.tx);
+            UpdateBalanceContributions(wtx);
         }
     }
 
@@ -1114,7 +1320,9 @@ void CWallet::MarkConflicted(const uint256& hashBlock, int conflicting_height, c
         return;
 
     // Do not flush the wallet here for performance reasons
-    WalletBatch batch(*database, false);
+    std::unique_ptr<WalletBatch> own_batch;
+    if (!m_write_batch) own_batch = MakeUnique<WalletBatch>(*database, false);
+    WalletBatch& batch = m_write_batch ? *m_write_batch : *own_batch;
 
     std::set<uint256> todo;
     std::set<uint256> done;
@@ -1149,6 +1357,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, int conflicting_height, c
             // If a transaction changes 'conflicted' state, that changes the balance
             // available of the outputs it spends. So force those to be recomputed
             MarkInputsDirty(wtx.tx);
+            UpdateBalanceContributions(wtx);
         }
     }
 }
@@ -1171,6 +1380,7 @@ void CWallet::transactionAddedToMempool(const CTransactionRef& tx, uint64_t memp
     auto it = mapWallet.find(tx->GetHash());
     if (it != mapWallet.end()) {
         it->second.fInMempool = true;
+        UpdateBalanceContributions(it->second);
     }
 }
 
@@ -1179,6 +1389,7 @@ void CWallet::transactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRe
     auto it = mapWallet.find(tx->GetHash());
     if (it != mapWallet.end()) {
         it->second.fInMempool = false;
+        UpdateBalanceContributions(it->second);
     }
     // Handle transactions that were removed from the mempool because they
     // conflict with transactions in a newly connected block.
@@ -1219,10 +1430,16 @@ void CWallet::blockConnected(const CBlock& block, int height)
 
     m_last_block_processed_height = height;
     m_last_block_processed = block_hash;
+    BeginWriteBatch();
     for (size_t index = 0; index < block.vtx.size(); index++) {
         SyncTransaction(block.vtx[index], {CWalletTx::Status::CONFIRMED, height, block_hash, (int)index});
         transactionRemovedFromMempool(block.vtx[index], MemPoolRemovalReason::BLOCK, 0 /* mempool_sequence */);
     }
+    if (!CommitWriteBatch() && !m_block_write_failed.exchange(true)) {
+        WalletLogPrintf("Error: Could not write the wallet transactions of block %s (height %d), the wallet will rescan from it when loaded again\n", block_hash.ToString(), height);
+    }
+    // Coins may have matured and unconfirmed transactions may have become final
+    UpdateTipDependentBalances(height);
 }
 
 void CWallet::blockDisconnected(const CBlock& block, int height)
@@ -1235,9 +1452,14 @@ void CWallet::blockDisconnected(const CBlock& block, int height)
     // future with a stickier abandoned state or even removing abandontransaction call.
     m_last_block_processed_height = height - 1;
     m_last_block_processed = block.hashPrevBlock;
+    BeginWriteBatch();
     for (const CTransactionRef& ptx : block.vtx) {
         SyncTransaction(ptx, {CWalletTx::Status::UNCONFIRMED, /* block height */ 0, /* block hash */ {}, /* index */ 0});
     }
+    if (!CommitWriteBatch() && !m_block_write_failed.exchange(true)) {
+        WalletLogPrintf("Error: Could not write the wallet transactions of disconnected block %s (height %d), the wallet will rescan from it when loaded again\n", block.GetHash().ToString(), height);
+    }
+    UpdateTipDependentBalances(height);
 }
 
 void CWallet::updatedBlockTip()
@@ -1303,11 +1525,35 @@ isminetype CWallet::IsMine(const CTxDestination& dest) const
 isminetype CWallet::IsMine(const CScript& script) const
 {
     AssertLockHeld(cs_wallet);
-    isminetype result = ISMINE_NO;
-    for (const auto& spk_man_pair : m_spk_managers) {
-        result = std::max(result, spk_man_pair.second->IsMine(script));
+    UpdateIsMineIndex();
+    auto it = m_ismine_index.find(script);
+    return it != m_ismine_index.end() ? it->second : ISMINE_NO;
+}
+
+void CWallet::UpdateIsMineIndex() const
+{
+    AssertLockHeld(cs_wallet);
+    // Changes made while the index is rebuilt mark it dirty again.
+    if (m_ismine_index_dirty.exchange(false)) {
+        // Scripts queued so far are part of the rebuilt index.
+        WITH_LOCK(m_ismine_added_mutex, m_ismine_added.clear());
+        m_ismine_index.clear();
+        for (const auto& spk_man_pair : m_spk_managers) {
+            for (const auto& entry : spk_man_pair.second->GetIsMineScripts()) {
+                isminetype& mine = m_ismine_index.emplace(entry.first, ISMINE_NO).first->second;
+                mine = std::max(mine, entry.second);
+            }
+        }
+        return;
+    }
+    if (!m_ismine_added_pending.exchange(false)) return;
+    std::vector<std::pair<CScript, isminetype>> added;
+    WITH_LOCK(m_ismine_added_mutex, added.swap(m_ismine_added));
+    for (auto& entry : added) {
+        isminetype& mine = m_ismine_index.emplace(entry.first, ISMINE_NO).first->second;
+        mine = std::max(mine, entry.second);
+        m_wallet_utxos_added_scripts.insert(std::move(entry.first));
     }
-    return result;
 }
 
 CAmount CWallet::GetCredit(const CTxOut& txout, const isminefilter& filter) const
@@ -1452,6 +1698,7 @@ void CWallet::SetWalletFlag(uint64_t flags)
 {
     LOCK(cs_wallet);
     m_wallet_flags |= flags;
+    InvalidateBalanceTotals();
     if (!WalletBatch(*database).WriteWalletFlags(m_wallet_flags))
         throw std::runtime_error(std::string(__func__) + ": writing wallet flags failed");
 }
@@ -1466,6 +1713,7 @@ void CWallet::UnsetWalletFlagWithDB(WalletBatch& batch, uint64_t flag)
 {
     LOCK(cs_wallet);
     m_wallet_flags &= ~flag;
+    InvalidateBalanceTotals();
     if (!batch.WriteWalletFlags(m_wallet_flags))
         throw std::runtime_error(std::string(__func__) + ": writing wallet flags failed");
 }
@@ -1750,6 +1998,225 @@ int64_t CWallet::RescanFromTime(int64_t startTime, const WalletRescanReserver& r
     return startTime;
 }
 
+namespace {
+
+//! Maximum number of threads reading and matching blocks ahead of a rescan
+constexpr int MAX_RESCAN_READ_THREADS = 8;
+//! Number of blocks read ahead of a rescan
+constexpr size_t RESCAN_READ_AHEAD = 32;
+
+/**
+ * Set of the output scripts of a descriptor wallet. A transaction pays to the
+ * wallet exactly if one of its outputs is in the set, which lets the threads
+ * reading ahead of a rescan match transactions without the wallet lock. The
+ * set also rules out blocks with their BIP 158 block filters: a block that
+ * pays to or spends from the wallet always matches its filter, as basic
+ * filters contain both the output scripts and the scripts of the spent
+ * outputs of a block.
+ *
+ * The set is handed out as an immutable snapshot, which is replaced when the
+ * wallet's descriptors are topped up.
+ */
+class WalletRescanScripts
+{
+public:
+    using Snapshot = std::shared_ptr<const GCSFilter::ElementSet>;
+
+    explicit WalletRescanScripts(const CWallet& wallet) : m_wallet(wallet)
+    {
+        // Legacy wallets also match scripts derived from their keys and
+        // redeem scripts, so they have no closed set of scripts.
+        assert(!m_wallet.IsLegacy());
+        AssertLockHeld(m_wallet.cs_wallet);
+        auto scripts = std::make_shared<GCSFilter::ElementSet>();
+        for (ScriptPubKeyMan* spk_man : m_wallet.GetAllScriptPubKeyMans()) {
+            AddScriptPubKeys(*spk_man, *scripts);
+        }
+        m_snapshot = std::move(scripts);
+    }
+
+    /** Take in the scripts of descriptors topped up since the last snapshot. Requires cs_wallet. */
+    void Update()
+    {
+        AssertLockHeld(m_wallet.cs_wallet);
+        std::shared_ptr<GCSFilter::ElementSet> scripts;
+        for (ScriptPubKeyMan* spk_man : m_wallet.GetAllScriptPubKeyMans()) {
+            auto it = m_script_counts.find(spk_man->GetID());
+            if (it == m_script_counts.end() || it->second != static_cast<DescriptorScriptPubKeyMan*>(spk_man)->GetScriptPubKeyCount()) {
+                if (!scripts) scripts = std::make_shared<GCSFilter::ElementSet>(*m_snapshot);
+                AddScriptPubKeys(*spk_man, *scripts);
+            }
+        }
+        if (scripts) m_snapshot = std::move(scripts);
+    }
+
+    const Snapshot& Get() const { return m_snapshot; }
+
+    static bool PaysTo(const CTransaction& tx, const GCSFilter::ElementSet& scripts)
+    {
+        for (const CTxOut& txout : tx.vout) {
+            if (scripts.count(GCSFilter::Element(txout.scriptPubKey.begin(), txout.scriptPubKey.end()))) return true;
+        }
+        return false;
+    }
+
+private:
+    const CWallet& m_wallet;
+    //! Number of scripts added for each descriptor
+    std::map<uint256, size_t> m_script_counts;
+    Snapshot m_snapshot;
+
+    void AddScriptPubKeys(ScriptPubKeyMan& spk_man, GCSFilter::ElementSet& scripts)
+    {
+        auto desc_spk_man = dynamic_cast<DescriptorScriptPubKeyMan*>(&spk_man);
+        assert(desc_spk_man);
+        const std::vector<CScript> script_pub_keys = desc_spk_man->GetScriptPubKeys();
+        for (const CScript& script_pub_key : script_pub_keys) {
+            scripts.emplace(script_pub_key.begin(), script_pub_key.end());
+        }
+        m_script_counts[spk_man.GetID()] = script_pub_keys.size();
+    }
+};
+
+/**
+ * Reads blocks ahead of a rescan on several threads, skipping blocks whose
+ * block filters were found not to match. The threads also match the
+ * transactions of the blocks they read against a snapshot of the wallet's
+ * scripts, so that the rescan only needs to apply the matching transactions. Blocks are queued as the
+ * rescan goes on and handed out in order, one reader serving the whole rescan.
+ */
+class RescanBlockReader
+{
+public:
+    struct Result {
+        enum class Status { FAILED, FILTERED, READ };
+        Status status{Status::FAILED};
+        CBlock block;
+        //! Scripts the block was checked against, null for legacy wallets
+        WalletRescanScripts::Snapshot scripts;
+        //! Whether each transaction of the block pays to one of the scripts
+        std::vector<bool> pays_to_wallet;
+    };
+
+    RescanBlockReader(interfaces::Chain& chain, int num_threads)
+        : m_chain(chain)
+    {
+        for (int i = 0; i < num_threads; ++i) {
+            m_threads.emplace_back([this] {
+                util::ThreadRename("wallet.rescan");
+                Run();
+            });
+        }
+    }
+
+    ~RescanBlockReader()
+    {
+        {
+            LOCK(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    /**
+     * Queue a block to be read and matched against scripts, unless
+     * filter_match tells that its block filter matches none of them.
+     */
+    void Add(const uint256& block_hash, WalletRescanScripts::Snapshot scripts, Optional<bool> filter_match = nullopt)
+    {
+        {
+            LOCK(m_mutex);
+            m_slots.emplace_back();
+            m_slots.back().block_hash = block_hash;
+            m_slots.back().filter_match = filter_match;
+            m_slots.back().result.scripts = std::move(scripts);
+        }
+        m_cond.notify_all();
+    }
+
+    /** Number of blocks queued and not yet taken by Next(). */
+    size_t Size()
+    {
+        LOCK(m_mutex);
+        return m_slots.size();
+    }
+
+    /**
+     * Wait until the first queued block has been read and take it off the
+     * queue. Must only be called while blocks are queued. Returns false if it
+     * is not block_hash.
+     */
+    bool Next(const uint256& block_hash, Result& result)
+    {
+        WAIT_LOCK(m_mutex, lock);
+        assert(!m_slots.empty());
+        m_cond.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_slots.front().done; });
+        const bool match = m_slots.front().block_hash == block_hash;
+        result = std::move(m_slots.front().result);
+        m_slots.pop_front();
+        ++m_first;
+        return match;
+    }
+
+private:
+    struct Slot {
+        uint256 block_hash;
+        Optional<bool> filter_match;
+        bool done{false};
+        Result result;
+    };
+
+    interfaces::Chain& m_chain;
+    Mutex m_mutex;
+    std::condition_variable m_cond;
+    //! Queued blocks, in order. m_first is the sequence number of the first one.
+    std::deque<Slot> m_slots GUARDED_BY(m_mutex);
+    uint64_t m_first GUARDED_BY(m_mutex){0};
+    //! Sequence number of the next block to hand to a reading thread.
+    uint64_t m_next GUARDED_BY(m_mutex){0};
+    bool m_stop GUARDED_BY(m_mutex){false};
+    std::vector<std::thread> m_threads;
+
+    void Run()
+    {
+        WAIT_LOCK(m_mutex, lock);
+        while (true) {
+            m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_stop || m_next < m_first + m_slots.size(); });
+            if (m_stop) return;
+
+            const uint64_t n = m_next++;
+            const uint256 block_hash = m_slots[n - m_first].block_hash;
+            const bool filtered = m_slots[n - m_first].filter_match == Optional<bool>(false);
+            Result result;
+            result.scripts = m_slots[n - m_first].result.scripts;
+            {
+                REVERSE_LOCK(lock);
+                if (filtered) {
+                    result.status = Result::Status::FILTERED;
+                } else if (m_chain.findBlock(block_hash, FoundBlock().data(result.block)) && !result.block.IsNull()) {
+                    result.status = Result::Status::READ;
+                    if (result.scripts) {
+                        result.pays_to_wallet.reserve(result.block.vtx.size());
+                        for (const CTransactionRef& tx : result.block.vtx) {
+                            result.pays_to_wallet.push_back(WalletRescanScripts::PaysTo(*tx, *result.scripts));
+                        }
+                    }
+                }
+            }
+            // Blocks are only taken off the queue once read, so the slot is still there.
+            Slot& slot = m_slots[n - m_first];
+            slot.result = std::move(result);
+            slot.done = true;
+            m_cond.notify_all();
+        }
+    }
+};
+
+} // namespace
+
 /**
  * Scan the block chain (starting in start_block) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1761,6 +2228,12 @@ int64_t CWallet::RescanFromTime(int64_t startTime, const WalletRescanReserver& r
  * @param[in] max_height  Optional max scanning height. If unset there is
  *                        no maximum and scanning can continue to the tip
  *
+ * Blocks are read ahead on several threads. For descriptor wallets the
+ * threads also match the transactions against the wallet's scripts, so
+ * only the matching ones are synced, and, if -blockfilterindex is enabled,
+ * skip blocks whose filter matches none of the wallet's scripts without
+ * reading them from disk.
+ *
  * @return ScanResult returning scan information and indicating success or
  *         failure. Return status will be set to SUCCESS if scan was
  *         successful. FAILURE if a complete rescan was not possible (due to
@@ -1792,55 +2265,144 @@ CWallet::ScanResult CWallet::ScanForWalletTransactions(const uint256& start_bloc
     double progress_end = chain().guessVerificationProgress(end_hash);
     double progress_current = progress_begin;
     int block_height = start_height;
-    while (!fAbortRescan && !chain().shutdownRequested()) {
-        if (progress_end - progress_begin > 0.0) {
-            m_scanning_progress = (progress_current - progress_begin) / (progress_end - progress_begin);
-        } else { // avoid divide-by-zero for single block scan range (i.e. start and stop hashes are equal)
-            m_scanning_progress = 0;
-        }
-        if (block_height % 100 == 0 && progress_end - progress_begin > 0.0) {
-            ShowProgress(strprintf("%s " + _("Rescanning...").translated, GetDisplayName()), std::max(1, std::min(99, (int)(m_scanning_progress * 100))));
-        }
-        if (GetTime() >= nNow + 60) {
-            nNow = GetTime();
-            WalletLogPrintf("Still rescanning. At block %d. Progress=%f\n", block_height, progress_current);
-        }
+    std::unique_ptr<WalletRescanScripts> rescan_scripts;
+    if (!IsLegacy()) rescan_scripts = WITH_LOCK(cs_wallet, return MakeUnique<WalletRescanScripts>(*this));
+    const bool use_filters = rescan_scripts && chain().hasBlockFilterIndex(BlockFilterType::BASIC);
+    const int read_threads = std::max(1, std::min(GetNumCores(), MAX_RESCAN_READ_THREADS));
+    RescanBlockReader reader(chain(), read_threads);
+    // Last block queued to be read ahead
+    uint256 read_hash;
+    int read_height = 0;
+    int skipped_blocks = 0;
+    const int batch_blocks = std::max<int64_t>(1, gArgs.GetArg("-rescanbatchblocks", DEFAULT_RESCAN_BATCH_BLOCKS));
+    bool scanning = true;
+    while (scanning && !fAbortRescan && !chain().shutdownRequested()) {
+        // Scan a chunk of blocks while holding cs_wallet, so that the chunk's
+        // database transaction is committed before any other wallet code can
+        // write, and never takes in or delays writes of its own.
+        LOCK(cs_wallet);
+        BeginWriteBatch();
+        const uint256 chunk_last_scanned_block = result.last_scanned_block;
+        const Optional<int> chunk_last_scanned_height = result.last_scanned_height;
+        for (int chunk_blocks = 0; chunk_blocks < batch_blocks && !fAbortRescan && !chain().shutdownRequested(); ++chunk_blocks) {
+            if (progress_end - progress_begin > 0.0) {
+                m_scanning_progress = (progress_current - progress_begin) / (progress_end - progress_begin);
+            } else { // avoid divide-by-zero for single block scan range (i.e. start and stop hashes are equal)
+                m_scanning_progress = 0;
+            }
+            if (block_height % 100 == 0 && progress_end - progress_begin > 0.0) {
+                ShowProgress(strprintf("%s " + _("Rescanning...").translated, GetDisplayName()), std::max(1, std::min(99, (int)(m_scanning_progress * 100))));
+            }
+            if (GetTime() >= nNow + 60) {
+                nNow = GetTime();
+                WalletLogPrintf("Still rescanning. At block %d. Progress=%f\n", block_height, progress_current);
+            }
 
-        CBlock block;
-        bool next_block;
-        uint256 next_block_hash;
-        bool reorg = false;
-        if (chain().findBlock(block_hash, FoundBlock().data(block)) && !block.IsNull()) {
-            LOCK(cs_wallet);
-            next_block = chain().findNextBlock(block_hash, block_height, FoundBlock().hash(next_block_hash), &reorg);
-            if (reorg) {
-                // Abort scan if current block is no longer active, to prevent
-                // marking transactions as coming from the wrong block.
-                // TODO: This should return success instead of failure, see
-                // https://github.com/bitcoin/bitcoin/pull/14711#issuecomment-458342518
+            // Read ahead along the active chain. Should it change meanwhile, the
+            // blocks queued no longer follow on and are dropped. The queue is
+            // refilled once half empty, so that the block filters of the blocks
+            // added are matched in one batch, and a block is read unless
+            // its filter rules it out. Should the filter be missing, e.g. while
+            // the index is still syncing, the block is read.
+            const WalletRescanScripts::Snapshot scripts = rescan_scripts ? rescan_scripts->Get() : nullptr;
+            const size_t queued = reader.Size();
+            if (queued <= RESCAN_READ_AHEAD / 2) {
+                std::vector<uint256> read_hashes;
+                if (queued == 0) {
+                    read_hashes.push_back(block_hash);
+                    read_hash = block_hash;
+                    read_height = block_height;
+                }
+                uint256 next_read_hash;
+                bool read_reorg = false;
+                while (queued + read_hashes.size() < RESCAN_READ_AHEAD && !(max_height && read_height >= *max_height) &&
+                       chain().findNextBlock(read_hash, read_height, FoundBlock().hash(next_read_hash), &read_reorg) && !read_reorg) {
+                    read_hashes.push_back(next_read_hash);
+                    read_hash = next_read_hash;
+                    ++read_height;
+                }
+                std::vector<Optional<bool>> filter_matches(read_hashes.size());
+                if (use_filters && !read_hashes.empty()) {
+                    filter_matches = chain().blockFiltersMatchAny(BlockFilterType::BASIC, read_hashes, *scripts, read_threads);
+                }
+                for (size_t i = 0; i < read_hashes.size(); ++i) {
+                    reader.Add(read_hashes[i], scripts, filter_matches[i]);
+                }
+            }
+            RescanBlockReader::Result read;
+            if (!reader.Next(block_hash, read)) {
+                while (reader.Size() > 0) reader.Next(block_hash, read);
+                reader.Add(block_hash, scripts);
+                read_hash = block_hash;
+                read_height = block_height;
+                reader.Next(block_hash, read);
+            }
+            // Descriptors topped up since the block was read may match transactions
+            // the snapshot did not.
+            const bool scripts_current = rescan_scripts && read.scripts == rescan_scripts->Get();
+            if (read.status == RescanBlockReader::Result::Status::FILTERED && !scripts_current) {
+                if (chain().blockFilterMatchesAny(BlockFilterType::BASIC, block_hash, *rescan_scripts->Get()) != Optional<bool>(false)) {
+                    read.status = chain().findBlock(block_hash, FoundBlock().data(read.block)) && !read.block.IsNull() ? RescanBlockReader::Result::Status::READ : RescanBlockReader::Result::Status::FAILED;
+                }
+            }
+
+            const CBlock& block = read.block;
+            bool next_block;
+            uint256 next_block_hash;
+            bool reorg = false;
+            if (read.status == RescanBlockReader::Result::Status::FILTERED) {
+                next_block = chain().findNextBlock(block_hash, block_height, FoundBlock().hash(next_block_hash), &reorg);
+                if (reorg) {
+                    result.last_failed_block = block_hash;
+                    result.status = ScanResult::FAILURE;
+                    scanning = false;
+                    break;
+                }
+                ++skipped_blocks;
+                result.last_scanned_block = block_hash;
+                result.last_scanned_height = block_height;
+            } else if (read.status == RescanBlockReader::Result::Status::READ) {
+                next_block = chain().findNextBlock(block_hash, block_height, FoundBlock().hash(next_block_hash), &reorg);
+                if (reorg) {
+                    // Abort scan if current block is no longer active, to prevent
+                    // marking transactions as coming from the wrong block.
+                    // TODO: This should return success instead of failure, see
+                    // https://github.com/bitcoin/bitcoin/pull/14711#issuecomment-458342518
+                    result.last_failed_block = block_hash;
+                    result.status = ScanResult::FAILURE;
+                    scanning = false;
+                    break;
+                }
+                // Transactions matched by the reader threads are exact until one of
+                // them tops up the wallet's descriptors, from then on all are synced.
+                bool matched = scripts_current;
+                for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
+                    const CTransactionRef& tx = block.vtx[posInBlock];
+                    if (matched && !read.pays_to_wallet[posInBlock] && !MayInvolveWallet(*tx)) continue;
+                    SyncTransaction(tx, {CWalletTx::Status::CONFIRMED, block_height, block_hash, (int)posInBlock}, fUpdate);
+                    if (matched) {
+                        rescan_scripts->Update();
+                        matched = read.scripts == rescan_scripts->Get();
+                    }
+                }
+                // scan succeeded, record block as most recent successfully scanned
+                result.last_scanned_block = block_hash;
+                result.last_scanned_height = block_height;
+            } else {
+                // could not scan block, keep scanning but record this block as the most recent failure
                 result.last_failed_block = block_hash;
                 result.status = ScanResult::FAILURE;
-                break;
+                next_block = chain().findNextBlock(block_hash, block_height, FoundBlock().hash(next_block_hash), &reorg);
             }
-            for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
-                SyncTransaction(block.vtx[posInBlock], {CWalletTx::Status::CONFIRMED, block_height, block_hash, (int)posInBlock}, fUpdate);
+            if (rescan_scripts) rescan_scripts->Update();
+            if (max_height && block_height >= *max_height) {
+                scanning = false;
+                break;
             }
-            // scan succeeded, record block as most recent successfully scanned
-            result.last_scanned_block = block_hash;
-            result.last_scanned_height = block_height;
-        } else {
-            // could not scan block, keep scanning but record this block as the most recent failure
-            result.last_failed_block = block_hash;
-            result.status = ScanResult::FAILURE;
-            next_block = chain().findNextBlock(block_hash, block_height, FoundBlock().hash(next_block_hash), &reorg);
-        }
-        if (max_height && block_height >= *max_height) {
-            break;
-        }
-        {
             if (!next_block || reorg) {
                 // break successfully when rescan has reached the tip, or
                 // previous block is no longer on the chain due to a reorg
+                scanning = false;
                 break;
             }
 
@@ -1851,12 +2413,20 @@ CWallet::ScanResult CWallet::ScanForWalletTransactions(const uint256& start_bloc
 
             // handle updated tip hash
             const uint256 prev_tip_hash = tip_hash;
-            tip_hash = WITH_LOCK(cs_wallet, return GetLastBlockHash());
+            tip_hash = GetLastBlockHash();
             if (!max_height && prev_tip_hash != tip_hash) {
                 // in case the tip has changed, update progress max
                 progress_end = chain().guessVerificationProgress(tip_hash);
             }
         }
+        if (!CommitWriteBatch()) {
+            // The transactions found in this chunk are not on disk.
+            result.last_scanned_block = chunk_last_scanned_block;
+            result.last_scanned_height = chunk_last_scanned_height;
+            result.last_failed_block = block_hash;
+            result.status = ScanResult::FAILURE;
+            break;
+        }
     }
     ShowProgress(strprintf("%s " + _("Rescanning...").translated, GetDisplayName()), 100); // hide progress dialog in GUI
     if (block_height && fAbortRescan) {
@@ -1868,6 +2438,9 @@ CWallet::ScanResult CWallet::ScanForWalletTransactions(const uint256& start_bloc
     } else {
         WalletLogPrintf("Rescan completed in %15dms\n", GetTimeMillis() - start_time);
     }
+    if (use_filters) {
+        WalletLogPrintf("Rescan skipped %d blocks not matching the wallet's block filters\n", skipped_blocks);
+    }
     return result;
 }
 
@@ -1899,7 +2472,9 @@ void CWallet::ReacceptWalletTransactions()
     for (const std::pair<const int64_t, CWalletTx*>& item : mapSorted) {
         CWalletTx& wtx = *(item.second);
         std::string unused_err_string;
-        wtx.SubmitMemoryPoolAndRelay(unused_err_string, false);
+        if (wtx.SubmitMemoryPoolAndRelay(unused_err_string, false)) {
+            UpdateBalanceContributions(wtx);
+        }
     }
 }
 
@@ -2138,7 +2713,10 @@ void CWallet::ResendWalletTransactions()
             // any confirmed or conflicting txs.
             if (wtx.nTimeReceived > m_best_block_time - 5 * 60) continue;
             std::string unused_err_string;
-            if (wtx.SubmitMemoryPoolAndRelay(unused_err_string, true)) ++submitted_tx_count;
+            if (wtx.SubmitMemoryPoolAndRelay(unused_err_string, true)) {
+                ++submitted_tx_count;
+                UpdateBalanceContributions(wtx);
+            }
         }
     } // cs_wallet
 
@@ -2175,38 +2753,175 @@ void AbandonOrphanedCoinStakes()
 }
 
 
+void MaybeConsolidateStakeCoins()
+{
+    for (const std::shared_ptr<CWallet>& pwallet : GetWallets()) {
+        if (!pwallet->m_stake_consolidate || pwallet->IsWalletFlagSet(WALLET_FLAG_DISABLE_PRIVATE_KEYS)) continue;
+        TRY_LOCK(pwallet->cs_wallet, locked_wallet);
+        if (!locked_wallet || pwallet->IsLocked()) continue;
+
+        const StakeConsolidationPlan plan = pwallet->PlanStakeConsolidation();
+        if (plan.consolidations.empty()) continue;
+        if (!plan.fee_ok) {
+            pwallet->WalletLogPrintf("Postponing the merging of small outputs, fee rate %s is above %s\n",
+                plan.feerate.ToString(), pwallet->m_stake_consolidate_max_fee.ToString());
+            continue;
+        }
+        const size_t count = pwallet->ConsolidateStakeCoins(plan);
+        pwallet->WalletLogPrintf("Merged small outputs in %u of %u transactions\n", count, plan.consolidations.size());
+    }
+}
+
+
 /** @defgroup Actions
  *
  * @{
  */
 
 
-CWallet::Balance CWallet::GetBalance(const int min_depth, bool avoid_reuse) const
+static void AddBalance(CWallet::Balance& total, const CWallet::Balance& amounts, int sign)
+{
+    total.m_mine_trusted += sign * amounts.m_mine_trusted;
+    total.m_mine_untrusted_pending += sign * amounts.m_mine_untrusted_pending;
+    total.m_mine_immature += sign * amounts.m_mine_immature;
+    total.m_watchonly_trusted += sign * amounts.m_watchonly_trusted;
+    total.m_watchonly_untrusted_pending += sign * amounts.m_watchonly_untrusted_pending;
+    total.m_watchonly_immature += sign * amounts.m_watchonly_immature;
+}
+
+CWallet::Balance CWallet::GetBalanceContribution(const CWalletTx& wtx, int min_depth, bool avoid_reuse, std::set<uint256>& trusted_parents) const
 {
+    AssertLockHeld(cs_wallet);
     Balance ret;
     isminefilter reuse_filter = avoid_reuse ? ISMINE_NO : ISMINE_USED;
-    {
-        LOCK(cs_wallet);
-        std::set<uint256> trusted_parents;
-        for (const auto& entry : mapWallet)
-        {
-            const CWalletTx& wtx = entry.second;
-            const bool is_trusted{IsTrusted(wtx, trusted_parents)};
-            const int tx_depth{wtx.GetDepthInMainChain()};
-            const CAmount tx_credit_mine{wtx.GetAvailableCredit(/* fUseCache */ true, ISMINE_SPENDABLE | reuse_filter)};
-            const CAmount tx_credit_watchonly{wtx.GetAvailableCredit(/* fUseCache */ true, ISMINE_WATCH_ONLY | reuse_filter)};
-            if (is_trusted && tx_depth >= min_depth) {
-                ret.m_mine_trusted += tx_credit_mine;
-                ret.m_watchonly_trusted += tx_credit_watchonly;
+    const bool is_trusted{IsTrusted(wtx, trusted_parents)};
+    const int tx_depth{wtx.GetDepthInMainChain()};
+    const CAmount tx_credit_mine{wtx.GetAvailableCredit(/* fUseCache */ true, ISMINE_SPENDABLE | reuse_filter)};
+    const CAmount tx_credit_watchonly{wtx.GetAvailableCredit(/* fUseCache */ true, ISMINE_WATCH_ONLY | reuse_filter)};
+    if (is_trusted && tx_depth >= min_depth) {
+        ret.m_mine_trusted += tx_credit_mine;
+        ret.m_watchonly_trusted += tx_credit_watchonly;
+    }
+    if (!is_trusted && tx_depth == 0 && wtx.InMempool()) {
+        ret.m_mine_untrusted_pending += tx_credit_mine;
+        ret.m_watchonly_untrusted_pending += tx_credit_watchonly;
+    }
+    ret.m_mine_immature += wtx.GetImmatureCredit();
+    ret.m_watchonly_immature += wtx.GetImmatureWatchOnlyCredit();
+    return ret;
+}
+
+void CWallet::UpdateBalanceContribution(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (!m_balance_totals_valid) return;
+
+    const uint256& hash = wtx.GetHash();
+    std::set<uint256> trusted_parents;
+    BalanceContribution& cached = m_balance_contributions[hash];
+    AddBalance(m_balance_totals, cached.amounts, -1);
+    cached.amounts = GetBalanceContribution(wtx, /* min_depth */ 0, /* avoid_reuse */ true, trusted_parents);
+    AddBalance(m_balance_totals, cached.amounts, 1);
+
+    const int depth = wtx.GetDepthInMainChain();
+    if (depth == 0 && wtx.InMempool()) {
+        m_balance_mempool_txs.insert(hash);
+    } else {
+        m_balance_mempool_txs.erase(hash);
+    }
+
+    const int coinbase_height = (wtx.IsCoinBase() || wtx.IsCoinStake()) && depth > 0 ? wtx.m_confirm.block_height : -1;
+    if (coinbase_height != cached.coinbase_height) {
+        if (cached.coinbase_height >= 0) {
+            auto range = m_balance_coinbases.equal_range(cached.coinbase_height);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second == hash) {
+                    m_balance_coinbases.erase(it);
+                    break;
+                }
             }
-            if (!is_trusted && tx_depth == 0 && wtx.InMempool()) {
-                ret.m_mine_untrusted_pending += tx_credit_mine;
-                ret.m_watchonly_untrusted_pending += tx_credit_watchonly;
+        }
+        if (coinbase_height >= 0) m_balance_coinbases.emplace(coinbase_height, hash);
+        cached.coinbase_height = coinbase_height;
+    }
+}
+
+void CWallet::UpdateBalanceContributions(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (!m_balance_totals_valid) return;
+
+    // Spending an output changes the available credit of the transaction that created it
+    MarkInputsDirty(wtx.tx);
+    for (const CTxIn& txin : wtx.tx->vin) {
+        const auto it = mapWallet.find(txin.prevout.hash);
+        if (it != mapWallet.end()) UpdateBalanceContribution(it->second);
+    }
+
+    // Whether an unconfirmed transaction is trusted depends on its parents
+    std::set<uint256> todo{wtx.GetHash()};
+    std::set<uint256> done;
+    while (!todo.empty()) {
+        const uint256 now = *todo.begin();
+        todo.erase(todo.begin());
+        done.insert(now);
+        const auto it = mapWallet.find(now);
+        if (it == mapWallet.end()) continue;
+        UpdateBalanceContribution(it->second);
+        for (auto iter = mapTxSpends.lower_bound(COutPoint(now, 0)); iter != mapTxSpends.end() && iter->first.hash == now; ++iter) {
+            const auto child = mapWallet.find(iter->second);
+            if (child != mapWallet.end() && child->second.GetDepthInMainChain() == 0 && !done.count(iter->second)) {
+                todo.insert(iter->second);
             }
-            ret.m_mine_immature += wtx.GetImmatureCredit();
-            ret.m_watchonly_immature += wtx.GetImmatureWatchOnlyCredit();
         }
     }
+}
+
+void CWallet::UpdateTipDependentBalances(int height)
+{
+    AssertLockHeld(cs_wallet);
+    if (!m_balance_totals_valid) return;
+
+    std::vector<uint256> txids(m_balance_mempool_txs.begin(), m_balance_mempool_txs.end());
+    const auto range = m_balance_coinbases.equal_range(height - COINBASE_MATURITY);
+    for (auto it = range.first; it != range.second; ++it) {
+        txids.push_back(it->second);
+    }
+    for (const uint256& hash : txids) {
+        const auto it = mapWallet.find(hash);
+        if (it != mapWallet.end()) UpdateBalanceContribution(it->second);
+    }
+}
+
+void CWallet::InvalidateBalanceTotals()
+{
+    AssertLockHeld(cs_wallet);
+    m_balance_totals_valid = false;
+    m_balance_totals = Balance();
+    m_balance_contributions.clear();
+    m_balance_mempool_txs.clear();
+    m_balance_coinbases.clear();
+}
+
+CWallet::Balance CWallet::GetBalance(const int min_depth, bool avoid_reuse) const
+{
+    LOCK(cs_wallet);
+    // The default balance is kept up to date incrementally.
+    if (min_depth == 0 && avoid_reuse) {
+        if (!m_balance_totals_valid) {
+            m_balance_totals_valid = true;
+            for (const auto& entry : mapWallet) {
+                UpdateBalanceContribution(entry.second);
+            }
+        }
+        return m_balance_totals;
+    }
+
+    Balance ret;
+    std::set<uint256> trusted_parents;
+    for (const auto& entry : mapWallet) {
+        AddBalance(ret, GetBalanceContribution(entry.second, min_depth, avoid_reuse, trusted_parents), 1);
+    }
     return ret;
 }
 
@@ -2236,21 +2951,38 @@ void CWallet::AvailableCoins(std::vector<COutput>& vCoins, bool fOnlySafe, const
     bool allow_used_addresses = !IsWalletFlagSet(WALLET_FLAG_AVOID_REUSE) || (coinControl && !coinControl->m_avoid_address_reuse);
     const int min_depth = {coinControl ? coinControl->m_min_depth : DEFAULT_MIN_DEPTH};
     const int max_depth = {coinControl ? coinControl->m_max_depth : DEFAULT_MAX_DEPTH};
+    const int tip_height = m_last_block_processed_height;
 
+    UpdateWalletUTXOIndex();
     std::set<uint256> trusted_parents;
-    for (const auto& entry : mapWallet)
+    // Only outputs that are ours and not spent by a confirmed transaction are
+    // considered. They are ordered by txid, so the checks that apply to whole
+    // transactions are done once per transaction.
+    auto utxo_it = m_wallet_utxos.begin();
+    while (utxo_it != m_wallet_utxos.end())
     {
-        const uint256& wtxid = entry.first;
-        const CWalletTx& wtx = entry.second;
+        const uint256 wtxid = utxo_it->first.hash;
+        const auto utxo_begin = utxo_it;
+        while (utxo_it != m_wallet_utxos.end() && utxo_it->first.hash == wtxid) ++utxo_it;
+        const auto utxo_end = utxo_it;
+
+        const auto wtx_it = mapWallet.find(wtxid);
+        if (wtx_it == mapWallet.end()) {
+            WalletLogPrintf("%s: wallet output index refers to unknown transaction %s\n", __func__, wtxid.ToString());
+            continue;
+        }
+        const CWalletTx& wtx = wtx_it->second;
 
         if (!chain().checkFinalTx(*wtx.tx)) {
             continue;
         }
 
-        if (wtx.IsImmatureCoinBase())
+        // Same as GetDepthInMainChain, without looking up the tip height for every transaction.
+        const int nDepth = wtx.isUnconfirmed() || wtx.isAbandoned() ? 0 : (tip_height - wtx.m_confirm.block_height + 1) * (wtx.isConflicted() ? -1 : 1);
+        // Same as IsImmatureCoinBase
+        if ((wtx.IsCoinBase() || wtx.IsCoinStake()) && nDepth < COINBASE_MATURITY + 1)
             continue;
 
-        int nDepth = wtx.GetDepthInMainChain();
         if (nDepth < 0)
             continue;
 
@@ -2300,37 +3032,32 @@ void CWallet::AvailableCoins(std::vector<COutput>& vCoins, bool fOnlySafe, const
             continue;
         }
 
-        for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+        for (auto it = utxo_begin; it != utxo_end; ++it) {
+            const unsigned int i = it->first.n;
             // Only consider selected coins if add_inputs is false
-            if (coinControl && !coinControl->m_add_inputs && !coinControl->IsSelected(COutPoint(entry.first, i))) {
+            if (coinControl && !coinControl->m_add_inputs && !coinControl->IsSelected(it->first)) {
                 continue;
             }
 
             if (wtx.tx->vout[i].nValue < nMinimumAmount || wtx.tx->vout[i].nValue > nMaximumAmount)
                 continue;
 
-            if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(COutPoint(entry.first, i)))
+            if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(it->first))
                 continue;
 
-            if (IsLockedCoin(entry.first, i))
+            if (IsLockedCoin(wtxid, i))
                 continue;
 
             if (IsSpent(wtxid, i))
                 continue;
 
-            isminetype mine = IsMine(wtx.tx->vout[i]);
-
-            if (mine == ISMINE_NO) {
-                continue;
-            }
+            const isminetype mine = it->second.mine;
 
             if (!allow_used_addresses && IsSpentKey(wtxid, i)) {
                 continue;
             }
 
-            std::unique_ptr<SigningProvider> provider = GetSolvingProvider(wtx.tx->vout[i].scriptPubKey);
-
-            bool solvable = provider ? IsSolvable(*provider, wtx.tx->vout[i].scriptPubKey) : false;
+            const bool solvable = it->second.solvable;
             bool spendable = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) || (((mine & ISMINE_WATCH_ONLY) != ISMINE_NO) && (coinControl && coinControl->fAllowWatchOnly && solvable));
 
             vCoins.push_back(COutput(&wtx, i, nDepth, spendable, solvable, safeTx, (coinControl && coinControl->fAllowWatchOnly)));
@@ -2411,7 +3138,7 @@ const CTxOut& CWallet::FindNonChangeParentOutput(const CTransaction& tx, int out
     return ptx->vout[n];
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const CoinEligibilityFilter& eligibility_filter, std::vector<OutputGroup> groups,
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const CoinEligibilityFilter& eligibility_filter, const std::vector<OutputGroup>& groups,
                                  std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CoinSelectionParams& coin_selection_params, bool& bnb_used) const
 {
     setCoinsRet.clear();
@@ -2428,19 +3155,25 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const CoinEligibil
         // Calculate cost of change
         CAmount cost_of_change = GetDiscardRate(*this).GetFee(coin_selection_params.change_spend_size) + coin_selection_params.effective_fee.GetFee(coin_selection_params.change_output_size);
 
-        // Filter by the min conf specs and add to utxo_pool and calculate effective value
-        for (OutputGroup& group : groups) {
+        // Filter by the min conf specs and add to utxo_pool and calculate effective value. Each
+        // eligible group is copied once, the fees are set on the copy, and only the groups with
+        // outputs that don't pay for themselves are copied again without those outputs.
+        for (const OutputGroup& group : groups) {
             if (!group.EligibleForSpending(eligibility_filter)) continue;
 
+            utxo_pool.push_back(group);
+            OutputGroup& pool_group = utxo_pool.back();
             if (coin_selection_params.m_subtract_fee_outputs) {
                 // Set the effective feerate to 0 as we don't want to use the effective value since the fees will be deducted from the output
-                group.SetFees(CFeeRate(0) /* effective_feerate */, long_term_feerate);
+                pool_group.SetFees(CFeeRate(0) /* effective_feerate */, long_term_feerate);
             } else {
-                group.SetFees(coin_selection_params.effective_fee, long_term_feerate);
+                pool_group.SetFees(coin_selection_params.effective_fee, long_term_feerate);
             }
 
-            OutputGroup pos_group = group.GetPositiveOnlyGroup();
-            if (pos_group.effective_value > 0) utxo_pool.push_back(pos_group);
+            if (std::any_of(pool_group.m_outputs.begin(), pool_group.m_outputs.end(), [](const CInputCoin& coin) { return coin.effective_value <= 0; })) {
+                pool_group = pool_group.GetPositiveOnlyGroup();
+            }
+            if (pool_group.effective_value <= 0) utxo_pool.pop_back();
         }
         // Calculate the fees for things that aren't inputs
         CAmount not_input_fees = coin_selection_params.effective_fee.GetFee(coin_selection_params.tx_noinputs_size);
@@ -3227,6 +3960,7 @@ void CWallet::CommitTransaction(CTransactionRef tx, mapValue_t mapValue, std::ve
         WalletLogPrintf("CommitTransaction(): Transaction cannot be broadcast immediately, %s\n", err_string);
         // TODO: if we expect the failure to be long term or permanent, instead delete wtx from the wallet and return failure.
     }
+    UpdateBalanceContributions(wtx);
 }
 
 DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
@@ -3255,6 +3989,11 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
     if (nLoadWalletRet != DBErrors::LOAD_OK)
         return nLoadWalletRet;
 
+    // Otherwise the first AvailableCoins call builds m_wallet_utxos, once the
+    // keys and scripts transactions may have been loaded before are all known.
+    LoadWalletSummary();
+    m_write_summary_on_close = true;
+
     return DBErrors::LOAD_OK;
 }
 
@@ -3267,6 +4006,7 @@ DBErrors CWallet::ZapSelectTx(std::vector<uint256>& vHashIn, std::vector<uint256
         wtxOrdered.erase(it->second.m_it_wtxOrdered);
         for (const auto& txin : it->second.tx->vin)
             mapTxSpends.erase(txin.prevout);
+        RemoveWalletUTXOs(it->second);
         mapWallet.erase(it);
         NotifyTransactionChanged(this, hash, CT_DELETED);
     }
@@ -3424,11 +4164,13 @@ int64_t CWallet::GetOldestKeyPoolTime() const
 void CWallet::MarkDestinationsDirty(const std::set<CTxDestination>& destinations) {
     for (auto& entry : mapWallet) {
         CWalletTx& wtx = entry.second;
-        if (wtx.m_is_cache_empty) continue;
+        // Transactions counted in the balance totals depend on the used state even when their cache is empty
+        if (wtx.m_is_cache_empty && !m_balance_contributions.count(entry.first)) continue;
         for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
             CTxDestination dst;
             if (ExtractDestination(wtx.tx->vout[i].scriptPubKey, dst) && destinations.count(dst)) {
                 wtx.MarkDirty();
+                UpdateBalanceContribution(wtx);
                 break;
             }
         }
@@ -4045,6 +4787,29 @@ std::shared_ptr<CWallet> CWallet::Create(interfaces::Chain& chain, const std::st
     walletInstance->m_spend_zero_conf_change = gArgs.GetBoolArg("-spendzeroconfchange", DEFAULT_SPEND_ZEROCONF_CHANGE);
     walletInstance->m_signal_rbf = gArgs.GetBoolArg("-walletrbf", DEFAULT_WALLET_RBF);
 
+    walletInstance->m_stake_consolidate = gArgs.GetBoolArg("-stakeconsolidate", DEFAULT_STAKE_CONSOLIDATE);
+    walletInstance->m_stake_consolidate_count = std::max<int64_t>(1, gArgs.GetArg("-stakeconsolidatecount", DEFAULT_STAKE_CONSOLIDATE_COUNT));
+    if (gArgs.IsArgSet("-stakeconsolidatesize")) {
+        CAmount n = 0;
+        if (!ParseMoney(gArgs.GetArg("-stakeconsolidatesize", ""), n) || n <= 0) {
+            error = AmountErrMsg("stakeconsolidatesize", gArgs.GetArg("-stakeconsolidatesize", ""));
+            return nullptr;
+        }
+        walletInstance->m_stake_consolidate_size = n;
+    }
+    if (gArgs.IsArgSet("-stakeconsolidatemaxfee")) {
+        CAmount nFeePerK = 0;
+        if (!ParseMoney(gArgs.GetArg("-stakeconsolidatemaxfee", ""), nFeePerK)) {
+            error = AmountErrMsg("stakeconsolidatemaxfee", gArgs.GetArg("-stakeconsolidatemaxfee", ""));
+            return nullptr;
+        }
+        if (nFeePerK > HIGH_TX_FEE_PER_KB) {
+            warnings.push_back(AmountHighWarn("-stakeconsolidatemaxfee") + Untranslated(" ") +
+                               _("This is the highest fee rate the wallet pays to merge small staking outputs."));
+        }
+        walletInstance->m_stake_consolidate_max_fee = CFeeRate(nFeePerK);
+    }
+
     walletInstance->WalletLogPrintf("Wallet completed loading in %15dms\n", GetTimeMillis() - nStart);
 
     // Try to top up keypool. No-op if the wallet is locked.
@@ -4260,8 +5025,12 @@ std::vector<OutputGroup> CWallet::GroupOutputs(const std::vector<COutput>& outpu
             CTxDestination dst;
             CInputCoin input_coin = output.GetInputCoin();
 
-            size_t ancestors, descendants;
-            chain().getTransactionAncestry(output.tx->GetHash(), ancestors, descendants);
+            // Only unconfirmed transactions can be in the mempool, so the mempool is not looked
+            // up for the confirmed outputs that make up most of a large wallet.
+            size_t ancestors = 0, descendants = 0;
+            if (output.nDepth == 0) {
+                chain().getTransactionAncestry(output.tx->GetHash(), ancestors, descendants);
+            }
             if (!single_coin && ExtractDestination(output.tx->tx->vout[output.i].scriptPubKey, dst)) {
                 auto it = gmap.find(dst);
                 if (it != gmap.end()) {
@@ -4450,6 +5219,7 @@ void CWallet::SetupLegacyScriptPubKeyMan()
         m_external_spk_managers[type] = spk_manager.get();
     }
     m_spk_managers[spk_manager->GetID()] = std::move(spk_manager);
+    NotifyIsMineChanged();
 }
 
 const CKeyingMaterial& CWallet::GetEncryptionKey() const
@@ -4474,6 +5244,7 @@ void CWallet::LoadDescriptorScriptPubKeyMan(uint256 id, WalletDescriptor& desc)
 {
     auto spk_manager = std::unique_ptr<ScriptPubKeyMan>(new DescriptorScriptPubKeyMan(*this, desc));
     m_spk_managers[id] = std::move(spk_manager);
+    NotifyIsMineChanged();
 }
 
 void CWallet::SetupDescriptorScriptPubKeyMans()
@@ -4504,6 +5275,7 @@ void CWallet::SetupDescriptorScriptPubKeyMans()
             spk_manager->SetupDescriptorGeneration(master_key, t);
             uint256 id = spk_manager->GetID();
             m_spk_managers[id] = std::move(spk_manager);
+            NotifyIsMineChanged();
             AddActiveScriptPubKeyMan(id, t, internal);
         }
     }
@@ -4619,6 +5391,7 @@ ScriptPubKeyMan* CWallet::AddWalletDescriptor(WalletDescriptor& desc, const Flat
     // Save the descriptor to memory
     auto ret = new_spk_man.get();
     m_spk_managers[new_spk_man->GetID()] = std::move(new_spk_man);
+    NotifyIsMineChanged();
 
     // Save the descriptor to DB
     ret->WriteDescriptor();
@@ -4648,7 +5421,194 @@ bool CWallet::SelectStakeCoins(std::set<CInputCoin>& setCoins) const
     return true;
 }
 
+StakeConsolidationPlan CWallet::PlanStakeConsolidation() const
+{
+    AssertLockHeld(cs_wallet);
+
+    StakeConsolidationPlan plan;
+    CCoinControl coin_control;
+    coin_control.m_min_depth = 1;
+    std::vector<COutput> coins;
+    AvailableCoins(coins, true, &coin_control);
+
+    const Consensus::Params& consensus = Params().GetConsensus();
+    const int next_height = GetLastBlockHeight() + 1;
+    const int params_index = next_height >= consensus.nMandatoryUpgradeBlock ? 1 : 0;
+    const int64_t stake_min_age = consensus.nStakeMinAge[params_index];
+    const int stake_min_depth = consensus.nStakeMinDepth[params_index];
+    const int64_t now = GetTime();
+    std::map<uint256, int64_t> block_times;
+    std::map<CScript, std::vector<const COutput*>> candidates;
+    for (const COutput& out : coins) {
+        if (!out.fSpendable) continue;
+        ++plan.utxo_count;
+        const CTxOut& txout = out.tx->tx->vout[out.i];
+        if (txout.nValue >= m_stake_consolidate_size) continue;
+        // Merging an output resets its age and depth, which the kernel counts
+        // from the block that confirmed it. Outputs past half of the way to
+        // both stake minimums are left to become eligible for staking instead,
+        // while outputs already eligible are merged like young ones.
+        const uint256& block_hash = out.tx->m_confirm.hashBlock;
+        auto block_time = block_times.find(block_hash);
+        if (block_time == block_times.end()) {
+            int64_t time = now;
+            chain().findBlock(block_hash, FoundBlock().time(time));
+            block_time = block_times.emplace(block_hash, time).first;
+        }
+        const int64_t age = now - block_time->second;
+        if (age >= stake_min_age / 2 && out.nDepth >= stake_min_depth / 2 &&
+            (age < stake_min_age || out.nDepth < stake_min_depth)) {
+            ++plan.maturing_count;
+            continue;
+        }
+        candidates[txout.scriptPubKey].push_back(&out);
+    }
+
+    coin_control.m_confirm_target = chain().estimateMaxBlocks();
+    plan.feerate = GetMinimumFeeRate(*this, coin_control, nullptr);
+    plan.fee_ok = plan.feerate <= m_stake_consolidate_max_fee;
+    if (plan.utxo_count <= m_stake_consolidate_count) return plan;
+    size_t excess = plan.utxo_count - m_stake_consolidate_count;
+
+    // Outputs are only merged with outputs paying to the same script, so that
+    // no addresses are linked, starting with the scripts with the most outputs.
+    typedef std::map<CScript, std::vector<const COutput*>>::iterator CandidateIt;
+    std::vector<CandidateIt> groups;
+    for (CandidateIt it = candidates.begin(); it != candidates.end(); ++it) {
+        groups.push_back(it);
+    }
+    std::stable_sort(groups.begin(), groups.end(), [](const CandidateIt& a, const CandidateIt& b) {
+        return a->second.size() > b->second.size();
+    });
+    for (const CandidateIt& group : groups) {
+        std::vector<const COutput*>& outputs = group->second;
+        std::sort(outputs.begin(), outputs.end(), [](const COutput* a, const COutput* b) {
+            return a->tx->tx->vout[a->i].nValue < b->tx->tx->vout[b->i].nValue;
+        });
+        StakeConsolidation consolidation;
+        for (size_t i = 0; i < outputs.size() && excess > 0; ++i) {
+            consolidation.inputs.emplace_back(outputs[i]->tx->GetHash(), outputs[i]->i);
+            consolidation.amount += outputs[i]->tx->tx->vout[outputs[i]->i].nValue;
+            if (consolidation.amount < m_stake_consolidate_size && consolidation.inputs.size() < MAX_STAKE_CONSOLIDATE_INPUTS &&
+                consolidation.inputs.size() - 1 < excess && i + 1 < outputs.size()) {
+                continue;
+            }
+            if (consolidation.inputs.size() > 1) {
+                excess -= consolidation.inputs.size() - 1;
+                consolidation.script = group->first;
+                plan.consolidations.push_back(std::move(consolidation));
+            }
+            consolidation = StakeConsolidation();
+        }
+        if (excess == 0) break;
+    }
+    return plan;
+}
+
+size_t CWallet::ConsolidateStakeCoins(const StakeConsolidationPlan& plan)
+{
+    AssertLockHeld(cs_wallet);
+
+    size_t count = 0;
+    for (const StakeConsolidation& consolidation : plan.consolidations) {
+        CCoinControl coin_control;
+        coin_control.fAllowOtherInputs = false;
+        coin_control.m_feerate = plan.feerate;
+        for (const COutPoint& outpoint : consolidation.inputs) {
+            coin_control.Select(outpoint);
+        }
+        const std::vector<CRecipient> recipients{{consolidation.script, consolidation.amount, true /* fSubtractFeeFromAmount */}};
+        CTransactionRef tx;
+        CAmount fee;
+        int change_pos = -1;
+        bilingual_str error;
+        FeeCalculation fee_calc;
+        if (!CreateTransaction(recipients, tx, fee, change_pos, error, coin_control, fee_calc)) {
+            WalletLogPrintf("%s: failed to merge %u outputs: %s\n", __func__, consolidation.inputs.size(), error.original);
+            continue;
+        }
+        CommitTransaction(tx, {}, {});
+        ++count;
+    }
+    return count;
+}
+
 // peercoin: sign block
+StakeSigningInfo CWallet::GetStakeSigningInfo(const CScript& script) const
+{
+    AssertLockHeld(cs_wallet);
+    if (m_stake_signing_cache_dirty.exchange(false)) {
+        m_stake_signing_cache.clear();
+        m_block_signing_spk_mans.clear();
+    }
+    auto it = m_stake_signing_cache.find(script);
+    if (it != m_stake_signing_cache.end()) return it->second;
+
+    StakeSigningInfo& info = m_stake_signing_cache[script];
+    std::vector<std::vector<unsigned char>> vSolutions;
+    info.script_type = info.type = Solver(script, vSolutions);
+    std::unique_ptr<SigningProvider> provider = GetSolvingProvider(script);
+
+    if (info.script_type == TxoutType::SCRIPTHASH || info.script_type == TxoutType::WITNESS_V0_SCRIPTHASH) {
+        // only p2sh-p2wpkh and p2sh/p2wsh-multisig are supported
+        CScript subscript;
+        uint160 hash;
+        if (info.script_type == TxoutType::WITNESS_V0_SCRIPTHASH) {
+            CRIPEMD160 hasher;
+            hasher.Write(&vSolutions[0][0], 32).Finalize(hash.begin());
+        } else // info.script_type == TxoutType::SCRIPTHASH
+            hash = uint160(vSolutions[0]);
+        if (!provider || !provider->GetCScript(CScriptID(hash), subscript))
+            return info;
+        info.type = Solver(subscript, vSolutions);
+        if (info.type != TxoutType::WITNESS_V0_KEYHASH && info.type != TxoutType::MULTISIG)
+            return info;
+    }
+
+    if (info.type == TxoutType::PUBKEY) {
+        info.pubkey = CPubKey(vSolutions[0]);
+    } else if (info.type == TxoutType::PUBKEYHASH || info.type == TxoutType::WITNESS_V0_KEYHASH) {
+        if (!provider || !provider->GetPubKey(CKeyID(uint160(vSolutions[0])), info.pubkey))
+            return info;
+    } else if (info.type == TxoutType::MULTISIG) {
+        // only single pubkey multisig is supported, except behind p2sh/p2wsh
+        if (vSolutions.size() == 3 && vSolutions.front()[0] == 1 && vSolutions.back()[0] == 1)
+            info.pubkey = CPubKey(vSolutions[1]);
+        if (info.script_type == TxoutType::MULTISIG && !info.pubkey.IsValid())
+            return info;
+    } else {
+        return info;
+    }
+    info.can_sign = true;
+    return info;
+}
+
+void CWallet::PrepareStakeSigning(const std::set<CInputCoin>& coins)
+{
+    AssertLockHeld(cs_wallet);
+    for (const CInputCoin& coin : coins) {
+        GetStakeSigningInfo(coin.txout.scriptPubKey);
+    }
+    if (!m_stake_destination && gArgs.GetBoolArg("-quantumsafestaking", false)) {
+        CTxDestination dest;
+        std::string error;
+        if (GetNewChangeDestination(OutputType::BECH32, dest, error)) {
+            m_stake_destination = dest;
+        }
+    }
+}
+
+bool CWallet::GetStakeDestination(CTxDestination& dest, std::string& error)
+{
+    AssertLockHeld(cs_wallet);
+    if (m_stake_destination) {
+        dest = *m_stake_destination;
+        m_stake_destination = nullopt;
+        return true;
+    }
+    return GetNewChangeDestination(OutputType::BECH32, dest, error);
+}
+
 bool CWallet::GetBlockSigningPubKey(const CBlock& block, CPubKey& pubkey, bool& pubkeyInSig) const
 {
     AssertLockHeld(cs_wallet);
@@ -4667,40 +5627,13 @@ bool CWallet::GetBlockSigningPubKey(const CBlock& block, CPubKey& pubkey, bool&
     } else {
         scriptPubKey = txout.scriptPubKey;
     }
-    TxoutType whichType = Solver(scriptPubKey, vSolutions);
-
-    if (whichType == TxoutType::PUBKEY) {
-        pubkey = CPubKey(vSolutions[0]);
-    } else if (whichType == TxoutType::PUBKEYHASH || whichType == TxoutType::WITNESS_V0_KEYHASH) {
-        std::unique_ptr<SigningProvider> provider = GetSolvingProvider(scriptPubKey);
-        if (!provider || !provider->GetPubKey(CKeyID(uint160(vSolutions[0])), pubkey))
-            return false;
-    } else if (whichType == TxoutType::SCRIPTHASH || whichType == TxoutType::WITNESS_V0_SCRIPTHASH) {
-        CScript subscript;
-        std::unique_ptr<SigningProvider> provider = GetSolvingProvider(scriptPubKey);
-        uint160 hash;
-        if (whichType == TxoutType::WITNESS_V0_SCRIPTHASH) {
-            CRIPEMD160 hasher;
-            hasher.Write(&vSolutions[0][0], 32).Finalize(hash.begin());
-        } else // whichType == TxoutType::SCRIPTHASH
-            hash = uint160(vSolutions[0]);
-        if (provider && provider->GetCScript(CScriptID(hash), subscript)) {
-            TxoutType scriptType = Solver(subscript, vSolutions);
-            if (fProofOfStake && (scriptType == TxoutType::MULTISIG /*|| scriptType == TxoutType::MULTISIG_DATA*/))
-                whichType = scriptType; // pubkey is retrieved from PoS output below
-            else if (scriptType != TxoutType::WITNESS_V0_KEYHASH || !provider->GetPubKey(CKeyID(uint160(vSolutions[0])), pubkey))
-                return false;
-        } else
-            return false;
-    } else if (whichType == TxoutType::MULTISIG /*|| whichType == TxoutType::MULTISIG_DATA*/) {
-        if (vSolutions.size() != 3 || vSolutions.front()[0] != 1 || vSolutions.back()[0] != 1)
-            return false;
-        pubkey = CPubKey(vSolutions[1]);
-        if (!pubkey.IsValid())
-            return false;
-    } else {
+    const StakeSigningInfo info = GetStakeSigningInfo(scriptPubKey);
+    if (!info.can_sign)
         return false;
-    }
+    const TxoutType whichType = info.type;
+    if (whichType == TxoutType::MULTISIG && info.script_type != TxoutType::MULTISIG && !fProofOfStake)
+        return false; // p2sh/p2wsh-multisig is only supported for PoS, where the pubkey is retrieved from the output below
+    pubkey = info.pubkey;
 
     if (fProofOfStake) {
         TxoutType outputType = Solver(txout.scriptPubKey, vSolutions); // check the output
@@ -4709,19 +5642,12 @@ bool CWallet::GetBlockSigningPubKey(const CBlock& block, CPubKey& pubkey, bool&
             pubkeyInSig = true;
         } else if (whichType == TxoutType::PUBKEY || whichType == TxoutType::MULTISIG /*|| whichType == TxoutType::MULTISIG_DATA*/) { // p2pk and multisig PoS inputs don't place the pubkey in the scriptSig
             pubkeyInSig = false;
-            if (outputType == TxoutType::PUBKEYHASH || outputType == TxoutType::WITNESS_V0_KEYHASH) {
-                std::unique_ptr<SigningProvider> provider = GetSolvingProvider(txout.scriptPubKey);
-                if (!provider || !provider->GetPubKey(CKeyID(uint160(vSolutions[0])), pubkey)) // extract pubkey from output to put in coinbase
-                    return false;
-            } else if (outputType == TxoutType::SCRIPTHASH) {
-                CScript subscript;
-                std::unique_ptr<SigningProvider> provider = GetSolvingProvider(txout.scriptPubKey);
-                if (provider && provider->GetCScript(CScriptID(uint160(vSolutions[0])), subscript)) { // extract pubkey from script to put in coinbase
-                    outputType = Solver(subscript, vSolutions);
-                    if (outputType != TxoutType::WITNESS_V0_KEYHASH || !provider->GetPubKey(CKeyID(uint160(vSolutions[0])), pubkey))
-                        return false;
-                } else
+            if (outputType == TxoutType::PUBKEYHASH || outputType == TxoutType::WITNESS_V0_KEYHASH || outputType == TxoutType::SCRIPTHASH) {
+                // extract pubkey from output, or from its p2sh-p2wpkh script, to put in coinbase
+                const StakeSigningInfo output_info = GetStakeSigningInfo(txout.scriptPubKey);
+                if (!output_info.can_sign || (output_info.type != TxoutType::PUBKEYHASH && output_info.type != TxoutType::WITNESS_V0_KEYHASH))
                     return false;
+                pubkey = output_info.pubkey;
             } else
                 return false;
         } else
@@ -4768,10 +5694,26 @@ bool CWallet::SignBlock(CBlock& block, const CPubKey& pubkey) const
 {
     AssertLockHeld(cs_wallet);
 
+    if (m_stake_signing_cache_dirty.exchange(false)) {
+        m_stake_signing_cache.clear();
+        m_block_signing_spk_mans.clear();
+    }
+
+    // Try the ScriptPubKeyMan that signed with the key before first, if the
+    // wallet still has it
+    auto it = m_block_signing_spk_mans.find(pubkey.GetID());
+    if (it != m_block_signing_spk_mans.end()) {
+        auto spk_man = m_spk_managers.find(it->second);
+        if (spk_man != m_spk_managers.end() && spk_man->second->SignBlock(block, pubkey) == SigningResult::OK)
+            return true;
+    }
+
     // Try to sign with all ScriptPubKeyMans
     for (ScriptPubKeyMan* spk_man : GetAllScriptPubKeyMans()) {
-        if (spk_man->SignBlock(block, pubkey) == SigningResult::OK)
+        if (spk_man->SignBlock(block, pubkey) == SigningResult::OK) {
+            m_block_signing_spk_mans[pubkey.GetID()] = spk_man->GetID();
             return true;
+        }
     }
     return false;
 }
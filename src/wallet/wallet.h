@@ -13,6 +13,7 @@
 #include <policy/feerate.h>
 #include <psbt.h>
 #include <tinyformat.h>
+#include <util/bytevectorhash.h>
 #include <util/message.h>
 #include <util/strencodings.h>
 #include <util/string.h>
@@ -33,6 +34,8 @@
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -87,6 +90,18 @@ static const bool DEFAULT_WALLET_REJECT_LONG_CHAINS = false;
 static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 6;
 //! -walletrbf default
 static const bool DEFAULT_WALLET_RBF = false;
+//! -rescanbatchblocks default
+static const int DEFAULT_RESCAN_BATCH_BLOCKS = 100;
+//! -stakeconsolidate default
+static const bool DEFAULT_STAKE_CONSOLIDATE = false;
+//! -stakeconsolidatecount default
+static const unsigned int DEFAULT_STAKE_CONSOLIDATE_COUNT = 100;
+//! -stakeconsolidatesize default
+constexpr CAmount DEFAULT_STAKE_CONSOLIDATE_SIZE{1000 * COIN};
+//! -stakeconsolidatemaxfee default
+static const CAmount DEFAULT_STAKE_CONSOLIDATE_MAX_FEE = 200000; // 2 * DEFAULT_TRANSACTION_MINFEE
+//! Maximum number of outputs merged by one consolidation transaction
+static const unsigned int MAX_STAKE_CONSOLIDATE_INPUTS = 200;
 static const bool DEFAULT_WALLETBROADCAST = true;
 static const bool DEFAULT_DISABLE_WALLET = false;
 //! -maxtxfee default
@@ -212,6 +227,41 @@ struct CRecipient
     bool fSubtractFeeFromAmount;
 };
 
+/** A transaction merging small outputs that pay to the same script into one output. */
+struct StakeConsolidation
+{
+    CScript script;
+    std::vector<COutPoint> inputs;
+    CAmount amount{0};
+};
+
+/** The transactions that bring the number of spendable outputs of a wallet down to its target. */
+struct StakeConsolidationPlan
+{
+    //! Number of spendable confirmed outputs of the wallet
+    size_t utxo_count{0};
+    //! Number of small outputs left alone as they reach the stake minimum age and depth soon
+    size_t maturing_count{0};
+    //! Fee rate the transactions would pay
+    CFeeRate feerate;
+    //! Whether the fee rate is low enough for the transactions to be made automatically
+    bool fee_ok{false};
+    std::vector<StakeConsolidation> consolidations;
+};
+
+/** How the coinstake and the block are signed for an output script the wallet stakes with. */
+struct StakeSigningInfo
+{
+    //! Whether the wallet can stake with the script. The fields below are only set if it can.
+    bool can_sign{false};
+    //! Type of the script
+    TxoutType script_type{TxoutType::NONSTANDARD};
+    //! Type of the script, or of the redeem script of p2sh and p2wsh scripts
+    TxoutType type{TxoutType::NONSTANDARD};
+    //! The key of a key script, or the single key of a 1-of-1 multisig script
+    CPubKey pubkey;
+};
+
 typedef std::map<std::string, std::string> mapValue_t;
 
 
@@ -652,6 +702,38 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
     void AddToSpends(const uint256& wtxid) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
 
+    /** Ownership of a wallet transaction output, cached in m_wallet_utxos. */
+    struct WalletUTXO {
+        isminetype mine;
+        bool solvable;
+    };
+    /**
+     * Outputs of wallet transactions that are mine and not spent by a confirmed
+     * wallet transaction, which are the only outputs AvailableCoins looks at.
+     * Spends by unconfirmed transactions are still checked with IsSpent, as
+     * those may be abandoned or conflicted. Restored from the wallet summary
+     * after loading. Otherwise, and whenever IsMine may have changed, it is
+     * rebuilt from scratch by the next AvailableCoins call. Scripts that only
+     * became mine, e.g. of new keys, just have their outputs added.
+     */
+    mutable std::map<COutPoint, WalletUTXO> m_wallet_utxos GUARDED_BY(cs_wallet);
+    mutable std::atomic<bool> m_wallet_utxos_dirty{true};
+    //! Scripts added to m_ismine_index whose outputs m_wallet_utxos does not have yet
+    mutable std::unordered_set<CScript, ByteVectorHash> m_wallet_utxos_added_scripts GUARDED_BY(cs_wallet);
+    bool IsSpentByConfirmed(const COutPoint& outpoint) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    void UpdateWalletUTXO(const CWalletTx& wtx, unsigned int n) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /** Update the outputs a transaction creates and spends in m_wallet_utxos. */
+    void UpdateWalletUTXOs(const CWalletTx& wtx) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /** Remove the outputs of a transaction that is erased from mapWallet, and restore the ones it spent. */
+    void RemoveWalletUTXOs(const CWalletTx& wtx) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /** Rebuild m_wallet_utxos if it is dirty, or add the outputs of scripts that became mine. */
+    void UpdateWalletUTXOIndex() const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /** Restore m_wallet_utxos from the summary written when the wallet was last closed, if it still matches the wallet,
+     *  so that the first AvailableCoins call does not rebuild it. */
+    bool LoadWalletSummary() EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    //! Set once the wallet has loaded, so a summary is never written for a wallet that failed to load or was already closed
+    bool m_write_summary_on_close GUARDED_BY(cs_wallet){false};
+
     /**
      * Add a transaction to the wallet, or update it.  pIndex and posInBlock should
      * be set when the transaction was known to be included in a block.  When
@@ -667,6 +749,10 @@ private:
      */
     bool AddToWalletIfInvolvingMe(const CTransactionRef& tx, CWalletTx::Confirmation confirm, bool fUpdate) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
 
+    /* Whether a transaction paying to none of the wallet's scripts may still involve the wallet:
+     * it is in the wallet already, or it spends or conflicts with a wallet transaction. */
+    bool MayInvolveWallet(const CTransaction& tx) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, int conflicting_height, const uint256& hashTx);
 
@@ -698,6 +784,25 @@ private:
     /** Internal database handle. */
     std::unique_ptr<WalletDatabase> database;
 
+    /**
+     * Batch shared by the writes made for a connected block or for a chunk of
+     * rescanned blocks, between BeginWriteBatch and CommitWriteBatch. On
+     * SQLite the writes are made in one database transaction, which writes
+     * through other batches join too, so cs_wallet must be held from
+     * BeginWriteBatch until CommitWriteBatch.
+     */
+    std::unique_ptr<WalletBatch> m_write_batch GUARDED_BY(cs_wallet);
+    bool m_write_batch_txn GUARDED_BY(cs_wallet){false};
+    void BeginWriteBatch() EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /** Returns false, after rolling the writes back, if they could not be committed. */
+    bool CommitWriteBatch() EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /**
+     * Set once the writes of a connected or disconnected block could not be
+     * committed. The best block locator is then no longer moved forward, so
+     * the block is rescanned when the wallet is loaded again.
+     */
+    std::atomic<bool> m_block_write_failed{false};
+
     /**
      * The following is used to keep track of how far behind the wallet is
      * from the chain sync, and to allow clients to block on us being caught up.
@@ -721,6 +826,35 @@ private:
     // ScriptPubKeyMan::GetID. In many cases it will be the hash of an internal structure
     std::map<uint256, std::unique_ptr<ScriptPubKeyMan>> m_spk_managers;
 
+    /**
+     * Index of the scripts the ScriptPubKeyMans consider mine, with the highest
+     * isminetype any of them returns, so IsMine is a single lookup. Scripts not
+     * in the index are ISMINE_NO. The index is rebuilt by the first lookup after
+     * NotifyIsMineChanged, e.g. once the wallet loaded or keys were imported.
+     * Scripts of generated keys and topped up descriptors are queued by
+     * NotifyIsMineScriptsAdded, which may be called without cs_wallet, and
+     * merged by the next lookup.
+     */
+    mutable std::unordered_map<CScript, isminetype, ByteVectorHash> m_ismine_index GUARDED_BY(cs_wallet);
+    mutable std::atomic<bool> m_ismine_index_dirty{true};
+    mutable Mutex m_ismine_added_mutex;
+    mutable std::vector<std::pair<CScript, isminetype>> m_ismine_added GUARDED_BY(m_ismine_added_mutex);
+    mutable std::atomic<bool> m_ismine_added_pending{false};
+    void UpdateIsMineIndex() const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+
+    /**
+     * Cache of how blocks staked with an output script are signed, so the keys
+     * and scripts are looked up by the stake minter ahead of a stake rather than
+     * when one is found. Cleared on NotifyIsMineChanged, as new keys and scripts
+     * can make more outputs stakeable.
+     */
+    mutable std::unordered_map<CScript, StakeSigningInfo, ByteVectorHash> m_stake_signing_cache GUARDED_BY(cs_wallet);
+    //! Id of the ScriptPubKeyMan that last signed a block with a key
+    mutable std::map<CKeyID, uint256> m_block_signing_spk_mans GUARDED_BY(cs_wallet);
+    mutable std::atomic<bool> m_stake_signing_cache_dirty{false};
+    //! Destination derived ahead of a stake for -quantumsafestaking
+    Optional<CTxDestination> m_stake_destination GUARDED_BY(cs_wallet);
+
     bool CreateTransactionInternal(const std::vector<CRecipient>& vecSend, CTransactionRef& tx, CAmount& nFeeRet, int& nChangePosInOut, bilingual_str& error, const CCoinControl& coin_control, FeeCalculation& fee_calc_out, bool sign);
 
 public:
@@ -822,7 +956,7 @@ public:
      * completion the coin set and corresponding actual target value is
      * assembled
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, const CoinEligibilityFilter& eligibility_filter, std::vector<OutputGroup> groups,
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, const CoinEligibilityFilter& eligibility_filter, const std::vector<OutputGroup>& groups,
         std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CoinSelectionParams& coin_selection_params, bool& bnb_used) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
@@ -934,6 +1068,38 @@ public:
     Balance GetBalance(int min_depth = 0, bool avoid_reuse = true) const;
     CAmount GetAvailableBalance(const CCoinControl* coinControl = nullptr) const;
 
+private:
+    /**
+     * Running totals of the default GetBalance(), kept as the amount each
+     * wallet transaction contributes to them. The totals are computed in full
+     * on first use and then updated for the transactions affected by each
+     * wallet, mempool and block event. Invalidated by MarkDirty.
+     */
+    struct BalanceContribution {
+        Balance amounts;
+        //! Height of the block containing a coinbase or coinstake, or -1
+        int coinbase_height{-1};
+    };
+    mutable std::map<uint256, BalanceContribution> m_balance_contributions GUARDED_BY(cs_wallet);
+    mutable Balance m_balance_totals GUARDED_BY(cs_wallet);
+    mutable bool m_balance_totals_valid GUARDED_BY(cs_wallet){false};
+    //! Unconfirmed transactions in the mempool, which can become final as the tip moves.
+    mutable std::set<uint256> m_balance_mempool_txs GUARDED_BY(cs_wallet);
+    //! Coinbases and coinstakes in the main chain by the height of their block.
+    //! Their outputs mature or become immature again when the block
+    //! COINBASE_MATURITY blocks later is connected or disconnected.
+    mutable std::multimap<int, uint256> m_balance_coinbases GUARDED_BY(cs_wallet);
+
+    Balance GetBalanceContribution(const CWalletTx& wtx, int min_depth, bool avoid_reuse, std::set<uint256>& trusted_parents) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    void UpdateBalanceContribution(const CWalletTx& wtx) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /** Update the contributions of a transaction, of the transactions it spends and of its unconfirmed descendants. */
+    void UpdateBalanceContributions(const CWalletTx& wtx) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /** Update the contributions that change when the block at the given height is connected or disconnected. */
+    void UpdateTipDependentBalances(int height) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    void InvalidateBalanceTotals() EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+
+public:
+
     OutputType TransactionChangeType(const Optional<OutputType>& change_type, const std::vector<CRecipient>& vecSend);
 
     /**
@@ -984,6 +1150,25 @@ public:
      */
     void CommitTransaction(CTransactionRef tx, mapValue_t mapValue, std::vector<std::pair<std::string, std::string>> orderForm);
     bool SelectStakeCoins(std::set<CInputCoin>& setCoins) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /**
+     * Plan the merging of outputs smaller than m_stake_consolidate_size into
+     * outputs of about that size, until no more than m_stake_consolidate_count
+     * spendable outputs are left, so that staking doesn't slow down as the
+     * outputs created by stakes pile up.
+     */
+    StakeConsolidationPlan PlanStakeConsolidation() const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    //! Create and broadcast the transactions of a plan, returning how many were made
+    size_t ConsolidateStakeCoins(const StakeConsolidationPlan& plan) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    //! Look up how blocks staked with an output script are signed, from the cache if it was looked up before
+    StakeSigningInfo GetStakeSigningInfo(const CScript& script) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /**
+     * Look up the signing info of the scripts of the given stake coins and, with
+     * -quantumsafestaking, derive the destination of the next coinstake, so that
+     * little is left to do once a kernel is found.
+     */
+    void PrepareStakeSigning(const std::set<CInputCoin>& coins) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    //! Get a new destination for a coinstake output, the one derived ahead if there is one
+    bool GetStakeDestination(CTxDestination& dest, std::string& error) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
     bool GetBlockSigningPubKey(const CBlock& block, CPubKey& pubkey, bool& pubkeyInSig) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
     bool SignBlock(CBlock& block, const CPubKey& pubkey) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
 
@@ -1025,6 +1210,10 @@ public:
     Optional<OutputType> m_default_change_type{};
     /** Absolute maximum transaction fee (in satoshis) used by default for the wallet */
     CAmount m_default_max_tx_fee{DEFAULT_TRANSACTION_MAXFEE};
+    bool m_stake_consolidate{DEFAULT_STAKE_CONSOLIDATE}; //!< Override with -stakeconsolidate
+    unsigned int m_stake_consolidate_count{DEFAULT_STAKE_CONSOLIDATE_COUNT}; //!< Override with -stakeconsolidatecount
+    CAmount m_stake_consolidate_size{DEFAULT_STAKE_CONSOLIDATE_SIZE}; //!< Override with -stakeconsolidatesize
+    CFeeRate m_stake_consolidate_max_fee{DEFAULT_STAKE_CONSOLIDATE_MAX_FEE}; //!< Override with -stakeconsolidatemaxfee
 
     size_t KeypoolCountExternalKeys() const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
     bool TopUpKeyPool(unsigned int kpSize = 0);
@@ -1092,9 +1281,12 @@ public:
     //! Flush wallet (bitdb flush)
     void Flush();
 
-    //! Close wallet database
+    //! Close wallet database, writing the wallet summary first
     void Close();
 
+    //! Write the summary restored by the next load, once nothing can change the wallet anymore
+    void WriteWalletSummary() EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+
     /** Wallet is about to be unloaded */
     boost::signals2::signal<void ()> NotifyUnload;
 
@@ -1231,6 +1423,22 @@ public:
 
     const CKeyingMaterial& GetEncryptionKey() const override;
     bool HasEncryptionKeys() const override;
+    void NotifyIsMineChanged() override
+    {
+        m_ismine_index_dirty = true;
+        m_wallet_utxos_dirty = true;
+        m_stake_signing_cache_dirty = true;
+    }
+    void NotifyIsMineScriptsAdded(std::vector<std::pair<CScript, isminetype>> scripts) override
+    {
+        if (scripts.empty()) return;
+        {
+            LOCK(m_ismine_added_mutex);
+            m_ismine_added.insert(m_ismine_added.end(), std::make_move_iterator(scripts.begin()), std::make_move_iterator(scripts.end()));
+        }
+        m_ismine_added_pending = true;
+        m_stake_signing_cache_dirty = true;
+    }
 
     /** Get last block processed height */
     int GetLastBlockHeight() const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet)
@@ -1294,6 +1502,9 @@ void MaybeResendWalletTxs();
 // Called periodically to ensure that no unspendable orphaned coinstakes remain in any wallets
 void AbandonOrphanedCoinStakes();
 
+// Called periodically to merge the small outputs of wallets with -stakeconsolidate while fees are low
+void MaybeConsolidateStakeCoins();
+
 /** RAII object to check and reserve a wallet rescan */
 class WalletRescanReserver
 {
@@ -51,6 +51,7 @@ const std::string WALLETDESCRIPTOR{"walletdescriptor"};
 const std::string WALLETDESCRIPTORCACHE{"walletdescriptorcache"};
 const std::string WALLETDESCRIPTORCKEY{"walletdescriptorckey"};
 const std::string WALLETDESCRIPTORKEY{"walletdescriptorkey"};
+const std::string WALLET_SUMMARY{"walletsummary"};
 const std::string WATCHMETA{"watchmeta"};
 const std::string WATCHS{"watchs"};
 } // namespace DBKeys
@@ -175,6 +176,21 @@ bool WalletBatch::ReadBestBlock(CBlockLocator& locator)
     return m_batch->Read(DBKeys::BESTBLOCK_NOMERKLE, locator);
 }
 
+bool WalletBatch::WriteWalletSummary(const CWalletSummary& summary)
+{
+    return WriteIC(DBKeys::WALLET_SUMMARY, summary);
+}
+
+bool WalletBatch::ReadWalletSummary(CWalletSummary& summary)
+{
+    return m_batch->Read(DBKeys::WALLET_SUMMARY, summary);
+}
+
+bool WalletBatch::EraseWalletSummary()
+{
+    return EraseIC(DBKeys::WALLET_SUMMARY);
+}
+
 bool WalletBatch::WriteOrderPosNext(int64_t nOrderPosNext)
 {
     return WriteIC(DBKeys::ORDERPOSNEXT, nOrderPosNext);
@@ -660,7 +676,8 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             wss.fIsEncrypted = true;
         } else if (strType != DBKeys::BESTBLOCK && strType != DBKeys::BESTBLOCK_NOMERKLE &&
                    strType != DBKeys::MINVERSION && strType != DBKeys::ACENTRY &&
-                   strType != DBKeys::VERSION && strType != DBKeys::SETTINGS) {
+                   strType != DBKeys::VERSION && strType != DBKeys::SETTINGS &&
+                   strType != DBKeys::WALLET_SUMMARY) {
             wss.m_unknown_records++;
         }
     } catch (const std::exception& e) {
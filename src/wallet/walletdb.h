@@ -12,6 +12,8 @@
 #include <wallet/db.h>
 #include <wallet/walletutil.h>
 #include <key.h>
+#include <primitives/transaction.h>
+#include <uint256.h>
 
 #include <stdint.h>
 #include <string>
@@ -78,6 +80,7 @@ extern const std::string VERSION;
 extern const std::string WALLETDESCRIPTOR;
 extern const std::string WALLETDESCRIPTORCKEY;
 extern const std::string WALLETDESCRIPTORKEY;
+extern const std::string WALLET_SUMMARY;
 extern const std::string WATCHMETA;
 extern const std::string WATCHS;
 } // namespace DBKeys
@@ -167,6 +170,39 @@ public:
     }
 };
 
+/**
+ * Ownership of the wallet's outputs, written when the wallet is closed so that
+ * the first AvailableCoins or balance call after the next load does not have
+ * to check every output of every transaction with IsMine. Loading itself still
+ * reads every transaction. It is erased when the wallet is loaded, as any
+ * later change to the wallet invalidates it.
+ */
+class CWalletSummary
+{
+public:
+    static const int CURRENT_VERSION = 1;
+
+    struct Output {
+        COutPoint outpoint;
+        uint8_t mine;
+        bool solvable;
+
+        SERIALIZE_METHODS(Output, obj) { READWRITE(obj.outpoint, obj.mine, obj.solvable); }
+    };
+
+    int nVersion = CURRENT_VERSION;
+    //! Best block of the wallet's locator when the summary was written
+    uint256 best_block;
+    uint64_t tx_count = 0;
+    uint64_t script_count = 0;
+    std::vector<Output> outputs;
+
+    SERIALIZE_METHODS(CWalletSummary, obj)
+    {
+        READWRITE(obj.nVersion, obj.best_block, obj.tx_count, obj.script_count, obj.outputs);
+    }
+};
+
 /** Access to the wallet database.
  * Opens the database and provides read and write access to it. Each read and write is its own transaction.
  * Multiple operation transactions can be started using TxnBegin() and committed using TxnCommit()
@@ -234,6 +270,10 @@ public:
     bool WriteBestBlock(const CBlockLocator& locator);
     bool ReadBestBlock(CBlockLocator& locator);
 
+    bool WriteWalletSummary(const CWalletSummary& summary);
+    bool ReadWalletSummary(CWalletSummary& summary);
+    bool EraseWalletSummary();
+
     bool WriteOrderPosNext(int64_t nOrderPosNext);
 
     bool ReadPool(int64_t nPool, CKeyPool& keypool);